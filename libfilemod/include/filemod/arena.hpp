@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace filemod {
+
+// Strings stored back to back in one buffer, e.g. paths of a query result,
+// instead of an allocation each.
+//
+// Views of the strings are kept in one array too. They stay valid when the
+// arena is moved, but not across `push_back`, which may grow the buffer.
+class string_arena {
+ public:
+  string_arena() = default;
+
+  string_arena(const string_arena &) = delete;
+  string_arena &operator=(const string_arena &) = delete;
+
+  string_arena(string_arena &&) noexcept = default;
+  string_arena &operator=(string_arena &&) noexcept = default;
+
+  void reserve(size_t strs, size_t bytes) {
+    m_views.reserve(strs);
+    if (bytes > m_buf.capacity()) {
+      grow_(bytes);
+    }
+  }
+
+  void push_back(std::string_view str) {
+    if (m_buf.size() + str.size() > m_buf.capacity()) {
+      grow_(std::max(2 * m_buf.capacity(), m_buf.size() + str.size()));
+    }
+    auto *data = m_buf.data() + m_buf.size();
+    m_buf.insert(m_buf.end(), str.begin(), str.end());
+    m_views.emplace_back(data, str.size());
+  }
+
+  [[nodiscard]] size_t size() const noexcept { return m_views.size(); }
+
+  // Bytes of all strings.
+  [[nodiscard]] size_t bytes() const noexcept { return m_buf.size(); }
+
+  [[nodiscard]] std::string_view operator[](size_t i) const noexcept {
+    return m_views[i];
+  }
+
+  // Views of strings [first, last).
+  [[nodiscard]] std::span<const std::string_view> views(
+      size_t first, size_t last) const noexcept {
+    return {m_views.data() + first, last - first};
+  }
+
+ private:
+  std::vector<char> m_buf;
+  std::vector<std::string_view> m_views;
+
+  // Move the buffer to one of `capacity` bytes, views rebased to it.
+  void grow_(size_t capacity) {
+    std::vector<char> buf;
+    buf.reserve(capacity);
+    buf.insert(buf.end(), m_buf.begin(), m_buf.end());
+    for (auto &view : m_views) {
+      view = {buf.data() + (view.data() - m_buf.data()), view.size()};
+    }
+    m_buf = std::move(buf);
+  }
+};
+
+// Views of `strs`, for functions taking strings of an arena.
+inline std::vector<std::string_view> views_of(
+    const std::vector<std::string> &strs) {
+  return {strs.begin(), strs.end()};
+}
+
+}  // namespace filemod
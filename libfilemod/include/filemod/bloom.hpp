@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+namespace filemod {
+
+// Bloom filter over strings, serialized as bytes to be stored in database.
+// Strings cannot be removed, a filter only answers "maybe" or "definitely
+// not".
+class bloom_filter {
+ public:
+  // Empty filter sized for `capacity` strings at about 1% false positives.
+  explicit bloom_filter(size_t capacity = 0);
+
+  // Filter serialized by `to_bytes`, or nullopt if `bytes` is malformed.
+  static std::optional<bloom_filter> from_bytes(
+      const std::vector<unsigned char> &bytes);
+
+  [[nodiscard]] std::vector<unsigned char> to_bytes() const;
+
+  void add(std::string_view str);
+
+  [[nodiscard]] bool may_contain(std::string_view str) const;
+
+  // Number of strings added, duplicates included.
+  [[nodiscard]] size_t size() const noexcept { return m_size; }
+
+  [[nodiscard]] size_t capacity() const noexcept { return m_capacity; }
+
+ private:
+  std::vector<uint64_t> m_words;
+  uint64_t m_size = 0;
+  uint64_t m_capacity = 0;
+};
+
+}  // namespace filemod
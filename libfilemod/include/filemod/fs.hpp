@@ -4,7 +4,11 @@
 
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
+#include <functional>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "filemod/fs_manager.hpp"
@@ -15,6 +19,41 @@ const char BACKUP_DIR[] = "___filemod_backup";
 const char FILEMOD_TEMP_DIR[] = "joexie.filemod";
 const char TMP_UNINSTALLED[] = "___filemod_uninstalled";
 const char TMP_EXTRACTED[] = "___extracted";
+const char BLOB_DIR[] = "___filemod_blobs";
+const char GEN_NEXT_SUFFIX[] = ".filemod_next";
+const char GEN_PREV_SUFFIX[] = ".filemod_prev";
+const char GEN_STALE_SUFFIX[] = ".filemod_stale";
+
+// Paths of mod files in target `tar_dir`. If `nocase`, components not found
+// as given are matched to existing entries ignoring ASCII case, so files of a
+// mod land in existing directories of another case, e.g. `DATA/a` in `data/`.
+// Listings are cached, entries created afterwards are only found as given.
+class tar_paths {
+ public:
+  tar_paths(std::filesystem::path tar_dir, bool nocase)
+      : m_tar_dir{std::move(tar_dir)}, m_nocase{nocase} {}
+
+  [[nodiscard]] const std::filesystem::path &dir() const noexcept {
+    return m_tar_dir;
+  }
+
+  // `file_rel` as found below `dir()`, components not found kept as given.
+  std::filesystem::path rel(const std::filesystem::path &file_rel);
+
+ private:
+  std::filesystem::path m_tar_dir;
+  bool m_nocase;
+  // found directories by their given relative path
+  std::unordered_map<std::string, std::filesystem::path> m_dirs;
+  // names of entries of listed directories by their case-folded names
+  std::unordered_map<std::string,
+                     std::unordered_map<std::string, std::filesystem::path>>
+      m_listings;
+
+  // Entry `name` of directory `dir_rel` as found.
+  std::filesystem::path find_(const std::filesystem::path &dir_rel,
+                              const std::filesystem::path &name);
+};
 
 // internal transaction scope
 class tx_scope {
@@ -22,7 +61,24 @@ class tx_scope {
   explicit tx_scope(tx_scope *parent, bool log = true)
       : m_fsman{log}, m_parent{parent} {}
 
-  tx_scope &new_child() { return m_children.emplace_back(this); }
+  tx_scope &new_child() {
+    m_child_marks.push_back(m_fsman.size());
+    return m_children.emplace_back(this);
+  }
+
+  // `n` children beginning at once, to be changed concurrently. Returned
+  // pointers are valid until another child is added.
+  std::vector<tx_scope *> new_children(size_t n) {
+    m_child_marks.insert(m_child_marks.end(), n, m_fsman.size());
+    std::vector<tx_scope *> children;
+    for (size_t i = 0; i < n; ++i) {
+      m_children.emplace_back(this);
+    }
+    for (size_t i = m_children.size() - n; i < m_children.size(); ++i) {
+      children.push_back(&m_children[i]);
+    }
+    return children;
+  }
 
   tx_scope *parent() { return m_parent; }
 
@@ -37,6 +93,8 @@ class tx_scope {
 
  private:
   std::vector<tx_scope> m_children;
+  // number of own records when each child began
+  std::vector<size_t> m_child_marks;
   fsman m_fsman;
   tx_scope *const m_parent = nullptr;
   bool m_rollbacked = false;
@@ -77,6 +135,14 @@ class FS {
     return std::filesystem::temp_directory_path() /= FILEMOD_TEMP_DIR;
   }
 
+  // Generation replaced by the last activation of `tar_dir`, see
+  // activate_generation().
+  static std::filesystem::path get_prev_gen(
+      const std::filesystem::path &tar_dir) {
+    auto prev_gen = tar_dir.parent_path() / tar_dir.filename();
+    return prev_gen += GEN_PREV_SUFFIX;
+  }
+
   static std::filesystem::path get_uninst_dir(
       const std::filesystem::path &tar_id) {
     return (get_tmp_dir() /= tar_id) /= TMP_UNINSTALLED;
@@ -105,22 +171,46 @@ class FS {
       int64_t tar_id, const std::filesystem::path &mod_name,
       const std::filesystem::path &mod_src, copy_mod_t copy_mod);
 
-  // Create symlinks from cfg_mod to tar_dir.
+  // Create symlinks from cfg_mod to tar_dir. Original files of tar_dir in
+  // place of mod files are backed up. If `nocase`, both are matched ignoring
+  // ASCII case, see `tar_paths`.
   //
   // May fail deal to no privileged permission on Windows.
   //
   // Returns relative backup files.
   std::vector<std::filesystem::path> install_mod(
       const std::filesystem::path &cfg_mod,
-      const std::filesystem::path &tar_dir);
+      const std::filesystem::path &tar_dir, bool nocase = false);
 
-  // Remove mod files (symlinks) from tar_dir.
+  // Remove mod files (symlinks) from tar_dir, matched as by `install_mod`.
   // And restore backup files to tar_dir.
   void uninstall_mod(
       const std::filesystem::path &cfg_mod,
       const std::filesystem::path &tar_dir,
       const std::vector<std::filesystem::path> &sorted_mod_file_rels,
-      const std::vector<std::filesystem::path> &sorted_bak_file_rels);
+      const std::vector<std::filesystem::path> &sorted_bak_file_rels,
+      bool nocase = false);
+
+  // Recreate mod file `file_rel` in `tar.dir()` the way `install_mod` creates
+  // it, as a directory or a symlink to the mod file, along with missing parent
+  // directories. A non-directory file in place is moved to the backup
+  // directory first, superseding a previous backup of it.
+  //
+  // Returns the file backed up relative to `tar.dir()`, empty if none.
+  std::filesystem::path repair_file(const std::filesystem::path &cfg_mod,
+                                    tar_paths &tar,
+                                    const std::filesystem::path &file_rel);
+
+  // Delete files of cfg_mod, and directories left empty.
+  void remove_mod_files(
+      const std::filesystem::path &cfg_mod,
+      const std::vector<std::filesystem::path> &sorted_file_rels);
+
+  // Copy files from mod_dir to cfg_mod, parents must exist or come first.
+  void copy_mod_files(
+      const std::filesystem::path &mod_dir,
+      const std::filesystem::path &cfg_mod,
+      const std::vector<std::filesystem::path> &sorted_file_rels);
 
   // Delete cfg_mod and log all changes
   void remove_mod(const std::filesystem::path &cfg_mod);
@@ -128,13 +218,55 @@ class FS {
   // Delete cfg_dir/<tar_id> and log all changes
   void remove_target(int64_t tar_id);
 
+  // Store regular file `file`, created in the current transaction, in the
+  // blob store as the blob of content `hash`. `file` becomes a hardlink of the
+  // blob, an existing blob is reused.
+  //
+  // Returns false and leaves `file` as is if the existing blob of `hash` has
+  // different content.
+  bool link_blob(const std::filesystem::path &file, const std::string &hash);
+
+  // Delete blobs of `hashes` and log all changes
+  void remove_blobs(const std::vector<std::string> &hashes);
+
+  // Create `<tar_dir>.filemod_next` holding the same tree as `tar_dir`, with
+  // non-directories hard linked, to be changed in place of `tar_dir`.
+  //
+  // Returns the new generation directory.
+  std::filesystem::path begin_generation(const std::filesystem::path &tar_dir);
+
+  // Exchange generation `gen_dir` with `tar_dir`, atomically where the
+  // filesystem supports it. The replaced generation is kept as
+  // `<tar_dir>.filemod_prev`, the one kept before is deleted once the
+  // outermost transaction commits.
+  //
+  // Not to be called in `parallel_tx`.
+  void activate_generation(const std::filesystem::path &tar_dir,
+                           const std::filesystem::path &gen_dir);
+
   void rename_mod(int64_t tar_id, const std::filesystem::path &oldname,
                   const std::filesystem::path &newname);
 
+  // Call `func(i)` for each i in [0, n) in parallel, see parallel_for(), each
+  // i in its own nested scope of the current transaction. Calls of different
+  // i must not change the same files.
+  void parallel_tx(size_t n, const std::function<void(size_t)> &func);
+
+  // Report changes made afterwards to `task`, or to none if null. Reporting
+  // throws `cancelled` once the task is stopped.
+  void set_task(task *task) noexcept { m_task = task; }
+
+  [[nodiscard]] task *get_task() const noexcept { return m_task; }
+
   std::filesystem::path get_cfg_tar(int64_t tar_id) {
     return m_cfg_dir / std::to_string(tar_id);
   }
 
+  // Blobs are fanned out by the first 2 digits of their hash.
+  std::filesystem::path get_blob(const std::string &hash) {
+    return (m_cfg_dir / BLOB_DIR / hash.substr(0, 2)) /= hash;
+  }
+
   std::filesystem::path get_cfg_mod(int64_t tar_id,
                                     const std::filesystem::path &mod_rel_dir) {
     return get_cfg_tar(tar_id) /= mod_rel_dir;
@@ -144,11 +276,25 @@ class FS {
   const std::filesystem::path m_cfg_dir;
   tx_scope m_root_scope{nullptr, false};
   tx_scope *m_curr_scope = &m_root_scope;
+  task *m_task = nullptr;
+  // generations replaced in the outermost transaction, deleted once it
+  // commits
+  std::vector<std::filesystem::path> m_stale_gens;
+
+  // Current scope of the calling thread, `m_curr_scope` unless in a worker of
+  // `parallel_tx`.
+  tx_scope *&curr_scope_();
+
+  // fsman of the current scope, reporting to `m_task`.
+  fsman &fsman_();
 
   void move_file_(const std::filesystem::path &src_file,
                   const std::filesystem::path &dest_file,
                   const std::filesystem::path &dest_dir);
 
+  // Move `src_file` to `dest_file`, creating its parents below the base.
+  void move_file_(path_ref src_file, path_buf &dest_file);
+
   // Returns relative backup files
   std::vector<std::filesystem::path> backup_files_(
       const std::filesystem::path &cfg_mod,
@@ -166,7 +312,7 @@ class FS {
   void begin_tx_();
 
   // Proxy function for `fs_tx`.
-  void end_tx_();
+  void end_tx_(bool committed);
 
   friend fs_tx;
 
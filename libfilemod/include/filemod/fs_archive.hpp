@@ -1,15 +1,61 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "filemod/fs_manager.hpp"
 
 namespace filemod {
 
-// Extract archive `filename` to destination directory `dest_dir`.
+struct archive_file {
+  std::filesystem::path rel;
+  int64_t size;
+  bool is_dir;
+};
+
+// CRC-32 and uncompressed size of a regular file of a zip archive.
+struct zip_crc {
+  uint32_t crc;
+  uint64_t size;
+};
+
+// Extract archive `filename` to destination directory `dest_dir`. Returns
+// relative paths of entries, and of directories created as their parents.
 // Require setting LC_CTYPE to UTF-8, e.g. `setlocale(LC_CTYPE, "en_US.UTF-8")`.
 std::vector<std::filesystem::path> copy_mod_a(
     const std::filesystem::path &filepath, const std::filesystem::path &destdir,
     fsman &fsman);
 
+// Extract only entries of relative paths `filter` returns true for, one by
+// one.
+std::vector<std::filesystem::path> copy_mod_a(
+    const std::filesystem::path &filepath, const std::filesystem::path &destdir,
+    fsman &fsman,
+    const std::function<bool(const std::filesystem::path &)> &filter);
+
+// Read the entries of archive `filepath` from its headers, without extracting
+// them. Relative paths are the same as `copy_mod_a` returns.
+// Throws exception if the archive cannot be read.
+// Require setting LC_CTYPE to UTF-8, e.g. `setlocale(LC_CTYPE, "en_US.UTF-8")`.
+std::vector<archive_file> scan_archive(const std::filesystem::path &filepath);
+
+// Same as `scan_archive` for zip archives, read from the central directory
+// only. Returns nothing for other archives, whose headers are spread over the
+// compressed stream, e.g. tar.gz or solid rar.
+// Throws exception if the archive cannot be read.
+std::optional<std::vector<archive_file>> scan_zip(
+    const std::filesystem::path &filepath);
+
+// CRC-32s of regular files of zip archive `filepath` by relative paths as
+// `copy_mod_a` returns, UTF-8 encoded, read from its central directory only.
+// Zip64 entries and names in a legacy code page are left out, none are found
+// if it is no zip archive or cannot be read.
+std::unordered_map<std::string, zip_crc> read_zip_crcs(
+    const std::filesystem::path &filepath);
+
 }  // namespace filemod
\ No newline at end of file
@@ -1,162 +1,129 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
-#include <memory>
 #include <vector>
 
 #include "filemod/fs_utils.hpp"
+#include "filemod/path_buf.hpp"
+#include "filemod/task.hpp"
 
 namespace filemod {
 
-class fsman;
-
-class fs_rec_base {
- public:
-  template <typename S, typename D>
-  explicit fs_rec_base(S &&src, D &&dest)
-      : m_src{std::forward<S>(src)}, m_dest{std::forward<D>(dest)} {}
-
-  virtual void revert() = 0;
-
- protected:
-  std::filesystem::path m_src;
-  std::filesystem::path m_dest;
-
-  friend fsman;
+// Changes to files made through `fsman`, logged to revert them.
+enum class fs_rec_kind : unsigned char {
+  create,       // dest created
+  mv_f,         // file src moved to dest
+  cp_f,         // file src copied to dest
+  rm_d,         // empty directory dest removed
+  rename_d,     // directory src renamed to dest
+  create_tree,  // directory dest created along w/ all its content
+  exchange_d,   // directories src and dest exchanged
 };
 
-class fs_rec_create : public fs_rec_base {
+class fsman {
  public:
-  using fs_rec_base::fs_rec_base;
+  explicit fsman(bool log = true) : m_log{log} {}
 
-  void revert() override { std::filesystem::remove(m_dest); }
-};
+  [[nodiscard]] bool log() const { return m_log; }
 
-struct fs_rec_mv_f : public fs_rec_base {
- public:
-  using fs_rec_base::fs_rec_base;
+  // Number of records.
+  [[nodiscard]] size_t size() const noexcept { return m_recs.size(); }
 
-  void revert() override;
-};
+  void revert() { revert(0, m_recs.size()); }
 
-class fs_rec_cp_f : public fs_rec_base {
- public:
-  using fs_rec_base::fs_rec_base;
+  // Revert records [first, last) in reverse order.
+  void revert(size_t first, size_t last);
 
-  void revert() override { std::filesystem::remove(m_dest); }
-};
+  void create_d(path_ref dest);
 
-class fs_rec_rm_d : public fs_rec_base {
- public:
-  using fs_rec_base::fs_rec_base;
+  void create_s(path_ref src, path_ref dest);
 
-  void revert() override { std::filesystem::create_directories(m_dest); }
-};
+  void create_h(path_ref src, path_ref dest);
 
-class fs_rec_rename_d : public fs_rec_base {
- public:
-  using fs_rec_base::fs_rec_base;
+  void log_create(path_ref dest) {
+    log_(fs_rec_kind::create, native_view{}, dest);
+  }
 
-  void revert() override { std::filesystem::rename(m_dest, m_src); }
-};
+  void mv_f(path_ref src, path_ref dest);
 
-class fsman {
- public:
-  explicit fsman(bool log = true) : m_log{log} {}
+  void log_mv_f(path_ref src, path_ref dest) {
+    log_(fs_rec_kind::mv_f, src, dest);
+  }
 
-  [[nodiscard]] bool log() const { return m_log; }
+  void cp_f(path_ref src, path_ref dest);
 
-  [[nodiscard]] const std::vector<std::unique_ptr<fs_rec_base>> &records()
-      const {
-    return m_recs;
+  void log_cp_f(path_ref dest) {
+    log_(fs_rec_kind::cp_f, native_view{}, dest);
   }
 
-  void revert();
+  void rm_d(path_ref dest);
 
-  template <typename D>
-  void create_d(D &&dest) {
-    if (std::filesystem::create_directory(dest)) {
-      log_create(std::forward<D>(dest));
-    }
+  void log_rm_d(path_ref dest) {
+    log_(fs_rec_kind::rm_d, native_view{}, dest);
   }
 
-  template <typename S, typename D>
-  void create_s(S &&src, D &&dest) {
-    std::filesystem::create_symlink(src, dest);
-    log_create(std::forward<D>(dest));
+  // Log directory `dest` created along with all its content.
+  void log_create_tree(path_ref dest) {
+    log_(fs_rec_kind::create_tree, native_view{}, dest);
   }
 
-  template <typename D>
-  void log_create(D &&dest) {
-    if (m_log) {
-      m_recs.push_back(std::make_unique<fs_rec_create>(std::filesystem::path{},
-                                                       std::forward<D>(dest)));
-    }
-  }
+  void exchange_d(path_ref src, path_ref dest);
 
-  template <typename S, typename D>
-  void mv_f(S &&src, D &&dest) {
-    cross_filesystem_mv(src, dest);
-    log_mv_f(std::forward<S>(src), std::forward<D>(dest));
-  }
+  void rename_d(path_ref src, path_ref dest);
 
-  template <typename S, typename D>
-  void log_mv_f(S &&src, D &&dest) {
-    if (m_log) {
-      m_recs.push_back(std::make_unique<fs_rec_mv_f>(std::forward<S>(src),
-                                                     std::forward<D>(dest)));
-    }
+  void log_rename_d(path_ref src, path_ref dest) {
+    log_(fs_rec_kind::rename_d, src, dest);
   }
 
-  template <typename S, typename D>
-  void cp_f(S &&src, D &&dest) {
-    std::filesystem::copy_file(src, dest);
-    log_cp_f(std::forward<D>(dest));
+  void reset() {
+    m_recs.clear();
+    m_paths.clear();
   }
 
-  template <typename D>
-  void log_cp_f(D &&dest) {
-    if (m_log) {
-      m_recs.push_back(std::make_unique<fs_rec_cp_f>(std::filesystem::path(),
-                                                     std::forward<D>(dest)));
-    }
-  }
+  // Task the changes are reported to, if any.
+  void set_task(task *task) noexcept { m_task = task; }
 
-  template <typename D>
-  void rm_d(D &&dest) {
-    std::error_code ec;
-    if (std::filesystem::remove(dest, ec)) {
-      log_rm_d(std::forward<D>(dest));
-    }
-  }
+  [[nodiscard]] task *get_task() const noexcept { return m_task; }
 
-  template <typename D>
-  void log_rm_d(D &&dest) {
-    if (m_log) {
-      m_recs.push_back(std::make_unique<fs_rec_rm_d>(std::filesystem::path(),
-                                                     std::forward<D>(dest)));
+  // Report `files` of `bytes` changed to the task, and throw `cancelled` if it
+  // is stopped. Call after logging the changes, so they are rolled back.
+  void report(uint64_t files, uint64_t bytes) {
+    if (m_task) {
+      m_task->add_done(files, bytes);
+      m_task->check_stop();
     }
   }
 
-  template <typename S, typename D>
-  void rename_d(S &&src, D &&dest) {
-    std::filesystem::rename(src, dest);
-    log_rename_d(std::forward<S>(src), std::forward<D>(dest));
-  }
+ private:
+  // Paths of a record are stored back to back in `m_paths`, after those of
+  // the previous record, so logging does not allocate once it has grown.
+  struct record {
+    fs_rec_kind kind;
+    size_t src_end;
+    size_t dest_end;
+  };
+
+  std::vector<record> m_recs;
+  native_string m_paths;
+  bool m_log = true;
+  task *m_task = nullptr;
 
-  template <typename S, typename D>
-  void log_rename_d(S &&src, D &&dest) {
+  void log_(fs_rec_kind kind, native_view src, path_ref dest) {
     if (m_log) {
-      m_recs.push_back(std::make_unique<fs_rec_rename_d>(
-          std::forward<S>(src), std::forward<D>(dest)));
+      m_paths.append(src);
+      size_t src_end = m_paths.size();
+      m_paths.append(dest.view());
+      m_recs.push_back(
+          {.kind = kind, .src_end = src_end, .dest_end = m_paths.size()});
     }
   }
 
-  void reset() { m_recs.clear(); }
+  void log_(fs_rec_kind kind, path_ref src, path_ref dest) {
+    log_(kind, src.view(), dest);
+  }
 
- private:
-  std::vector<std::unique_ptr<fs_rec_base>> m_recs;
-  bool m_log = true;
+  void revert_(const record &rec, size_t begin);
 };
 
 }  // namespace filemod
\ No newline at end of file
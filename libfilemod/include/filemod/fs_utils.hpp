@@ -2,9 +2,23 @@
 
 #include <filesystem>
 
+#include "filemod/path_buf.hpp"
+
 namespace filemod {
 
-void cross_filesystem_mv(const std::filesystem::path &src,
-                         const std::filesystem::path &dest);
+void cross_filesystem_mv(path_ref src, path_ref dest);
+
+// Copy regular file `src` to non-existing `dest`, as a reflink when the
+// filesystem supports it.
+void copy_file_cow(path_ref src, path_ref dest);
+
+// Exchange directories `a` and `b`, atomically where the filesystem supports
+// it, otherwise through a temporary name next to `a`.
+void exchange_dirs(const std::filesystem::path &a,
+                   const std::filesystem::path &b);
+
+// Whether regular files `a` and `b` have identical content.
+bool same_content(const std::filesystem::path &a,
+                  const std::filesystem::path &b);
 
 }  // namespace filemod
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace filemod {
+
+// Streaming XXH64, a fast non-cryptographic hash.
+class xxh64 {
+ public:
+  explicit xxh64(uint64_t seed = 0);
+
+  void update(const void *data, size_t len);
+
+  [[nodiscard]] uint64_t digest() const;
+
+ private:
+  uint64_t m_acc[4];
+  uint64_t m_seed;
+  uint64_t m_total_len = 0;
+  unsigned char m_buf[32];
+  size_t m_buf_len = 0;
+};
+
+// 16 lowercase hex digits.
+std::string hash_to_str(uint64_t hash);
+
+// XXH64 of the file content as 16 lowercase hex digits.
+// Throws exception if the file cannot be read.
+std::string hash_file(const std::filesystem::path &path);
+
+}  // namespace filemod
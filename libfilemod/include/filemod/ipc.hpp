@@ -0,0 +1,60 @@
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "filemod/utils.hpp"
+
+namespace filemod {
+
+const char SOCKFILE[] = "filemod.sock";
+
+// A command line run by a server on behalf of a client.
+struct ipc_request {
+  std::string cwd{};  // working directory of the client, utf-8
+  std::vector<std::string> args{};  // utf-8, program name excluded
+};
+
+struct ipc_response {
+  int code = 0;  // exit code of the command
+  std::string out{};
+  std::string err{};
+};
+
+// Handles a request by filling its response. Returns false to stop serving
+// once the response is sent.
+using ipc_handler = std::function<bool(const ipc_request &, ipc_response &)>;
+
+// Path of the local socket `filemod serve` listens on, in config directory.
+FILEMOD_API std::filesystem::path get_socket_path();
+
+/**
+ * @brief Serve requests on local socket `socket_path`, one at a time, until
+ * `handler` returns false.
+ *
+ * The socket is only accessible to the current user. A socket file left by a
+ * server that did not exit cleanly is replaced, and removed on return.
+ *
+ * @return result.success == true if stopped by `handler`.
+ * @return result.success == false w/ error message as `result.msg` if cannot
+ * listen on `socket_path`, e.g. another server is listening on it.
+ */
+FILEMOD_API result_base ipc_serve(const std::filesystem::path &socket_path,
+                                  const ipc_handler &handler);
+
+/**
+ * @brief Send `request` to the server listening on `socket_path`, and wait
+ * for its response.
+ *
+ * @return result.success == true w/ the response as `result.data`.
+ * @return result.success == false w/ empty `result.msg` if no server is
+ * listening, the request is not sent.
+ * @return result.success == false w/ error message as `result.msg` if the
+ * connection is lost, the request may have been run.
+ */
+FILEMOD_API result<ipc_response> ipc_send(
+    const std::filesystem::path &socket_path, const ipc_request &request);
+
+}  // namespace filemod
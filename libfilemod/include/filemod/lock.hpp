@@ -0,0 +1,52 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+
+#include "filemod/utils.hpp"
+
+namespace filemod {
+
+const char LOCKFILE[] = "filemod.lock";
+
+// Path of the file filemod processes lock, in config directory.
+FILEMOD_API std::filesystem::path get_lock_path();
+
+// Advisory lock of a file among processes, released on destruction. Each
+// instance opens the file on its own, so two instances in one process exclude
+// each other as two processes do.
+class file_lock {
+ public:
+  file_lock() noexcept = default;
+
+  file_lock(const file_lock &) = delete;
+  file_lock &operator=(const file_lock &) = delete;
+
+  FILEMOD_API ~file_lock();
+
+  /**
+   * @brief Lock `lock_path` exclusively, waiting up to `timeout` while another
+   * holds it. The lock held by this instance, if any, is released first.
+   *
+   * The file and its parent directory are created if missing.
+   *
+   * @return result.success == true if locked.
+   * @return result.success == false w/ error message as `result.msg` if timed
+   * out or cannot open `lock_path`.
+   */
+  FILEMOD_API result_base lock(const std::filesystem::path &lock_path,
+                               std::chrono::milliseconds timeout);
+
+  FILEMOD_API void unlock() noexcept;
+
+  [[nodiscard]] FILEMOD_API bool locked() const noexcept;
+
+ private:
+#ifdef _WIN32
+  HANDLE m_handle = INVALID_HANDLE_VALUE;
+#else
+  int m_fd = -1;
+#endif
+};
+
+}  // namespace filemod
@@ -3,15 +3,67 @@
 //
 #pragma once
 
+#include <future>
+#include <iosfwd>
+#include <span>
+#include <stop_token>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "filemod/fs.hpp"
+#include "filemod/fs_archive.hpp"
+#include "filemod/fs_tx.hpp"
+#include "filemod/ownership.hpp"
 #include "filemod/sql.hpp"
+#include "filemod/task.hpp"
 #include "filemod/utils.hpp"
 
 namespace filemod {
 
+class bloom_filter;
+
+enum class FileIssue {
+  Missing = 0,   // mod file is missing in config directory
+  Modified = 1,  // mod file content differs from when it was added
+  Unlinked = 2,  // installed file in target does not link to the mod file
+};
+
+struct [[nodiscard]] FileIssueDto {
+  int64_t mod_id;
+  std::string dir{};
+  FileIssue issue;
+};
+
+enum class FileDrift {
+  Missing = 0,        // installed file is gone from target
+  Replaced = 1,       // installed file in target is no longer the mod's link
+  BackupMissing = 2,  // backup of the original target file is gone
+};
+
+struct [[nodiscard]] FileDriftDto {
+  int64_t mod_id;
+  std::string dir{};
+  FileDrift drift;
+};
+
+enum class ListFormat {
+  Text = 0,    // indented lines, see modder::list_mods()
+  Json = 1,    // one JSON array of objects
+  NdJson = 2,  // one JSON object per line
+};
+
+struct ListOptions {
+  ListFormat format = ListFormat::Text;
+  // most items listed, all if negative
+  int64_t limit = -1;
+  // items skipped first
+  int64_t offset = 0;
+};
+
 class modder {
  public:
   /**
@@ -35,6 +87,18 @@ class modder {
    */
   FILEMOD_API modder();
 
+  /**
+   * @brief Create a modder instance in default config directory, only to query
+   * targets and mods if @c read_only.
+   *
+   * Similar to default constructor modder(), but database is opened read only
+   * if @c read_only, unless it is missing or of an older schema.
+   *
+   * @param read_only whether to open database read only
+   * @exception std::exception same as modder().
+   */
+  FILEMOD_API explicit modder(bool read_only);
+
   modder(const modder& filemod) = delete;
   modder& operator=(const modder& filemod) = delete;
   modder(modder&& filemod) = delete;
@@ -51,11 +115,78 @@ class modder {
    *
    * @param cfg_dir full path of config directory
    * @param db_path full path of database file
+   * @param read_only whether to open database read only, see modder(bool)
    * @exception std::exception if fail to create @c cfg_dir or @c db_path, or
    * cannot recognize existing ones as directory and SQLite database file.
    */
   FILEMOD_API explicit modder(const std::filesystem::path& cfg_dir,
-                              const std::filesystem::path& db_path);
+                              const std::filesystem::path& db_path,
+                              bool read_only = false);
+
+  /**
+   * @brief Store files of mods added afterwards in a content addressed blob
+   * store, off by default.
+   *
+   * Regular files of a mod become hardlinks of blobs under the config
+   * directory, so identical files of different mods are stored once. A blob is
+   * deleted when the last mod referencing it is removed.
+   *
+   * @attention Files of a mod are shared with other mods, do not modify them
+   * in the config directory.
+   * @param dedup whether to deduplicate files
+   */
+  FILEMOD_API void set_dedup(bool dedup) noexcept;
+
+  /**
+   * @brief Run `func` as one transaction, changes made through this modder in
+   * it are either all kept or all rolled back.
+   *
+   * Each call in `func` still runs in its own nested transaction, a failed call
+   * only rolls back its own changes. All of them are rolled back if `func`
+   * returns a failed result or throws, and committed at once otherwise.
+   *
+   * @param func callable taking no arguments and returning a reference to a
+   * result_base outliving the call, which tells whether to commit.
+   */
+  template <typename Func>
+  void transaction(Func func) {
+    tx_wrapper_(func);
+  }
+
+  /**
+   * @brief Run `func(*this)` on a new thread, reporting progress of the files
+   * it changes to `on_progress`, and cancelling it once `stop` is requested.
+   *
+   * A cancelled call rolls back its changes as a failed one does. Progress is
+   * reported from the threads changing files, one report at a time, and stop
+   * is checked after each file changed.
+   *
+   * @code
+   * std::stop_source stop;
+   * auto fut = modder.async(
+   *     [&](filemod::modder& m) { return m.add_mod_a(tar_id, name, path); },
+   *     stop.get_token(), [](const filemod::progress& p) { ... });
+   * @endcode
+   *
+   * @attention Do not use this modder until the returned future is ready.
+   * @param func callable taking this modder and returning a result of a call
+   * of it, e.g. install_mods().
+   * @return future of the result of `func`, result.success == false w/ error
+   * message as `result.msg` if cancelled.
+   */
+  template <typename Func>
+  auto async(Func func, std::stop_token stop = {},
+             progress_fn on_progress = {})
+      -> std::future<std::invoke_result_t<Func&, modder&>>;
+
+  /**
+   * @brief Drop state cached from database, if another connection changed it
+   * since the last call.
+   *
+   * For a modder kept for a long time, e.g. by `filemod serve`, while other
+   * processes may change the same database.
+   */
+  FILEMOD_API void drop_stale_caches();
 
   /**
    * @brief Add target to managed config.
@@ -70,6 +201,45 @@ class modder {
   FILEMOD_API result<int64_t> add_target(
       const std::filesystem::path& tar_dir_raw);
 
+  /**
+   * @brief Set whether a target is activated atomically.
+   *
+   * @c install_target, @c uninstall_target and @c switch_profile of an atomic
+   * target build the result in a new generation next to the target directory,
+   * which is then exchanged with the target directory in one step, atomically
+   * where the filesystem supports it. The replaced generation is kept as
+   * `<target_dir>.filemod_prev` until the next activation, and its mods can be
+   * installed again by @c activate_prev.
+   *
+   * Meant for targets whose directory is owned by filemod, e.g. a game's mods
+   * directory, since the whole directory is replaced.
+   *
+   * @param tar_id id of a target
+   * @param atomic whether to activate atomically
+   * @return result.success == true if successfully set.
+   * @return result.success == false w/ error message as `result.msg` if target
+   * does not exist.
+   */
+  FILEMOD_API result_base set_atomic(int64_t tar_id, bool atomic);
+
+  /**
+   * @brief Set whether files of a target differing only in ASCII case are the
+   * same file.
+   *
+   * For games run through Wine or Proton on a case-sensitive filesystem,
+   * which see `Textures/A.dds` and `textures/a.dds` as one file. Mods of a
+   * case-insensitive target conflict if they provide files differing only in
+   * case, and original files of the target are backed up on install the same
+   * way. Mods installed already are not checked again.
+   *
+   * @param tar_id id of a target
+   * @param nocase whether to ignore case
+   * @return result.success == true if successfully set.
+   * @return result.success == false w/ error message as `result.msg` if target
+   * does not exist.
+   */
+  FILEMOD_API result_base set_nocase(int64_t tar_id, bool nocase);
+
   /**
    * @brief add mod to managed config.
    *
@@ -104,6 +274,9 @@ class modder {
    * @param tar_id
    * @param mod_name require UTF-8 encoded
    * @param path
+   * @note The archive content is hashed. If a mod of any target was added
+   * from an identical archive and its files still match the recorded hashes,
+   * they are cloned instead of decompressing the archive again.
    * @attention Require setting LC_CTYPE to UTF-8, e.g. `setlocale(LC_CTYPE,
    */
   FILEMOD_API result<int64_t> add_mod_a(int64_t tar_id,
@@ -119,6 +292,31 @@ class modder {
   FILEMOD_API result<int64_t> add_mod_a(int64_t tar_id,
                                         const std::filesystem::path& path);
 
+  /**
+   * @brief Update a mod to a new version in place.
+   *
+   * Runs as a transaction that does not leave an intermediate state. The new
+   * version is compared with the files recorded for the mod, only added,
+   * changed and removed files are copied, linked or deleted. Files of the same
+   * size are compared by content hash, modification times are not trusted, so
+   * all files of the new version are read. Files of a zip archive w/ the
+   * CRC-32 and size recorded when extracted from a zip archive before are
+   * unchanged, only other files are extracted and read. If the mod is
+   * installed, it stays installed.
+   *
+   * @param mod_id id of the mod to be updated
+   * @param mod_src_raw directory or archive of the new version
+   * @return result.success == true if successfully updated.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. mod or @c mod_src_raw does not exist, or
+   * 2. added files are in conflict with other installed mods.
+   * @attention Require setting LC_CTYPE to UTF-8 for archives, e.g.
+   * `setlocale(LC_CTYPE, "en_US.UTF-8")`.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result_base update_mod(int64_t mod_id,
+                                     const std::filesystem::path& mod_src_raw);
+
   /**
    * @brief Install mods.
    *
@@ -142,7 +340,8 @@ class modder {
   /**
    * @brief Install all mods relate to a target.
    *
-   * Equivalent to @c install_mods with all @c mod_ids relate to the target.
+   * Equivalent to @c install_mods with all @c mod_ids relate to the target,
+   * activated atomically for an atomic target, see @c set_atomic.
    *
    * @param tar_id id of target which related mods to be installed
    * @return result.success == true if successfully installed.
@@ -187,6 +386,9 @@ class modder {
   /**
    * Reference:\n
    * @copydoc install_path(int64_t,const std::filesystem::path&)
+   * @note Conflicts of a zip archive are checked against its central
+   * directory before any data is extracted. Other archives are checked once
+   * extracted.
    * @attention Require setting LC_CTYPE to UTF-8, e.g. `setlocale(LC_CTYPE,
    * "en_US.UTF-8")`.
    * @param tar_id
@@ -224,7 +426,8 @@ class modder {
   /**
    * @brief Uninstall all mods of a target.
    *
-   * Equivalent to @c uninstall_mods with all @c mod_ids relate to the target.
+   * Equivalent to @c uninstall_mods with all @c mod_ids relate to the target,
+   * activated atomically for an atomic target, see @c set_atomic.
    *
    * @param tar_id id of a target
    * @return result.success == true if successfully uninstalled.
@@ -262,6 +465,212 @@ class modder {
    */
   FILEMOD_API result_base remove_target(int64_t tar_id);
 
+  /**
+   * @brief Verify mod files in config directory and files of installed mods
+   * in target directory.
+   *
+   * Mod files are hashed in parallel and compared with the hashes recorded
+   * when they were added, mods added before hashes were recorded are only
+   * checked for existence. Every file of an installed mod must be linked in
+   * target directory.
+   *
+   * @param mod_ids ids of mods to be verified
+   * @return result.success == true w/ issues found as `result.data`, empty if
+   * all files are intact.
+   * @return result.success == false w/ error message as `result.msg` if one or
+   * more mods do not exist.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<std::vector<FileIssueDto>> verify_mods(
+      const std::vector<int64_t>& mod_ids);
+
+  /**
+   * @brief Verify all mods of a target.
+   *
+   * Equivalent to @c verify_mods with all @c mod_ids relate to the target.
+   *
+   * @param tar_id id of a target
+   * @return result.success == true w/ issues found as `result.data`.
+   * @return result.success == false w/ error message as `result.msg` if target
+   * does not exist.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<std::vector<FileIssueDto>> verify_target(int64_t tar_id);
+
+  /**
+   * @brief Find files of installed mods changed in target directories.
+   *
+   * Only file metadata is compared, in parallel. A link is intact if its inode
+   * and modification time are the same as at install, or it still points to
+   * the mod file. File contents are not read, see @c verify_mods.
+   *
+   * @param tar_ids ids of targets, all targets if empty
+   * @return result.success == true w/ drifted files as `result.data`, empty if
+   * targets are as installed.
+   * @return result.success == false w/ error message as `result.msg` if one or
+   * more targets do not exist.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<std::vector<FileDriftDto>> status(
+      const std::vector<int64_t>& tar_ids);
+
+  /**
+   * @brief Recreate missing or replaced files of installed mods in target
+   * directory.
+   *
+   * Runs as a transaction that does not leave an intermediate state. Only
+   * drifted files found as by @c status are touched, a file put in place of a
+   * mod file, e.g. by a game update, is backed up and restored when the mod is
+   * uninstalled. Mods not installed are ignored.
+   *
+   * @param mod_ids ids of mods to be repaired
+   * @return result.success == true if successfully repaired.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. one or more mods do not exist, or
+   * 2. a directory is in place of a mod file in target directory.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result_base repair_mods(const std::vector<int64_t>& mod_ids);
+
+  /**
+   * @brief Repair all installed mods of a target.
+   *
+   * Equivalent to @c repair_mods with all @c mod_ids relate to the target.
+   *
+   * @param tar_id id of a target
+   * @return result.success == true if successfully repaired.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. target does not exist, or
+   * 2. a directory is in place of a mod file in target directory.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result_base repair_target(int64_t tar_id);
+
+  /**
+   * @brief Save currently installed mods of a target as a profile.
+   *
+   * Equivalent to @c save_profile with all installed @c mod_ids of the
+   * target.
+   *
+   * @param tar_id id of a target
+   * @param name profile name, an existing profile of the name is overwritten
+   * @return result.success == true w/ profile id as `result.data`.
+   * @return result.success == false w/ error message as `result.msg` if target
+   * does not exist.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<int64_t> save_profile(int64_t tar_id,
+                                           const std::string& name);
+
+  /**
+   * @brief Save a set of mods of a target as a profile.
+   *
+   * @param tar_id id of a target
+   * @param name profile name, an existing profile of the name is overwritten
+   * @param mod_ids ids of mods in the profile
+   * @return result.success == true w/ profile id as `result.data`.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. target does not exist, or
+   * 2. one or more mods do not exist or do not belong to the target.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<int64_t> save_profile(int64_t tar_id,
+                                           const std::string& name,
+                                           const std::vector<int64_t>& mod_ids);
+
+  /**
+   * @brief Install exactly the mods of a profile.
+   *
+   * Runs as a transaction that does not leave an intermediate state. Only
+   * installed mods not in the profile are uninstalled, and only mods of the
+   * profile not installed are installed, mods in both stay untouched.
+   * Activated atomically for an atomic target, see @c set_atomic.
+   *
+   * @param tar_id id of a target
+   * @param name profile name
+   * @return result.success == true if successfully switched.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. target or profile does not exist, or
+   * 2. a mod of the profile is in conflict with another.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result_base switch_profile(int64_t tar_id,
+                                         const std::string& name);
+
+  /**
+   * @brief Install exactly the mods installed before the last activation of an
+   * atomic target, see @c set_atomic.
+   *
+   * Activated as @c switch_profile, so calling it again goes back to the mods
+   * installed before.
+   *
+   * @param tar_id id of a target
+   * @return result.success == true if successfully switched.
+   * @return result.success == false w/ error message as `result.msg` if
+   * 1. target does not exist, or
+   * 2. target is not atomic or has no previous generation, or
+   * 3. a mod installed before is in conflict with another.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result_base activate_prev(int64_t tar_id);
+
+  /**
+   * @brief Delete a profile, its mods are left as they are.
+   *
+   * @param tar_id id of a target
+   * @param name profile name
+   * @return result.success == true if successfully removed.
+   * @return result.success == false w/ error message as `result.msg` if
+   * profile does not exist.
+   */
+  FILEMOD_API result_base remove_profile(int64_t tar_id,
+                                         const std::string& name);
+
+  /**
+   * @brief Query profiles of a target from database.
+   * @param tar_id id of a target
+   * @return profiles of the target ordered by name.
+   */
+  FILEMOD_API std::vector<ProfileDto> query_profiles(int64_t tar_id);
+
+  /**
+   * @brief Find installed mods providing a file in a target directory.
+   *
+   * Looked up in an index of installed files of the target, loaded from
+   * database once per modder instance.
+   *
+   * @param path file in a target directory, can be full path or relative path
+   * of current working directory
+   * @return result.success == true w/ mods providing the file as
+   * `result.data`, empty if none, more than one only for a directory.
+   * @return result.success == false w/ error message as `result.msg` if @c
+   * path is not in any target directory.
+   * @exception std::exception if unknown runtime error occurs.
+   */
+  FILEMOD_API result<std::vector<ModDto>> which(
+      const std::filesystem::path& path);
+
+  /**
+   * @brief Find files of mods of a target matching a glob pattern.
+   *
+   * The pattern matches whole file paths relative to the target directory,
+   * case-sensitively, in SQLite GLOB syntax: `*` matches any characters
+   * including separators, `?` one character and `[...]` one of a set. A
+   * literal prefix, as `Data/Scripts/` of `Data/Scripts/[a-z]*`, is looked up
+   * in the index of files, patterns starting w/ a wildcard, as `*.ini`, in a
+   * trigram index of files.
+   *
+   * @param tar_id id of a target
+   * @param pattern glob pattern, require UTF-8 encoded
+   * @param installed whether to find files of installed mods only
+   * @return result.success == true w/ matching files paired with their mod
+   * ids as `result.data`, ordered by file.
+   * @return result.success == false w/ error message as `result.msg` if the
+   * target does not exist.
+   */
+  FILEMOD_API result<std::vector<std::pair<std::string, int64_t>>> find_files(
+      int64_t tar_id, const std::string& pattern, bool installed = false);
+
   /**
    * @brief Query mods from database with all verbose information.
    *
@@ -301,6 +710,23 @@ class modder {
    */
   FILEMOD_API std::string list_mods(const std::vector<int64_t>& mod_ids);
 
+  /**
+   * @brief Write mod(s) information from database to `out` as it is read, in
+   * constant memory however many mods and files there are.
+   *
+   * JSON objects are
+   * `{"id":1,"target_id":2,"dir":"a","status":"installed","files":["a/b"],
+   * "backup_files":[]}`. JSON output and the last NDJSON line are not ended
+   * by a newline.
+   *
+   * @param out stream written to
+   * @param mod_ids ids of mods, all mods if empty
+   * @param opts format, and page of mods ordered by id to list
+   */
+  FILEMOD_API void list_mods(std::ostream& out,
+                             const std::vector<int64_t>& mod_ids,
+                             const ListOptions& opts = {});
+
   /**
    * @brief Formatted target(s) information from database.
    * @param tar_ids ids of targets
@@ -313,6 +739,21 @@ class modder {
    */
   FILEMOD_API std::string list_targets(const std::vector<int64_t>& tar_ids);
 
+  /**
+   * @brief Write target(s) information from database to `out` as it is read,
+   * see list_mods(std::ostream&, ...).
+   *
+   * JSON objects are `{"id":1,"dir":"/a","atomic":false,"nocase":false,
+   * "mods":[{"id":2,"dir":"a","status":"installed"}]}`.
+   *
+   * @param out stream written to
+   * @param tar_ids ids of targets, all targets if empty
+   * @param opts format, and page of targets ordered by id to list
+   */
+  FILEMOD_API void list_targets(std::ostream& out,
+                                const std::vector<int64_t>& tar_ids,
+                                const ListOptions& opts = {});
+
   /**
    * @brief Rename mod.
    * Rename mod directory to `newname` and modify database record.
@@ -325,14 +766,47 @@ class modder {
  private:
   FS m_fs;  // ORDER DEPENDENCY
   DB m_db;  // ORDER DEPENDENCY
+  bool m_dedup = false;
+  // installed files of targets, cleared when a transaction fails
+  ownership_index m_owners;
+  // new generations of atomic targets being built, by target id
+  std::unordered_map<int64_t, std::filesystem::path> m_generations;
+  // `DB::data_version` seen by `drop_stale_caches`
+  int64_t m_data_version = 0;
 
   template <typename Func>
   void tx_wrapper_(Func func);
 
+  // Run `func(*this)` reporting to `task`, see async().
+  template <typename Func>
+  auto run_task_(Func& func, task& task)
+      -> std::invoke_result_t<Func&, modder&>;
+
+  // Run `func` returning whether it succeeded against a new generation of
+  // target `tar_id` if it is atomic, and activate the generation if so,
+  // recording mods installed before for activate_prev().
+  template <typename Func>
+  bool generation_wrapper_(int64_t tar_id, Func func);
+
+  // Uninstall installed mods of target `tar_id` not in `wanted`, then install
+  // mods of `wanted`, ascending, not installed. Returns false w/ `ret` set
+  // failed if cannot.
+  bool switch_mods_(result_base& ret, int64_t tar_id,
+                    const std::vector<int64_t>& wanted);
+
+  // Directory to change for target `tar_id` at `tar_dir_str`, its new
+  // generation while being built.
+  std::filesystem::path tar_dir_(int64_t tar_id, std::string&& tar_dir_str);
+
   result<int64_t> add_mod_(int64_t tar_id, const std::string& mod_name,
                            const std::filesystem::path& mod_src_raw,
                            copy_mod_t cp_mod_fn);
 
+  // Record hashes of regular files of newly added mod `mod_id`, and link them
+  // into the blob store if deduplicating.
+  void hash_mod_files_(int64_t mod_id, const std::filesystem::path& cfg_mod,
+                       const std::vector<std::string>& mod_file_strs);
+
   using add_mod_t = result<int64_t> (modder::*)(int64_t, const std::string&,
                                                 const std::filesystem::path&);
 
@@ -340,11 +814,159 @@ class modder {
                                 const std::filesystem::path& path,
                                 add_mod_t add_mod_fn);
 
+  // A mod checked to be installed, see install_mods().
+  struct install_job {
+    int64_t mod_id;
+    int64_t tar_id;
+    std::filesystem::path cfg_mod;
+    std::filesystem::path tar_dir;
+    bool nocase;
+    // files of the mod, viewed by `mod_file_strs`
+    ModViewsDto mod_views;
+    // non-directory mod files
+    std::vector<std::string_view> mod_file_strs;
+    // original target files backed up, once installed
+    std::vector<std::string> bak_file_strs{};
+  };
+
+  // A mod whose files are to be uninstalled, see uninstall_mods().
+  struct uninstall_job {
+    int64_t tar_id;
+    std::filesystem::path cfg_mod;
+    std::filesystem::path tar_dir;
+    bool nocase;
+    std::vector<std::filesystem::path> mod_file_rels;
+    std::vector<std::filesystem::path> bak_file_rels;
+  };
+
+  // Call `func(job)` for each of `jobs`, in order for a target, in parallel
+  // for targets of which none contains another.
+  template <typename Job, typename Func>
+  void for_each_target_(std::vector<Job>& jobs, Func func);
+
   result_base install_mod_(int64_t mod_id);
 
+  // Check mod `mod_id` can be installed and append its job to `jobs`, unless
+  // installed or in `jobs` already. Files of the mod are taken as installed
+  // by later checks. Returns false w/ `ret` set failed if cannot.
+  bool plan_install_(result_base& ret, int64_t mod_id,
+                     std::vector<install_job>& jobs);
+
+  // Change files for `job`, safe to call for different targets concurrently.
+  void install_files_(install_job& job);
+
+  // Record installed `job` in database.
+  void commit_install_(const install_job& job);
+
+  // Record metadata of the symlinks just installed for `mod_file_strs`,
+  // matched ignoring ASCII case if `nocase`.
+  void record_links_(int64_t mod_id, const std::filesystem::path& tar_dir,
+                     bool nocase,
+                     std::span<const std::string_view> mod_file_strs);
+
+  // Whether target `tar_id` is case-insensitive, false if it does not exist.
+  bool nocase_(int64_t tar_id);
+
+  // Load installed files of target `tar_id` into `m_owners` if not yet.
+  void load_owners_(int64_t tar_id);
+
+  // Bloom filter of installed files of target `tar_id` stored in database,
+  // built from installed files, case-folded if `nocase`, if missing.
+  bloom_filter load_bloom_(int64_t tar_id, bool nocase);
+
+  // Add files of a mod just installed to the stored bloom filter of target
+  // `tar_id`. A full filter is dropped to be rebuilt on next use.
+  void add_to_bloom_(int64_t tar_id,
+                     std::span<const std::string_view> mod_file_strs);
+
+  // Set `ret` failed and return false if any of the non-directory
+  // `mod_file_strs` belongs to an installed mod of target `tar_id`.
+  bool check_conflicts_(result_base& ret, int64_t tar_id,
+                        std::span<const std::string_view> mod_file_strs);
+
+  // Config directory of an existing mod added from an archive of content
+  // `hash` and unchanged since, or empty path if none.
+  std::filesystem::path find_archive_cache_(const std::string& hash);
+
+  // Record CRC-32s of files of mod `mod_id` extracted from a zip archive of
+  // `crcs`, to tell files of a new version unchanged w/o extracting them.
+  void record_zip_crcs_(int64_t mod_id,
+                        const std::unordered_map<std::string, zip_crc>& crcs);
+
+  // Check conflicts of archive `path` from its headers only, if it is a zip
+  // archive.
+  result_base check_archive_conflicts_(int64_t tar_id,
+                                       const std::filesystem::path& path);
+
+  // Returns the mod w/o files.
   result<ModDto> uninstall_mod_(int64_t mod_id);
 
+  // Record mod `mod_id` as uninstalled w/ it, w/o files, as `ret.data`, and
+  // append the job changing its files to `jobs`, unless uninstalled already or
+  // its target is gone. Returns false w/ `ret` set failed if it does not exist.
+  bool plan_uninstall_(result<ModDto>& ret, int64_t mod_id,
+                       std::vector<uninstall_job>& jobs);
+
+  // Change files for `job`, safe to call for different targets concurrently.
+  void uninstall_files_(const uninstall_job& job);
+
   result_base remove_mod_(int64_t mod_id);
+
+  result_base repair_mod_(int64_t mod_id);
 };  // class modder
 
+template <typename Func>
+void modder::tx_wrapper_(Func func) {
+  fs_tx fstx{m_fs};
+  auto dbtx = m_db.begin();
+
+  // changes to m_owners are not rolled back, drop them instead
+  try {
+    auto& ret = func();
+    if (!ret.success) {
+      m_owners.clear();
+      return;
+    }
+    dbtx.release();
+  } catch (...) {
+    m_owners.clear();
+    throw;
+  }
+
+  fstx.commit();
+}
+
+template <typename Func>
+auto modder::async(Func func, std::stop_token stop, progress_fn on_progress)
+    -> std::future<std::invoke_result_t<Func&, modder&>> {
+  return std::async(
+      std::launch::async,
+      [this, func = std::move(func), stop = std::move(stop),
+       on_progress = std::move(on_progress)]() mutable {
+        filemod::task task{std::move(stop), std::move(on_progress)};
+        return run_task_(func, task);
+      });
+}
+
+template <typename Func>
+auto modder::run_task_(Func& func, task& task)
+    -> std::invoke_result_t<Func&, modder&> {
+  std::invoke_result_t<Func&, modder&> ret{};
+
+  m_fs.set_task(&task);
+  try {
+    task.check_stop();
+    ret = func(*this);
+  } catch (const cancelled& ex) {
+    ret.success = false;
+    ret.msg = ex.what();
+  } catch (...) {
+    m_fs.set_task(nullptr);
+    throw;
+  }
+  m_fs.set_task(nullptr);
+
+  return ret;
+}
+
 }  // namespace filemod
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "filemod/utils.hpp"
+
+namespace filemod {
+
+// Files of installed mods of each target and the mods providing them.
+//
+// A target is loaded once from the database on first use, and kept up to date
+// by installs and uninstalls afterwards. Directories may be provided by more
+// than one mod. Files of a case-insensitive target are keyed case-folded, see
+// `ascii_fold`.
+class ownership_index {
+ public:
+  [[nodiscard]] bool loaded(int64_t tar_id) const {
+    return m_targets.contains(tar_id);
+  }
+
+  // `files` are pairs of file and the installed mod providing it.
+  void load(int64_t tar_id,
+            std::vector<std::pair<std::string, int64_t>> &&files,
+            bool nocase = false) {
+    auto &target = m_targets[tar_id];
+    target.nocase = nocase;
+    target.owners.clear();
+    target.owners.reserve(files.size());
+    for (auto &[file, mod_id] : files) {
+      target.owners.emplace(nocase ? ascii_fold(file) : std::move(file),
+                            mod_id);
+    }
+  }
+
+  // Record `files` provided by mod `mod_id`, if target `tar_id` is loaded.
+  void add(int64_t tar_id, int64_t mod_id,
+           std::span<const std::string_view> files) {
+    auto it = m_targets.find(tar_id);
+    if (it == m_targets.end()) {
+      return;
+    }
+    auto &target = it->second;
+    for (const auto &file : files) {
+      target.owners.emplace(target.key(file), mod_id);
+    }
+  }
+
+  // Forget `files` provided by mod `mod_id`, if target `tar_id` is loaded.
+  void remove(int64_t tar_id, int64_t mod_id,
+              std::span<const std::string_view> files) {
+    auto it = m_targets.find(tar_id);
+    if (it == m_targets.end()) {
+      return;
+    }
+    auto &target = it->second;
+    for (const auto &file : files) {
+      auto [first, last] = target.owners.equal_range(target.key(file));
+      for (; first != last; ++first) {
+        if (first->second == mod_id) {
+          target.owners.erase(first);
+          break;
+        }
+      }
+    }
+  }
+
+  // Ids of installed mods of target `tar_id` providing `file`, the target
+  // must be loaded.
+  [[nodiscard]] std::vector<int64_t> owners(int64_t tar_id,
+                                            std::string_view file) const {
+    std::vector<int64_t> mod_ids;
+    auto &target = m_targets.at(tar_id);
+    auto [first, last] = target.owners.equal_range(target.key(file));
+    for (; first != last; ++first) {
+      mod_ids.push_back(first->second);
+    }
+    return mod_ids;
+  }
+
+  // Unload target `tar_id`.
+  void drop(int64_t tar_id) { m_targets.erase(tar_id); }
+
+  // Unload all targets, e.g. when changes to them are rolled back.
+  void clear() { m_targets.clear(); }
+
+ private:
+  struct target_owners {
+    bool nocase = false;
+    std::unordered_multimap<std::string, int64_t> owners;
+
+    [[nodiscard]] std::string key(std::string_view file) const {
+      return nocase ? ascii_fold(file) : std::string{file};
+    }
+  };
+
+  std::unordered_map<int64_t, target_owners> m_targets;
+};
+
+}  // namespace filemod
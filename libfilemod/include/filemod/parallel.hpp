@@ -0,0 +1,62 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace filemod {
+
+// Call `func(i)` for each i in [0, n) on up to hardware concurrency threads,
+// the calling thread included.
+//
+// Rethrows the first exception thrown by `func` once all threads joined, the
+// remaining indices are skipped.
+template <typename Func>
+void parallel_for(size_t n, Func func) {
+  size_t nthreads = std::min<size_t>(
+      std::max(1u, std::thread::hardware_concurrency()), n);
+  if (nthreads <= 1) {
+    for (size_t i = 0; i < n; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next{0};
+  std::exception_ptr eptr;
+  std::mutex eptr_mtx;
+
+  auto work = [&]() {
+    for (size_t i; (i = next.fetch_add(1)) < n;) {
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard lock{eptr_mtx};
+        if (!eptr) {
+          eptr = std::current_exception();
+        }
+        next = n;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (size_t i = 1; i < nthreads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (eptr) {
+    std::rethrow_exception(eptr);
+  }
+}
+
+}  // namespace filemod
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+namespace filemod {
+
+using native_char = std::filesystem::path::value_type;
+using native_string = std::filesystem::path::string_type;
+using native_view = std::basic_string_view<native_char>;
+
+// No directory handle, paths are looked up in full.
+inline constexpr int NO_DIR_FD = -1;
+
+// Path of a base directory joined w/ a relative path, built in a buffer reused
+// across joins, so loops over the files of a directory do not allocate once
+// the buffer has grown.
+class path_buf {
+ public:
+  static constexpr native_char SEP =
+      std::filesystem::path::preferred_separator;
+
+  // Relative paths are looked up from `base_fd`, a handle of `base`, if any.
+  explicit path_buf(const std::filesystem::path &base,
+                    int base_fd = NO_DIR_FD)
+      : m_buf{base.native()}, m_base_fd{base_fd} {
+    if (!m_buf.empty() && m_buf.back() != SEP) {
+      m_buf += SEP;
+    }
+    m_rel = m_buf.size();
+  }
+
+  // Set to `base/rel`.
+  path_buf &join(native_view rel) {
+    m_buf.resize(m_rel);
+    m_buf.append(rel);
+    return *this;
+  }
+
+  // Append component `name`, returns the size to `cut` back to.
+  size_t push(native_view name) {
+    size_t size = m_buf.size();
+    if (size > m_rel) {
+      m_buf += SEP;
+    }
+    m_buf.append(name);
+    return size;
+  }
+
+  // Cut back to `size`, as returned by `push`.
+  void cut(size_t size) { m_buf.resize(size); }
+
+  // Call `func(dir)` for each directory between the base, excluded, and the
+  // file, outermost first. `dir` is the buffer cut short in place.
+  template <typename Func>
+  void for_each_parent(Func func);
+
+  [[nodiscard]] const native_char *c_str() const noexcept {
+    return m_buf.c_str();
+  }
+
+  [[nodiscard]] native_view view() const noexcept { return m_buf; }
+
+  // Path relative to the base.
+  [[nodiscard]] native_view rel() const noexcept {
+    return view().substr(m_rel);
+  }
+
+  [[nodiscard]] int base_fd() const noexcept { return m_base_fd; }
+
+ private:
+  // base w/ a trailing separator, then the relative path
+  native_string m_buf;
+  size_t m_rel;
+  int m_base_fd;
+
+  friend class path_ref;
+};
+
+// NUL terminated native path viewed from a path or a `path_buf` w/o copying,
+// to pass either to functions changing files.
+//
+// Viewed from a `path_buf` w/ a base handle, it is also the path relative to
+// the handle, which functions changing files look it up from.
+class path_ref {
+ public:
+  // implicit, for passing paths as before
+  path_ref(const std::filesystem::path &path) noexcept  // NOLINT
+      : m_view{path.native()} {}
+
+  path_ref(const path_buf &buf) noexcept  // NOLINT
+      : path_ref{buf.view(), buf.m_base_fd, buf.m_rel} {}
+
+  // `view` must be followed by NUL. Its part from `at` on is relative to
+  // `dir_fd`, if a handle.
+  explicit path_ref(native_view view, int dir_fd = NO_DIR_FD,
+                    size_t at = 0) noexcept
+      : m_view{view} {
+    if (dir_fd != NO_DIR_FD && at < view.size()) {
+      m_dir_fd = dir_fd;
+      m_at = at;
+    }
+  }
+
+  [[nodiscard]] const native_char *c_str() const noexcept {
+    return m_view.data();
+  }
+
+  [[nodiscard]] native_view view() const noexcept { return m_view; }
+
+  // Handle `at_path()` is relative to, or NO_DIR_FD if it is the full path.
+  [[nodiscard]] int dir_fd() const noexcept { return m_dir_fd; }
+
+  [[nodiscard]] const native_char *at_path() const noexcept {
+    return m_view.data() + m_at;
+  }
+
+  // Copy as a path.
+  [[nodiscard]] std::filesystem::path path() const { return m_view; }
+
+ private:
+  native_view m_view;
+  int m_dir_fd = NO_DIR_FD;
+  size_t m_at = 0;
+};
+
+template <typename Func>
+void path_buf::for_each_parent(Func func) {
+  for (size_t pos = m_buf.find(SEP, m_rel); pos != native_string::npos;
+       pos = m_buf.find(SEP, pos + 1)) {
+    m_buf[pos] = native_char{};
+    try {
+      func(path_ref{native_view{m_buf.data(), pos}, m_base_fd, m_rel});
+    } catch (...) {
+      m_buf[pos] = SEP;
+      throw;
+    }
+    m_buf[pos] = SEP;
+  }
+}
+
+}  // namespace filemod
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "filemod/fs_manager.hpp"
+#include "filemod/path_buf.hpp"
+
+namespace filemod {
+
+// File changes of a loop, made and logged to `fsman` in batches where built w/
+// FILEMOD_IO_URING and the kernel supports it, otherwise one by one as
+// through `fsman` directly.
+//
+// A change queued after `create_d` is made after it, others may be made in any
+// order. Handles of queued paths must stay open until `flush`. Changes still
+// queued when destroyed are not made.
+class fs_batch {
+ public:
+  explicit fs_batch(fsman &fsman);
+
+  fs_batch(const fs_batch &) = delete;
+  fs_batch &operator=(const fs_batch &) = delete;
+
+  ~fs_batch();
+
+  // Skipped if `dest` or a directory below it was created through this batch
+  // last.
+  void create_d(path_ref dest);
+
+  // Reported to the task of `fsman` as a file done once made.
+  void create_s(path_ref src, path_ref dest);
+
+  void mv_f(path_ref src, path_ref dest);
+
+  // Make queued changes, logging those made. Throws the error of the first
+  // one failed.
+  void flush();
+
+ private:
+  struct impl;
+
+  fsman &m_fsman;
+  // queue and ring, null if changes are made one by one
+  std::unique_ptr<impl> m_impl;
+  // directory created last
+  native_string m_last_dir;
+
+  // Whether `dir` is `m_last_dir` or a parent of it.
+  [[nodiscard]] bool made_dir_(native_view dir) const noexcept {
+    return native_view{m_last_dir}.starts_with(dir) &&
+           (m_last_dir.size() == dir.size() ||
+            m_last_dir[dir.size()] == path_buf::SEP);
+  }
+};
+
+}  // namespace filemod
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <utility>
+
+#include "filemod/path_buf.hpp"
 
 namespace filemod {
 
@@ -8,4 +13,83 @@ std::filesystem::path getexepath();
 
 std::filesystem::path get_home();
 
+// Create `dest` sharing the data extents of `src` (reflink), if the
+// filesystem supports it. Returns false, and creates nothing, otherwise.
+bool clone_file(path_ref src, path_ref dest);
+
+// Atomically exchange existing paths `a` and `b`. Returns false, and changes
+// nothing, if the platform or filesystem does not support it.
+bool exchange_paths(const std::filesystem::path &a,
+                    const std::filesystem::path &b);
+
+// Metadata of a path itself, symlinks are not followed.
+struct file_meta {
+  std::filesystem::file_type type = std::filesystem::file_type::not_found;
+  uint64_t ino = 0;  // 0 if the platform does not provide it
+  int64_t mtime = 0;  // in platform units
+};
+
+// `type` is file_type::not_found if `path` cannot be stat'ed.
+file_meta lstat_meta(const std::filesystem::path &path);
+
+// Handle of a directory, to look up paths relative to it w/ `path_buf`. The
+// kernel then walks only components below the directory, which stays the same
+// when an ancestor is renamed meanwhile.
+class dir_handle {
+ public:
+  dir_handle() = default;
+
+  // Open directory `dir`, no handle if it cannot be opened or the platform
+  // has none.
+  explicit dir_handle(const std::filesystem::path &dir);
+
+  dir_handle(const dir_handle &) = delete;
+  dir_handle &operator=(const dir_handle &) = delete;
+
+  dir_handle(dir_handle &&other) noexcept
+      : m_fd{std::exchange(other.m_fd, NO_DIR_FD)} {}
+
+  dir_handle &operator=(dir_handle &&other) noexcept {
+    std::swap(m_fd, other.m_fd);
+    return *this;
+  }
+
+  ~dir_handle();
+
+  // NO_DIR_FD if none.
+  [[nodiscard]] int fd() const noexcept { return m_fd; }
+
+ private:
+  int m_fd = NO_DIR_FD;
+};
+
+// Functions below take native paths and do not allocate, unless they throw
+// `std::filesystem::filesystem_error` on errors. Paths are looked up relative
+// to their handle, if any.
+
+// Type of `path`, symlinks followed, file_type::not_found if missing.
+std::filesystem::file_type stat_type(path_ref path);
+
+// Create directory `path`, returns false if a directory exists in place.
+bool make_dir(path_ref path);
+
+void make_symlink(path_ref target, path_ref link);
+
+// Rename `src` to `dest`, returns false if they are on different filesystems.
+bool rename_path(path_ref src, path_ref dest);
+
+// Remove empty directory `path`, returns false if it cannot.
+bool remove_dir(path_ref path);
+
+// Size of `path` if a regular file, symlinks followed, otherwise 0.
+uint64_t regular_size(path_ref path);
+
+// Call `func(file, is_dir)` for each file under directory `dir`, parents
+// before their children, `file.rel()` being its path relative to `dir`.
+// Symlinks to directories are directories, but not descended into, as by
+// std::filesystem::recursive_directory_iterator. `file` is relative to
+// `dir_fd`, a handle of `dir`, if not NO_DIR_FD.
+void walk_tree(const std::filesystem::path &dir, int dir_fd,
+               const std::function<void(const path_buf &, bool)> &func);
+
 }  // namespace filemod
\ No newline at end of file
@@ -4,10 +4,15 @@
 
 #pragma once
 
+#include <functional>
 #include <memory>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
+#include "filemod/arena.hpp"
 #include "filemod/utils.hpp"
 
 namespace filemod {
@@ -25,9 +30,57 @@ struct [[nodiscard]] ModDto {
   std::vector<std::string> bak_files{};
 };
 
+// Mod of a `ModViewsDto`, w/ files viewed in its arena.
+struct ModViewDto {
+  int64_t id;
+  int64_t tar_id;
+  std::string dir{};
+  ModStatus status;
+  std::span<const std::string_view> files{};
+  std::span<const std::string_view> bak_files{};
+};
+
+// Mods w/ files of a query, paths of all of them stored in one arena instead
+// of a string each as in `ModDto`.
+struct [[nodiscard]] ModViewsDto {
+  std::vector<ModViewDto> mods{};
+  string_arena paths{};
+};
+
+// Content hash of a mod file, `blob` tells if it is linked into the blob
+// store. `crc` is the CRC-32 of the content in the zip archive the file was
+// extracted from, -1 if unknown.
+struct FileHashDto {
+  std::string dir{};
+  std::string hash{};
+  bool blob = false;
+  int64_t crc = -1;
+};
+
+// Metadata of the symlink of an installed mod file in target, recorded at
+// install. `mtime` is 0 if not recorded.
+struct LinkMetaDto {
+  std::string dir{};
+  uint64_t ino = 0;
+  int64_t mtime = 0;
+};
+
+// Named set of mods of a target, `mod_ids` are ascending.
+struct [[nodiscard]] ProfileDto {
+  int64_t id;
+  int64_t tar_id;
+  std::string name{};
+  std::vector<int64_t> mod_ids{};
+};
+
 struct [[nodiscard]] TargetDto {
   int64_t id;
   std::string dir{};
+  // whether mods are activated in a new generation of `dir` flipped in place
+  bool atomic = false;
+  // whether files differing only in ASCII case are the same, as for games run
+  // through Wine or Proton
+  bool nocase = false;
   std::vector<ModDto> ModDtos{};
 };
 
@@ -39,7 +92,10 @@ class DB {
   class sp_wrap;
 
  public:
-  explicit DB(const std::string &path);
+  // Open database at utf-8 `path`, created if missing. A read-only connection
+  // is opened if `read_only`, unless the database is missing or of an older
+  // schema.
+  explicit DB(const std::string &path, bool read_only = false);
 
   DB(const DB &db) = delete;
   DB &operator=(const DB &db) = delete;
@@ -51,12 +107,45 @@ class DB {
 
   sp_wrap begin();
 
+  // Changes whenever another connection commits changes to the database.
+  int64_t data_version();
+
   std::vector<TargetDto> query_targets_mods(const std::vector<int64_t> &ids);
 
   std::vector<ModDto> query_mods_w_files(const std::vector<int64_t> &ids);
 
+  // Mods w/ files as `query_mods_w_files`, w/ paths in one arena.
+  ModViewsDto query_mod_views(const std::vector<int64_t> &ids);
+
   std::vector<ModDto> query_mods_by_target(int64_t tar_id);
 
+  // Streaming queries below read one row at a time, so memory use does not
+  // grow with the database. `func` must not query this database. Rows are
+  // ordered by id, `offset` of them are skipped and at most `limit` are read
+  // unless it is negative. Empty `ids` means all.
+
+  // Targets w/o mods.
+  void for_each_target(const std::vector<int64_t> &ids, int64_t limit,
+                       int64_t offset,
+                       const std::function<void(const TargetDto &)> &func);
+
+  // Mods w/o files.
+  void for_each_mod(const std::vector<int64_t> &ids, int64_t limit,
+                    int64_t offset,
+                    const std::function<void(const ModDto &)> &func);
+
+  // Mods of target `tar_id` w/o files.
+  void for_each_mod_of_target(int64_t tar_id,
+                              const std::function<void(const ModDto &)> &func);
+
+  // Files of mod `mod_id` ordered by file.
+  void for_each_mod_file(int64_t mod_id,
+                         const std::function<void(const std::string &)> &func);
+
+  // Backup files of mod `mod_id` ordered by file.
+  void for_each_backup_file(
+      int64_t mod_id, const std::function<void(const std::string &)> &func);
+
   result<ModDto> query_mod_by_targetid_dir(int64_t tar_id,
                                            const std::string &dir);
 
@@ -69,6 +158,18 @@ class DB {
 
   int delete_target(int64_t id);
 
+  int update_target_atomic(int64_t id, bool atomic);
+
+  int update_target_nocase(int64_t id, bool nocase);
+
+  // Serialized bloom filter of installed files of target `tar_id`.
+  result<std::vector<unsigned char>> query_target_bloom(int64_t tar_id);
+
+  void update_target_bloom(int64_t tar_id,
+                           const std::vector<unsigned char> &bloom);
+
+  int delete_target_bloom(int64_t tar_id);
+
   result_base delete_target_all(int64_t id);
 
   result<ModDto> query_mod(int64_t id);
@@ -78,6 +179,17 @@ class DB {
 
   int delete_mod(int64_t id);
 
+  // Files of installed mods of target `tar_id`, paired with their mod ids.
+  std::vector<std::pair<std::string, int64_t>> query_installed_files(
+      int64_t tar_id);
+
+  // Files of mods of target `tar_id` matching GLOB `pattern` as a whole, of
+  // installed mods only if `installed`, paired with their mod ids and ordered
+  // by file. A literal prefix of `pattern` is looked up as a range of the file
+  // index, other patterns in the trigram index of files if SQLite has one.
+  std::vector<std::pair<std::string, int64_t>> find_files(
+      int64_t tar_id, const std::string &pattern, bool installed = false);
+
   std::vector<ModDto> query_mods_contain_files(
       const std::vector<std::string> &files);
 
@@ -85,8 +197,68 @@ class DB {
 
   void uninstall_mod(int64_t id);
 
+  // Add backup files to installed mod `id`.
+  int insert_backup_files(int64_t id,
+                          const std::vector<std::string> &backup_files);
+
+  int delete_backup_files(int64_t id,
+                          const std::vector<std::string> &backup_files);
+
+  int insert_mod_files(int64_t mod_id, const std::vector<std::string> &files);
+
+  // Delete files of mod `mod_id` and drop their blob references.
+  // Returns blobs no longer referenced by any mod, their records are deleted.
+  std::vector<std::string> delete_mod_files(
+      int64_t mod_id, const std::vector<std::string> &files);
+
   int rename_mod(int64_t mid, const std::string &newname);
 
+  // Mods of all targets that were added from an archive of content `hash`.
+  std::vector<ModDto> query_mods_by_archive(const std::string &hash);
+
+  // Record that mod `mod_id` was added from an archive of content `hash`.
+  int insert_archive(int64_t mod_id, const std::string &hash);
+
+  int delete_archive(int64_t mod_id);
+
+  // Record content hashes of files of mod `mod_id`, and take a reference of
+  // the blob of each file linked into the blob store.
+  void update_mod_file_hashes(int64_t mod_id,
+                              const std::vector<FileHashDto> &file_hashes);
+
+  // Content hashes of all files of mod `mod_id` ordered by file, `hash` is
+  // empty if not recorded.
+  std::vector<FileHashDto> query_mod_file_hashes(int64_t mod_id);
+
+  // Record CRC-32s `crc` of files `dir` of mod `mod_id`, see `FileHashDto`.
+  void update_mod_file_crcs(int64_t mod_id,
+                            const std::vector<FileHashDto> &file_crcs);
+
+  // Record metadata of the symlinks of installed mod `mod_id`.
+  void update_link_metas(int64_t mod_id,
+                         const std::vector<LinkMetaDto> &link_metas);
+
+  // Link metadata of all files of mod `mod_id`.
+  std::vector<LinkMetaDto> query_link_metas(int64_t mod_id);
+
+  std::vector<std::string> query_backup_files(int64_t mod_id);
+
+  // Drop the blob references taken by mod `mod_id`.
+  // Returns blobs no longer referenced by any mod, their records are deleted.
+  std::vector<std::string> release_blobs(int64_t mod_id);
+
+  // Set mods of profile `name` of target `tar_id`, create it if not exists.
+  // Returns the profile id.
+  int64_t save_profile(int64_t tar_id, const std::string &name,
+                       const std::vector<int64_t> &mod_ids);
+
+  result<ProfileDto> query_profile(int64_t tar_id, const std::string &name);
+
+  // Profiles of target `tar_id` ordered by name.
+  std::vector<ProfileDto> query_profiles(int64_t tar_id);
+
+  int delete_profile(int64_t id);
+
  private:
   // db wrapper
   std::unique_ptr<db_wrap> m_dr;
@@ -103,6 +275,9 @@ class DB {
                            const std::vector<std::string> &bak_files);
 
   int delete_backup_files_(int64_t mod_id);
+
+  // Delete records of blobs no longer referenced, and return them.
+  std::vector<std::string> delete_unref_blobs_();
 };
 
 class DB::sp_wrap {
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <stop_token>
+
+#include "filemod/utils.hpp"
+
+namespace filemod {
+
+const char ERR_CANCELLED[] = "error: cancelled";
+
+// Files (and directories) and bytes changed by a modder call. Totals grow as
+// the call finds its work, e.g. once mods are checked to be installed, so
+// `files_done <= files_total` holds but totals may rise later.
+struct progress {
+  uint64_t files_done = 0;
+  uint64_t files_total = 0;
+  uint64_t bytes_done = 0;
+  uint64_t bytes_total = 0;
+};
+
+using progress_fn = std::function<void(const progress &)>;
+
+// Thrown out of a call whose task is stopped, its changes are rolled back on
+// the way out as for any other exception.
+class cancelled : public std::runtime_error {
+ public:
+  cancelled() : std::runtime_error{ERR_CANCELLED} {}
+};
+
+// Progress and stop request of a running modder call, shared by the threads
+// changing files for it.
+class task {
+ public:
+  task(std::stop_token stop, progress_fn on_progress)
+      : m_stop{std::move(stop)}, m_on_progress{std::move(on_progress)} {}
+
+  task(const task &) = delete;
+  task &operator=(const task &) = delete;
+
+  // Add work found, reported with the next progress.
+  FILEMOD_API void add_total(uint64_t files, uint64_t bytes);
+
+  // Add work done and report progress, serialized among threads. Other
+  // threads keep adding work while a report is running.
+  FILEMOD_API void add_done(uint64_t files, uint64_t bytes);
+
+  [[nodiscard]] bool stop_requested() const noexcept {
+    return m_stop.stop_requested();
+  }
+
+  // Throw `cancelled` if stop is requested.
+  void check_stop() const {
+    if (stop_requested()) {
+      throw cancelled{};
+    }
+  }
+
+ private:
+  std::stop_token m_stop;
+  progress_fn m_on_progress;
+  std::mutex m_mtx;  // guards m_progress
+  progress m_progress;
+  std::mutex m_report_mtx;  // serializes calls to m_on_progress
+};
+
+}  // namespace filemod
@@ -90,6 +90,10 @@ constexpr size_t length_s(const char *str) noexcept {
   return strlen(str);
 }
 
+// Lowercase ASCII letters of `str`, other bytes including UTF-8 sequences are
+// kept as is. Keys of case-insensitive targets are compared folded.
+FILEMOD_API std::string ascii_fold(std::string_view str);
+
 #ifdef _WIN32
 FILEMOD_API std::filesystem::path utf8str_to_path(std::string_view sv);
 
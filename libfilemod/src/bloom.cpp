@@ -0,0 +1,94 @@
+#include "filemod/bloom.hpp"
+
+#include <cstring>
+
+#include "filemod/hash.hpp"
+
+namespace filemod {
+
+// 10 bits per string and 7 probes give about 1% false positives
+constexpr uint64_t BITS_PER_STR = 10;
+constexpr unsigned NPROBES = 7;
+// capacity and size in front of the words
+constexpr size_t HEADER_SIZE = 2 * sizeof(uint64_t);
+
+bloom_filter::bloom_filter(size_t capacity)
+    : m_words((capacity * BITS_PER_STR + 63) / 64), m_capacity{capacity} {}
+
+// little-endian, as on all supported platforms
+std::optional<bloom_filter> bloom_filter::from_bytes(
+    const std::vector<unsigned char> &bytes) {
+  uint64_t capacity;
+  uint64_t size;
+  if (bytes.size() < HEADER_SIZE) {
+    return std::nullopt;
+  }
+  std::memcpy(&capacity, bytes.data(), sizeof(capacity));
+  std::memcpy(&size, bytes.data() + sizeof(capacity), sizeof(size));
+
+  if (capacity > (UINT64_MAX - 63) / BITS_PER_STR) {
+    return std::nullopt;
+  }
+  uint64_t nwords = (capacity * BITS_PER_STR + 63) / 64;
+  if ((bytes.size() - HEADER_SIZE) / sizeof(uint64_t) != nwords ||
+      (bytes.size() - HEADER_SIZE) % sizeof(uint64_t) != 0) {
+    return std::nullopt;
+  }
+
+  bloom_filter bloom{capacity};
+  bloom.m_size = size;
+  std::memcpy(bloom.m_words.data(), bytes.data() + HEADER_SIZE,
+              bloom.m_words.size() * sizeof(uint64_t));
+  return bloom;
+}
+
+std::vector<unsigned char> bloom_filter::to_bytes() const {
+  std::vector<unsigned char> bytes(HEADER_SIZE +
+                                   m_words.size() * sizeof(uint64_t));
+  std::memcpy(bytes.data(), &m_capacity, sizeof(m_capacity));
+  std::memcpy(bytes.data() + sizeof(m_capacity), &m_size, sizeof(m_size));
+  std::memcpy(bytes.data() + HEADER_SIZE, m_words.data(),
+              m_words.size() * sizeof(uint64_t));
+  return bytes;
+}
+
+// Probes are derived from one 64 bit hash by double hashing.
+template <typename Func>
+static void for_each_probe(std::string_view str, uint64_t nbits, Func func) {
+  xxh64 hasher;
+  hasher.update(str.data(), str.size());
+  uint64_t hash = hasher.digest();
+  uint64_t h1 = hash & 0xffffffff;
+  uint64_t h2 = (hash >> 32) | 1;
+  for (unsigned i = 0; i < NPROBES; ++i) {
+    if (!func((h1 + i * h2) % nbits)) {
+      return;
+    }
+  }
+}
+
+void bloom_filter::add(std::string_view str) {
+  ++m_size;
+  if (m_words.empty()) {
+    return;
+  }
+  for_each_probe(str, m_words.size() * 64, [this](uint64_t bit) {
+    m_words[bit / 64] |= uint64_t{1} << (bit % 64);
+    return true;
+  });
+}
+
+bool bloom_filter::may_contain(std::string_view str) const {
+  if (m_words.empty()) {
+    // an empty filter of capacity 0 knows nothing
+    return m_size > 0;
+  }
+  bool found = true;
+  for_each_probe(str, m_words.size() * 64, [&](uint64_t bit) {
+    found = m_words[bit / 64] & (uint64_t{1} << (bit % 64));
+    return found;
+  });
+  return found;
+}
+
+}  // namespace filemod
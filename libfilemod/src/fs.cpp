@@ -8,8 +8,15 @@
 #include <ranges>
 #include <stdexcept>
 #include <system_error>
+#include <unordered_map>
 
 #include "filemod/fs_manager.hpp"
+#include "filemod/fs_utils.hpp"
+#include "filemod/parallel.hpp"
+#include "filemod/path_buf.hpp"
+#include "filemod/private/fs_batch.hpp"
+#include "filemod/private/utils.hpp"
+#include "filemod/utils.hpp"
 
 namespace filemod {
 
@@ -18,15 +25,29 @@ void tx_scope::rollback() {
     return;
   }
 
-  for (auto &child : m_children) {
-    child.rollback();
+  // undo in reverse order of changes, children interleaved with own records
+  size_t last = m_fsman.size();
+  for (size_t i = m_children.size(); i-- > 0;) {
+    m_fsman.revert(m_child_marks[i], last);
+    m_children[i].rollback();
+    last = m_child_marks[i];
   }
-
-  m_fsman.revert();
+  m_fsman.revert(0, last);
   m_rollbacked = true;
 }
 
-void tx_scope::reset() { m_children.clear(); }
+void tx_scope::reset() {
+  m_children.clear();
+  m_child_marks.clear();
+}
+
+// Scope a worker thread of FS::parallel_tx() changes files of `fs` in.
+struct worker_scope {
+  const FS *fs = nullptr;
+  tx_scope *scope = nullptr;
+};
+
+static thread_local worker_scope t_worker;
 
 static void check_dir_exist(const std::filesystem::path &dir) {
   if (!std::filesystem::is_directory(dir)) {
@@ -42,22 +63,67 @@ static void check_dir_not_exist(const std::filesystem::path &dir) {
   }
 }
 
-// Returns conflict target files
-static std::vector<std::filesystem::path> find_conflict_files(
-    const std::filesystem::path &cfg_mod,
-    const std::filesystem::path &tar_dir) {
-  std::vector<std::filesystem::path> tar_files;
-  for (const auto &cfg_mod_file :
-       std::filesystem::recursive_directory_iterator(cfg_mod)) {
-    if (!cfg_mod_file.is_directory()) {
-      auto mod_file_rel =
-          std::filesystem::relative(cfg_mod_file.path(), cfg_mod);
-      auto tar_file = tar_dir / mod_file_rel;
-      if (std::filesystem::exists(tar_file)) {
-        tar_files.push_back(tar_file);
-      }
+std::filesystem::path tar_paths::rel(const std::filesystem::path &file_rel) {
+  if (!m_nocase) {
+    return file_rel;
+  }
+
+  std::filesystem::path dir_rel;
+  if (auto parent = file_rel.parent_path(); !parent.empty()) {
+    auto key = path_to_utf8str(parent);
+    auto it = m_dirs.find(key);
+    if (it == m_dirs.end()) {
+      it = m_dirs.emplace(std::move(key), rel(parent)).first;
+    }
+    dir_rel = it->second;
+  }
+  auto name = find_(dir_rel, file_rel.filename());
+  return dir_rel /= name;
+}
+
+std::filesystem::path tar_paths::find_(const std::filesystem::path &dir_rel,
+                                       const std::filesystem::path &name) {
+  auto dir = m_tar_dir / dir_rel;
+  std::error_code ec;
+  if (auto status = std::filesystem::symlink_status(dir / name, ec);
+      std::filesystem::exists(status)) {
+    return name;
+  }
+
+  auto [it, inserted] = m_listings.try_emplace(path_to_utf8str(dir_rel));
+  if (inserted && std::filesystem::is_directory(dir, ec)) {
+    for (const auto &entry : std::filesystem::directory_iterator(dir)) {
+      auto entry_name = entry.path().filename();
+      it->second.try_emplace(ascii_fold(path_to_utf8str(entry_name)),
+                             std::move(entry_name));
     }
   }
+  auto found = it->second.find(ascii_fold(path_to_utf8str(name)));
+  return found == it->second.end() ? name : found->second;
+}
+
+// Returns conflict target files, matched as by `tar`
+static std::vector<std::filesystem::path> find_conflict_files(
+    const std::filesystem::path &cfg_mod, const dir_handle &cfg_mod_h,
+    tar_paths &tar, const dir_handle &tar_h, bool nocase) {
+  std::vector<std::filesystem::path> tar_files;
+  path_buf tar_file{tar.dir(), tar_h.fd()};
+  walk_tree(
+      cfg_mod, cfg_mod_h.fd(), [&](const path_buf &cfg_mod_file, bool is_dir) {
+        if (is_dir) {
+          return;
+        }
+        tar_file.join(cfg_mod_file.rel());
+        if (stat_type(tar_file) != std::filesystem::file_type::not_found) {
+          tar_files.emplace_back(tar_file.view());
+        } else if (nocase) {
+          auto found = tar.dir() / tar.rel(cfg_mod_file.rel());
+          if (std::filesystem::exists(found) &&
+              !std::filesystem::is_directory(found)) {
+            tar_files.push_back(std::move(found));
+          }
+        }
+      });
   return tar_files;
 }
 
@@ -84,28 +150,51 @@ FS::~FS() noexcept {
 
 void FS::create_target(int64_t tar_id) {
   // create new folder named tar_id
-  m_curr_scope->get_fsman().create_d(get_cfg_tar(tar_id));
+  fsman_().create_d(get_cfg_tar(tar_id));
+}
+
+// Returns the size of a regular file copied, otherwise 0.
+static uint64_t copy_mod_file(path_ref mod_file, bool is_dir,
+                              path_ref cfg_mod_file, fsman &fsman) {
+  if (is_dir) {
+    fsman.create_d(cfg_mod_file);
+    return 0;
+  }
+  fsman.cp_f(mod_file, cfg_mod_file);
+  return regular_size(cfg_mod_file);
 }
 
 std::vector<std::filesystem::path> copy_mod(
     const std::filesystem::path &mod_dir, const std::filesystem::path &cfg_mod,
     fsman &fsman) {
   std::vector<std::filesystem::path> mod_file_rels;
-  // copy from src to dest folder
-  for (auto &mod_file :
-       std::filesystem::recursive_directory_iterator(mod_dir)) {
-    auto mod_file_rel = std::filesystem::relative(mod_file, mod_dir);
-    auto cfg_mod_file = cfg_mod / mod_file_rel;
-
-    if (mod_file.is_directory()) {
-      fsman.create_d(std::move(cfg_mod_file));
-    } else {
-      fsman.cp_f(mod_file.path(), std::move(cfg_mod_file));
-    }
-
-    mod_file_rels.push_back(mod_file_rel);
+  dir_handle mod_dir_h{mod_dir};
+  if (auto *task = fsman.get_task()) {
+    uint64_t files = 0;
+    uint64_t bytes = 0;
+    walk_tree(
+        mod_dir, mod_dir_h.fd(), [&](const path_buf &mod_file, bool is_dir) {
+          if (!is_dir) {
+            ++files;
+            bytes += regular_size(mod_file);
+          }
+        });
+    task->add_total(files, bytes);
   }
 
+  // copy from src to dest folder
+  dir_handle cfg_mod_h{cfg_mod};
+  path_buf cfg_mod_file{cfg_mod, cfg_mod_h.fd()};
+  walk_tree(
+      mod_dir, mod_dir_h.fd(), [&](const path_buf &mod_file, bool is_dir) {
+        cfg_mod_file.join(mod_file.rel());
+        auto size = copy_mod_file(mod_file, is_dir, cfg_mod_file, fsman);
+        mod_file_rels.emplace_back(mod_file.rel());
+        if (!is_dir) {
+          fsman.report(1, size);
+        }
+      });
+
   return mod_file_rels;
 }
 
@@ -123,9 +212,9 @@ std::vector<std::filesystem::path> FS::add_mod_base(
   check_dir_exist(cfg_mod.parent_path());
   check_dir_not_exist(cfg_mod);
 
-  m_curr_scope->get_fsman().create_d(cfg_mod);
+  fsman_().create_d(cfg_mod);
 
-  return copy_mod(mod_src, cfg_mod, m_curr_scope->get_fsman());
+  return copy_mod(mod_src, cfg_mod, fsman_());
 }
 
 std::vector<std::filesystem::path> FS::backup_files_(
@@ -138,7 +227,7 @@ std::vector<std::filesystem::path> FS::backup_files_(
   }
 
   const auto bak_dir = get_bak_dir(cfg_mod.parent_path());
-  m_curr_scope->get_fsman().create_d(bak_dir);
+  fsman_().create_d(bak_dir);
 
   for (auto &tar_file : tar_files) {
     auto tar_file_rel = std::filesystem::relative(tar_file, tar_dir);
@@ -151,23 +240,35 @@ std::vector<std::filesystem::path> FS::backup_files_(
 }
 
 std::vector<std::filesystem::path> FS::install_mod(
-    const std::filesystem::path &cfg_mod,
-    const std::filesystem::path &tar_dir) {
-  // check if conflict with original files
-  auto bak_file_rels =
-      backup_files_(cfg_mod, tar_dir, find_conflict_files(cfg_mod, tar_dir));
+    const std::filesystem::path &cfg_mod, const std::filesystem::path &tar_dir,
+    bool nocase) {
+  dir_handle cfg_mod_h{cfg_mod};
+  dir_handle tar_h{tar_dir};
+  tar_paths tar{tar_dir, nocase};
 
-  for (const auto &cfg_mod_file :
-       std::filesystem::recursive_directory_iterator(cfg_mod)) {
-    auto mod_file_rel = std::filesystem::relative(cfg_mod_file.path(), cfg_mod);
-    auto tar_file = tar_dir / mod_file_rel;
-    if (cfg_mod_file.is_directory()) {
-      m_curr_scope->get_fsman().create_d(std::move(tar_file));
-    } else {
-      m_curr_scope->get_fsman().create_s(cfg_mod_file.path(),
-                                         std::move(tar_file));
-    }
-  }
+  // check if conflict with original files
+  auto bak_file_rels = backup_files_(
+      cfg_mod, tar_dir,
+      find_conflict_files(cfg_mod, cfg_mod_h, tar, tar_h, nocase));
+
+  auto &fsman = fsman_();
+  fs_batch batch{fsman};
+  path_buf tar_file{tar_dir, tar_h.fd()};
+  walk_tree(
+      cfg_mod, cfg_mod_h.fd(), [&](const path_buf &cfg_mod_file, bool is_dir) {
+        if (nocase) {
+          // into existing directories of another case
+          tar_file.join(tar.rel(cfg_mod_file.rel()).native());
+        } else {
+          tar_file.join(cfg_mod_file.rel());
+        }
+        if (is_dir) {
+          batch.create_d(tar_file);
+        } else {
+          batch.create_s(cfg_mod_file, tar_file);
+        }
+      });
+  batch.flush();
 
   return bak_file_rels;
 }
@@ -175,7 +276,8 @@ std::vector<std::filesystem::path> FS::install_mod(
 void FS::uninstall_mod(
     const std::filesystem::path &cfg_mod, const std::filesystem::path &tar_dir,
     const std::vector<std::filesystem::path> &sorted_mod_file_rels,
-    const std::vector<std::filesystem::path> &sorted_bak_file_rels) {
+    const std::vector<std::filesystem::path> &sorted_bak_file_rels,
+    bool nocase) {
   if (sorted_mod_file_rels.empty() && sorted_bak_file_rels.empty()) {
     return;
   }
@@ -184,45 +286,141 @@ void FS::uninstall_mod(
   std::filesystem::create_directories(tmp_uni_dir);
 
   // remove (move) symlinks and dirs
-  move_mod_files_(tar_dir, tmp_uni_dir, sorted_mod_file_rels);
+  if (nocase) {
+    // all found before any is moved
+    tar_paths tar{tar_dir, true};
+    std::vector<std::filesystem::path> tar_file_rels;
+    tar_file_rels.reserve(sorted_mod_file_rels.size());
+    for (const auto &mod_file_rel : sorted_mod_file_rels) {
+      tar_file_rels.push_back(tar.rel(mod_file_rel));
+    }
+    move_mod_files_(tar_dir, tmp_uni_dir, tar_file_rels);
+  } else {
+    move_mod_files_(tar_dir, tmp_uni_dir, sorted_mod_file_rels);
+  }
+  fsman_().report(sorted_mod_file_rels.size(), 0);
 
   // restore backups
   auto bak_dir = get_bak_dir(cfg_mod.parent_path());
   move_mod_files_(bak_dir, tar_dir, sorted_bak_file_rels);
 }
 
+std::filesystem::path FS::repair_file(const std::filesystem::path &cfg_mod,
+                                      tar_paths &tar,
+                                      const std::filesystem::path &file_rel) {
+  auto &fsman = fsman_();
+  auto cfg_mod_file = cfg_mod / file_rel;
+  auto tar_file_rel = tar.rel(file_rel);
+  auto tar_file = tar.dir() / tar_file_rel;
+  bool is_dir = std::filesystem::is_directory(cfg_mod_file);
+  std::filesystem::path bak_file_rel;
+
+  if (auto status = std::filesystem::symlink_status(tar_file);
+      std::filesystem::is_directory(status)) {
+    if (is_dir) {
+      return bak_file_rel;
+    }
+    throw std::runtime_error{"cannot repair, directory in place of file: " +
+                             tar_file.string()};
+  } else if (std::filesystem::exists(status)) {
+    const auto bak_dir = get_bak_dir(cfg_mod.parent_path());
+    auto bak_file = bak_dir / tar_file_rel;
+    if (std::filesystem::exists(std::filesystem::symlink_status(bak_file))) {
+      auto tmp_bak_dir = (get_tmp_dir() /= *-- --cfg_mod.end()) /= BACKUP_DIR;
+      std::filesystem::create_directories(tmp_bak_dir);
+      move_file_(bak_file, tmp_bak_dir / tar_file_rel, tmp_bak_dir);
+    }
+    fsman.create_d(bak_dir);
+    move_file_(tar_file, bak_file, bak_dir);
+    bak_file_rel = tar_file_rel;
+  }
+
+  visit_through_path(tar_file_rel.parent_path(), tar.dir(),
+                     [&](const auto &visited_dir) {
+                       fsman.create_d(visited_dir);
+                     });
+  if (is_dir) {
+    fsman.create_d(std::move(tar_file));
+  } else {
+    fsman.create_s(std::move(cfg_mod_file), std::move(tar_file));
+  }
+  return bak_file_rel;
+}
+
+void FS::remove_mod_files(
+    const std::filesystem::path &cfg_mod,
+    const std::vector<std::filesystem::path> &sorted_file_rels) {
+  auto tmp_cfg_mod = get_tmp_dir() /= *-- --cfg_mod.end() / *--cfg_mod.end();
+  std::filesystem::create_directories(tmp_cfg_mod);
+  move_mod_files_(cfg_mod, tmp_cfg_mod, sorted_file_rels);
+}
+
+void FS::copy_mod_files(
+    const std::filesystem::path &mod_dir, const std::filesystem::path &cfg_mod,
+    const std::vector<std::filesystem::path> &sorted_file_rels) {
+  auto &fsman = fsman_();
+  dir_handle mod_dir_h{mod_dir};
+  dir_handle cfg_mod_h{cfg_mod};
+  path_buf mod_file{mod_dir, mod_dir_h.fd()};
+  path_buf cfg_mod_file{cfg_mod, cfg_mod_h.fd()};
+  for (const auto &file_rel : sorted_file_rels) {
+    mod_file.join(file_rel.native());
+    cfg_mod_file.join(file_rel.native());
+    copy_mod_file(
+        mod_file,
+        stat_type(mod_file) == std::filesystem::file_type::directory,
+        cfg_mod_file, fsman);
+  }
+}
+
 void FS::move_mod_files_(
     const std::filesystem::path &src_dir, const std::filesystem::path &dest_dir,
     const std::vector<std::filesystem::path> &sorted_file_rels) {
-  std::vector<std::filesystem::path> sorted_dirs;
-
-  for (auto &sorted_file_rel : sorted_file_rels) {
-    auto src_file = src_dir / sorted_file_rel;
+  if (sorted_file_rels.empty()) {
+    return;
+  }
 
-    auto status = std::filesystem::status(src_file);
-    if (std::filesystem::exists(status)) {
-      if (std::filesystem::is_directory(status)) {
-        sorted_dirs.push_back(src_file);
-      } else {
-        auto dest_file = dest_dir / sorted_file_rel;
-        move_file_(src_file, dest_file, dest_dir);
-      }
+  auto &fsman = fsman_();
+  fs_batch batch{fsman};
+  dir_handle src_h{src_dir};
+  dir_handle dest_h{dest_dir};
+  path_buf src_file{src_dir, src_h.fd()};
+  path_buf dest_file{dest_dir, dest_h.fd()};
+  // indices of directories in `sorted_file_rels`
+  std::vector<size_t> dir_idxs;
+
+  for (size_t i = 0; i < sorted_file_rels.size(); ++i) {
+    src_file.join(sorted_file_rels[i].native());
+
+    auto type = stat_type(src_file);
+    if (type == std::filesystem::file_type::directory) {
+      dir_idxs.push_back(i);
+    } else if (type != std::filesystem::file_type::not_found) {
+      dest_file.join(sorted_file_rels[i].native());
+      dest_file.for_each_parent([&](path_ref dir) { batch.create_d(dir); });
+      batch.mv_f(src_file, dest_file);
     }
   }
+  batch.flush();
 
-  delete_empty_dirs_(std::move(sorted_dirs));
+  // delete empty dirs, children first
+  for (auto i : std::ranges::reverse_view(dir_idxs)) {
+    fsman.rm_d(src_file.join(sorted_file_rels[i].native()));
+  }
 }
 
 void FS::move_file_(const std::filesystem::path &src_file,
                     const std::filesystem::path &dest_file,
                     const std::filesystem::path &dest_dir) {
-  visit_through_path(
-      std::filesystem::relative(dest_file.parent_path(), dest_dir), dest_dir,
-      [&](const auto &visited_dir) {
-        m_curr_scope->get_fsman().create_d(visited_dir);
-      });
+  path_buf dest{dest_dir};
+  dest.join(dest_file.lexically_relative(dest_dir).native());
+  move_file_(src_file, dest);
+}
 
-  m_curr_scope->get_fsman().mv_f(src_file, dest_file);
+void FS::move_file_(path_ref src_file, path_buf &dest_file) {
+  auto &fsman = fsman_();
+  dest_file.for_each_parent([&](path_ref dir) { fsman.create_d(dir); });
+  fsman.mv_f(src_file, dest_file);
 }
 
 void FS::remove_mod(const std::filesystem::path &cfg_mod) {
@@ -255,6 +453,97 @@ void FS::remove_target(int64_t tar_id) {
   delete_empty_dirs_({cfg_tar, cfg_tar / BACKUP_DIR});
 }
 
+bool FS::link_blob(const std::filesystem::path &file,
+                   const std::string &hash) {
+  auto blob = get_blob(hash);
+  auto &fsman = fsman_();
+
+  if (!std::filesystem::exists(blob)) {
+    visit_through_path(
+        std::filesystem::relative(blob.parent_path(), m_cfg_dir), m_cfg_dir,
+        [&](const auto &visited_dir) { fsman.create_d(visited_dir); });
+    fsman.create_h(file, std::move(blob));
+    return true;
+  }
+
+  // hash collision, keep the file on its own
+  if (!same_content(file, blob)) {
+    return false;
+  }
+
+  // creation of `file` is already logged
+  std::filesystem::remove(file);
+  fsman.create_h(std::move(blob), file);
+  return true;
+}
+
+void FS::remove_blobs(const std::vector<std::string> &hashes) {
+  if (hashes.empty()) {
+    return;
+  }
+
+  auto tmp_blob_dir = get_tmp_dir() /= BLOB_DIR;
+  std::filesystem::create_directories(tmp_blob_dir);
+
+  for (const auto &hash : hashes) {
+    auto blob = get_blob(hash);
+    if (std::filesystem::exists(blob)) {
+      move_file_(blob, tmp_blob_dir / hash, tmp_blob_dir);
+      // only succeeds once the fan-out directory is empty
+      fsman_().rm_d(blob.parent_path());
+    }
+  }
+}
+
+// `<dir><suffix>` next to `dir`.
+static std::filesystem::path sibling_dir(const std::filesystem::path &dir,
+                                         const char *suffix) {
+  auto sibling = dir.parent_path() / dir.filename();
+  return sibling += suffix;
+}
+
+std::filesystem::path FS::begin_generation(
+    const std::filesystem::path &tar_dir) {
+  check_dir_exist(tar_dir);
+  auto gen_dir = sibling_dir(tar_dir, GEN_NEXT_SUFFIX);
+  // left over by a crash
+  std::filesystem::remove_all(gen_dir);
+
+  std::filesystem::create_directory(gen_dir);
+  fsman_().log_create_tree(gen_dir);
+  for (auto it = std::filesystem::recursive_directory_iterator(tar_dir);
+       it != std::filesystem::recursive_directory_iterator(); ++it) {
+    // lexically, links of installed mods must not be followed
+    auto gen_file = gen_dir / it->path().lexically_relative(tar_dir);
+    if (it->is_symlink()) {
+      std::filesystem::copy_symlink(it->path(), gen_file);
+    } else if (it->is_directory()) {
+      std::filesystem::create_directory(gen_file);
+    } else {
+      std::filesystem::create_hard_link(it->path(), gen_file);
+    }
+  }
+  return gen_dir;
+}
+
+void FS::activate_generation(const std::filesystem::path &tar_dir,
+                             const std::filesystem::path &gen_dir) {
+  auto prev_dir = get_prev_gen(tar_dir);
+  auto &fsman = fsman_();
+  if (std::filesystem::exists(prev_dir)) {
+    // numbered by the outermost transaction, an existing one is left over by
+    // a crash
+    auto stale_dir = sibling_dir(tar_dir, GEN_STALE_SUFFIX) +=
+        std::to_string(m_stale_gens.size());
+    std::filesystem::remove_all(stale_dir);
+    fsman.rename_d(prev_dir, stale_dir);
+    m_stale_gens.push_back(std::move(stale_dir));
+  }
+
+  fsman.exchange_d(gen_dir, tar_dir);
+  fsman.rename_d(gen_dir, std::move(prev_dir));
+}
+
 void FS::rename_mod(int64_t tar_id, const std::filesystem::path &oldname,
                     const std::filesystem::path &newname) {
   auto oldpath = get_cfg_mod(tar_id, oldname);
@@ -265,21 +554,59 @@ void FS::rename_mod(int64_t tar_id, const std::filesystem::path &oldname,
     throw std::runtime_error{"rename mod error: Parent not the same"};
   }
 
-  m_curr_scope->get_fsman().rename_d(std::move(oldpath), std::move(newpath));
+  fsman_().rename_d(std::move(oldpath), std::move(newpath));
 }
 
 void FS::delete_empty_dirs_(std::vector<std::filesystem::path> &&sorted_dirs) {
   for (auto &sorted_dir : std::ranges::reverse_view(sorted_dirs)) {
-    m_curr_scope->get_fsman().rm_d(std::move(sorted_dir));
+    fsman_().rm_d(std::move(sorted_dir));
   }
 }
 
-void FS::begin_tx_() { m_curr_scope = &m_curr_scope->new_child(); }
+void FS::parallel_tx(size_t n, const std::function<void(size_t)> &func) {
+  auto scopes = curr_scope_()->new_children(n);
+  parallel_for(n, [&](size_t i) {
+    // the calling thread is a worker too, restore its scope after
+    auto prev = t_worker;
+    t_worker = {.fs = this, .scope = scopes[i]};
+    try {
+      func(i);
+    } catch (...) {
+      t_worker = prev;
+      throw;
+    }
+    t_worker = prev;
+  });
+}
+
+tx_scope *&FS::curr_scope_() {
+  return t_worker.fs == this ? t_worker.scope : m_curr_scope;
+}
+
+fsman &FS::fsman_() {
+  auto &fsman = curr_scope_()->get_fsman();
+  fsman.set_task(m_task);
+  return fsman;
+}
 
-void FS::end_tx_() {
-  m_curr_scope = m_curr_scope->parent();
-  if (m_curr_scope == &m_root_scope) {
+void FS::begin_tx_() {
+  auto &scope = curr_scope_();
+  scope = &scope->new_child();
+}
+
+void FS::end_tx_(bool committed) {
+  auto &scope = curr_scope_();
+  scope = scope->parent();
+  if (scope == &m_root_scope) {
     m_root_scope.reset();
+    // moved back in place if rolled back
+    if (committed) {
+      for (const auto &stale_dir : m_stale_gens) {
+        std::error_code ec;
+        std::filesystem::remove_all(stale_dir, ec);
+      }
+    }
+    m_stale_gens.clear();
   }
 }
 
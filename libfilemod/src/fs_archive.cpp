@@ -6,13 +6,102 @@
 #include <algorithm>
 #include <clocale>
 #include <cstring>
+#include <exception>
+#include <fstream>
 #include <memory>
+#include <numeric>
+#include <set>
 #include <stdexcept>
+#include <system_error>
+#include <thread>
 #include <vector>
 
+#include "filemod/utils.hpp"
+
 namespace filemod {
 
-static int copy_data(archive *ar, archive *aw) {
+// Read block size passed to libarchive. Large blocks cut the number of read
+// syscalls and let the zip/rar readers hand out bigger zero-copy buffers.
+constexpr size_t READ_BLOCK_SIZE = 1024 * 1024;
+
+// Parallel zip extraction: upper bound of worker threads, and the minimal
+// amount of work (files or uncompressed bytes) worth a worker of its own.
+constexpr unsigned MAX_EXTRACT_WORKERS = 8;
+constexpr size_t MIN_FILES_PER_WORKER = 32;
+constexpr la_int64_t MIN_BYTES_PER_WORKER = 4 * 1024 * 1024;
+
+constexpr size_t ERR_SIZE = 512;
+
+// Returned by scan_entries() once the archive turns out not to be zip.
+constexpr int SCAN_NOT_ZIP = ARCHIVE_FATAL - 1;
+
+// Zip records read by read_zip_crcs(), see APPNOTE.TXT of PKWARE.
+constexpr uint32_t ZIP_EOCD_SIG = 0x06054b50;
+constexpr size_t ZIP_EOCD_SIZE = 22;
+constexpr size_t ZIP_MAX_COMMENT = 0xffff;
+constexpr uint32_t ZIP_CDH_SIG = 0x02014b50;
+constexpr size_t ZIP_CDH_SIZE = 46;
+constexpr uint16_t ZIP_FLAG_UTF8 = 0x800;
+constexpr uint16_t ZIP_EXTRA_UNICODE_PATH = 0x7075;
+constexpr uint8_t ZIP_HOST_UNIX = 3;
+constexpr uint32_t ZIP64_MARK = 0xffffffff;
+
+using archive_ptr = std::unique_ptr<archive, void (*)(archive *)>;
+
+// Relative path of an archive entry, e.g. "./a/b/" -> "a/b".
+static std::filesystem::path entry_rel_path(
+    const std::filesystem::path &entry_path) {
+  auto rel = entry_path.lexically_normal();
+  if (!rel.has_filename()) {
+    rel = rel.parent_path();
+  }
+  return rel;
+}
+
+static void set_err(char *err, size_t errsize, const char *msg) {
+  strncpy(err, msg ? msg : "unknown archive error", errsize - 1);
+  err[errsize - 1] = '\0';
+}
+
+static archive_ptr new_reader() {
+  archive_ptr a{archive_read_new(), [](archive *a) {
+                  archive_read_close(a);
+                  archive_read_free(a);
+                }};
+  archive_read_support_format_zip(a.get());
+  archive_read_support_format_tar(a.get());
+  archive_read_support_format_rar(a.get());
+  archive_read_support_format_rar5(a.get());
+  archive_read_support_filter_gzip(a.get());
+  return a;
+}
+
+static int open_reader(archive *a, const std::filesystem::path &filepath) {
+#ifdef _WIN32
+  return archive_read_open_filename_w(a, filepath.c_str(), READ_BLOCK_SIZE);
+#else
+  return archive_read_open_filename(a, filepath.c_str(), READ_BLOCK_SIZE);
+#endif
+}
+
+static archive_ptr new_disk_writer() {
+  /* Select which attributes we want to restore. */
+  int flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM |
+              ARCHIVE_EXTRACT_ACL | ARCHIVE_EXTRACT_FFLAGS;
+  flags |= ARCHIVE_EXTRACT_SECURE_NODOTDOT;
+
+  archive_ptr ext{archive_write_disk_new(), [](archive *ext) {
+                    archive_write_close(ext);
+                    archive_write_free(ext);
+                  }};
+  archive_write_disk_set_options(ext.get(), flags);
+  archive_write_disk_set_standard_lookup(ext.get());
+  return ext;
+}
+
+// Copy data of the current entry, reporting bytes written to `task` if any.
+// Stops w/ ARCHIVE_FATAL once the task is stopped.
+static int copy_data(archive *ar, archive *aw, task *task) {
   const void *buff;
   size_t size;
   la_int64_t offset;
@@ -30,52 +119,80 @@ static int copy_data(archive *ar, archive *aw) {
     if (wr < ARCHIVE_OK) {
       break;
     }
+    if (task) {
+      task->add_done(0, size);
+      if (task->stop_requested()) {
+        return ARCHIVE_FATAL;
+      }
+    }
+  }
+  return r;
+}
+
+static const auto *entry_pathname(archive_entry *entry) {
+#ifdef _WIN32
+  return archive_entry_pathname_w(entry);
+#else
+  return archive_entry_pathname(entry);
+#endif
+}
+
+// Write `entry` to `newpath` through `ext`, including its data, reporting
+// progress to `task` if any.
+static int write_entry(archive *a, archive *ext, archive_entry *entry,
+                       const std::filesystem::path &newpath, task *task,
+                       char *err, size_t errsize) {
+#ifdef _WIN32
+  archive_entry_copy_pathname_w(entry, newpath.c_str());
+#else
+  archive_entry_set_pathname(entry, newpath.c_str());
+#endif
+
+  int r = archive_write_header(ext, entry);
+  if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+    set_err(err, errsize, archive_error_string(ext));
+    return r;
+  }
+
+  if (archive_entry_size(entry) > 0) {
+    r = copy_data(a, ext, task);
+    if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+      set_err(err, errsize,
+              task && task->stop_requested() ? ERR_CANCELLED
+                                             : archive_error_string(ext));
+      return r;
+    }
+  }
+
+  r = archive_write_finish_entry(ext);
+  if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+    set_err(err, errsize, archive_error_string(ext));
+  } else if (task && archive_entry_filetype(entry) != AE_IFDIR) {
+    task->add_done(1, 0);
   }
   return r;
 }
 
 // Extract absolute path `filepath` to `destdir`, both already exist in disk.
-// Outputs all absolute path of files and directories created on disk to
-// `outpaths`.
+// Outputs relative path of files and directories created on disk to
+// `outrels`, taken from the entry names. Entries are added to the totals of
+// `task` if any as they are read. Entries `filter`, if any, returns false for
+// are skipped.
 // Require setting LC_CTYPE to utf8, e.g. `setlocale(LC_CTYPE, "en_US.UTF-8")`.
-static int extract(const std::filesystem::path &filepath,
-                   const std::filesystem::path &destdir, char *err,
-                   size_t errsize,
-                   std::vector<std::filesystem::path> &outpaths) {
+static int extract(
+    const std::filesystem::path &filepath, const std::filesystem::path &destdir,
+    task *task, char *err, size_t errsize,
+    std::vector<std::filesystem::path> &outrels,
+    const std::function<bool(const std::filesystem::path &)> &filter) {
   struct archive_entry *entry;
-  int flags;
   int r;
 
-  /* Select which attributes we want to restore. */
-  flags = ARCHIVE_EXTRACT_TIME | ARCHIVE_EXTRACT_PERM | ARCHIVE_EXTRACT_ACL |
-          ARCHIVE_EXTRACT_FFLAGS;
-  flags |= ARCHIVE_EXTRACT_SECURE_NODOTDOT;
-
-  std::unique_ptr<archive, void (*)(archive *)> a{archive_read_new(),
-                                                  [](archive *a) {
-                                                    archive_read_close(a);
-                                                    archive_read_free(a);
-                                                  }};
-  archive_read_support_format_zip(a.get());
-  archive_read_support_format_tar(a.get());
-  archive_read_support_format_rar(a.get());
-  archive_read_support_format_rar5(a.get());
-  archive_read_support_filter_gzip(a.get());
-  std::unique_ptr<archive, void (*)(archive *)> ext{archive_write_disk_new(),
-                                                    [](archive *ext) {
-                                                      archive_write_close(ext);
-                                                      archive_write_free(ext);
-                                                    }};
-  archive_write_disk_set_options(ext.get(), flags);
-  archive_write_disk_set_standard_lookup(ext.get());
+  auto a = new_reader();
+  auto ext = new_disk_writer();
 
-#ifdef _WIN32
-  r = archive_read_open_filename_w(a.get(), filepath.c_str(), 10240);
-#else
-  r = archive_read_open_filename(a.get(), filepath.c_str(), 10240);
-#endif
+  r = open_reader(a.get(), filepath);
   if (r != ARCHIVE_OK) {
-    strncpy(err, archive_error_string(a.get()), errsize);
+    set_err(err, errsize, archive_error_string(a.get()));
     return r;
   }
 
@@ -85,77 +202,470 @@ static int extract(const std::filesystem::path &filepath,
       break;
     }
     if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
-      strncpy(err, archive_error_string(a.get()), errsize);
+      set_err(err, errsize, archive_error_string(a.get()));
       break;
     }
 
-#ifdef _WIN32
-    const wchar_t *original_path = archive_entry_pathname_w(entry);
-#else
-    const char *original_path = archive_entry_pathname(entry);
-#endif
+    const auto *original_path = entry_pathname(entry);
     if (!original_path) {
       r = ARCHIVE_FATAL;
-      strncpy(err, archive_error_string(a.get()), errsize);
+      set_err(err, errsize, archive_error_string(a.get()));
       break;
     }
-    std::filesystem::path newpath{destdir / original_path};
-#ifdef _WIN32
-    archive_entry_copy_pathname_w(entry, newpath.c_str());
-#else
-    archive_entry_set_pathname(entry, newpath.c_str());
-#endif
+    if (task && task->stop_requested()) {
+      r = ARCHIVE_FATAL;
+      set_err(err, errsize, ERR_CANCELLED);
+      break;
+    }
+    auto rel = entry_rel_path(original_path);
+    if (filter && !filter(rel)) {
+      continue;  // next header skips the data
+    }
+    auto newpath = destdir / rel;
+
+    // maybe half write, so log regular file no matter what
+    outrels.push_back(std::move(rel));
 
-    r = archive_write_header(ext.get(), entry);
+    if (task && archive_entry_filetype(entry) != AE_IFDIR) {
+      task->add_total(1, std::max<la_int64_t>(archive_entry_size(entry), 0));
+    }
+    r = write_entry(a.get(), ext.get(), entry, newpath, task, err, errsize);
     if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
-      strncpy(err, archive_error_string(ext.get()), errsize);
       break;
     }
+  }
+  return r;
+}
 
-    // maybe half write, so log regular file no matter what
-    outpaths.push_back(std::move(newpath));
+// Collect entries of `filepath` from headers only. Entry data is skipped,
+// which costs no decompression for zip, as the seekable reader uses the
+// central directory. If `zip_only`, stops and returns SCAN_NOT_ZIP as soon as
+// the archive turns out not to be zip.
+static int scan_entries(const std::filesystem::path &filepath,
+                        std::vector<archive_file> &entries, bool zip_only,
+                        char *err, size_t errsize) {
+  struct archive_entry *entry;
+  int r;
 
-    if (archive_entry_size(entry) > 0) {
-      r = copy_data(a.get(), ext.get());
-      if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
-        strncpy(err, archive_error_string(ext.get()), errsize);
-        break;
-      }
+  auto a = new_reader();
+  r = open_reader(a.get(), filepath);
+  if (r != ARCHIVE_OK) {
+    set_err(err, errsize, archive_error_string(a.get()));
+    return r;
+  }
+
+  while (true) {
+    r = archive_read_next_header(a.get(), &entry);
+    if (r == ARCHIVE_EOF) {
+      r = ARCHIVE_OK;
+      break;
+    }
+    if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+      set_err(err, errsize, archive_error_string(a.get()));
+      break;
+    }
+    if (zip_only && (archive_format(a.get()) & ARCHIVE_FORMAT_BASE_MASK) !=
+                        ARCHIVE_FORMAT_ZIP) {
+      r = SCAN_NOT_ZIP;
+      set_err(err, errsize, "not a zip archive");
+      break;
+    }
+
+    const auto *original_path = entry_pathname(entry);
+    if (!original_path) {
+      r = ARCHIVE_FATAL;
+      set_err(err, errsize, archive_error_string(a.get()));
+      break;
     }
+    entries.push_back({.rel = entry_rel_path(original_path),
+                       .size = archive_entry_size(entry),
+                       .is_dir = archive_entry_filetype(entry) == AE_IFDIR});
 
-    r = archive_write_finish_entry(ext.get());
+    r = archive_read_data_skip(a.get());
     if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
-      strncpy(err, archive_error_string(ext.get()), errsize);
+      set_err(err, errsize, archive_error_string(a.get()));
       break;
     }
   }
   return r;
 }
 
+static unsigned count_workers(const std::vector<archive_file> &entries) {
+  size_t files = 0;
+  la_int64_t bytes = 0;
+  for (const auto &entry : entries) {
+    if (!entry.is_dir) {
+      ++files;
+      bytes += entry.size;
+    }
+  }
+
+  // at least 2 workers so that I/O overlaps decompression even on one core
+  unsigned hw = std::max(2U, std::thread::hardware_concurrency());
+  auto by_work = std::max(files / MIN_FILES_PER_WORKER,
+                          static_cast<size_t>(bytes / MIN_BYTES_PER_WORKER));
+  return static_cast<unsigned>(std::min(
+      {static_cast<size_t>(hw), static_cast<size_t>(MAX_EXTRACT_WORKERS),
+       by_work, files}));
+}
+
+// Assign regular files to `nworkers` by largest uncompressed size first.
+// Returns owner worker of each entry, or `nworkers` for directories.
+static std::vector<unsigned> assign_workers(
+    const std::vector<archive_file> &entries, unsigned nworkers) {
+  std::vector<unsigned> owners(entries.size(), nworkers);
+  std::vector<size_t> order(entries.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](size_t lhs, size_t rhs) {
+    return entries[lhs].size > entries[rhs].size;
+  });
+
+  std::vector<la_int64_t> loads(nworkers, 0);
+  for (auto index : order) {
+    if (entries[index].is_dir) {
+      continue;
+    }
+    auto least = static_cast<unsigned>(
+        std::min_element(loads.begin(), loads.end()) - loads.begin());
+    owners[index] = least;
+    // per file overhead of creating it on disk
+    loads[least] += entries[index].size + 64 * 1024;
+  }
+  return owners;
+}
+
+struct extract_job {
+  unsigned worker;
+  filemod::task *task = nullptr;
+  int r = ARCHIVE_OK;
+  char err[ERR_SIZE]{};
+  std::vector<std::filesystem::path> outrels{};
+};
+
+// Extract the entries owned by `job.worker` with a private read handle,
+// writing through `ext`. Entries of other workers are skipped through the
+// central directory.
+static void extract_owned(const std::filesystem::path &filepath,
+                          const std::filesystem::path &destdir,
+                          const std::vector<archive_file> &entries,
+                          const std::vector<unsigned> &owners, archive *ext,
+                          extract_job &job) {
+  struct archive_entry *entry;
+  auto a = new_reader();
+
+  job.r = open_reader(a.get(), filepath);
+  if (job.r != ARCHIVE_OK) {
+    set_err(job.err, sizeof(job.err), archive_error_string(a.get()));
+    return;
+  }
+
+  for (size_t index = 0;; ++index) {
+    job.r = archive_read_next_header(a.get(), &entry);
+    if (job.r == ARCHIVE_EOF) {
+      job.r = ARCHIVE_OK;
+      break;
+    }
+    if (job.r < ARCHIVE_OK && job.r != ARCHIVE_WARN) {
+      set_err(job.err, sizeof(job.err), archive_error_string(a.get()));
+      break;
+    }
+    if (index >= entries.size()) {
+      job.r = ARCHIVE_FATAL;
+      set_err(job.err, sizeof(job.err), "archive changed during extraction");
+      break;
+    }
+    if (owners[index] != job.worker) {
+      continue;  // next header skips the data
+    }
+    if (job.task && job.task->stop_requested()) {
+      job.r = ARCHIVE_FATAL;
+      set_err(job.err, sizeof(job.err), ERR_CANCELLED);
+      break;
+    }
+
+    // maybe half write, so log regular file no matter what
+    job.outrels.push_back(entries[index].rel);
+
+    job.r = write_entry(a.get(), ext, entry, destdir / entries[index].rel,
+                        job.task, job.err, sizeof(job.err));
+    if (job.r < ARCHIVE_OK && job.r != ARCHIVE_WARN) {
+      break;
+    }
+  }
+}
+
+// Create directories first, then extract regular files on `nworkers` threads,
+// each writing a disjoint set of files.
+static int extract_parallel(const std::filesystem::path &filepath,
+                            const std::filesystem::path &destdir,
+                            const std::vector<archive_file> &entries,
+                            unsigned nworkers, task *task, char *err,
+                            size_t errsize,
+                            std::vector<std::filesystem::path> &outrels) {
+  auto owners = assign_workers(entries, nworkers);
+
+  // directories, the writer is kept open until all files are written, so
+  // their permissions and times are fixed up last
+  auto dir_ext = new_disk_writer();
+  extract_job dir_job{.worker = nworkers, .task = task};
+  extract_owned(filepath, destdir, entries, owners, dir_ext.get(), dir_job);
+
+  std::vector<extract_job> jobs(nworkers);
+  if (dir_job.r == ARCHIVE_OK || dir_job.r == ARCHIVE_WARN) {
+    std::vector<std::thread> threads;
+    threads.reserve(nworkers);
+    for (unsigned i = 0; i < nworkers; ++i) {
+      jobs[i].worker = i;
+      jobs[i].task = task;
+      threads.emplace_back([&, i]() {
+        try {
+          auto ext = new_disk_writer();
+          extract_owned(filepath, destdir, entries, owners, ext.get(),
+                        jobs[i]);
+        } catch (const std::exception &ex) {
+          jobs[i].r = ARCHIVE_FATAL;
+          set_err(jobs[i].err, sizeof(jobs[i].err), ex.what());
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+
+  // merge created files and report the first error
+  int r = ARCHIVE_OK;
+  jobs.push_back(std::move(dir_job));
+  for (auto &job : jobs) {
+    outrels.insert(outrels.end(), std::make_move_iterator(job.outrels.begin()),
+                   std::make_move_iterator(job.outrels.end()));
+    if (job.r < ARCHIVE_OK && job.r != ARCHIVE_WARN &&
+        (r == ARCHIVE_OK || r == ARCHIVE_WARN)) {
+      r = job.r;
+      set_err(err, errsize, job.err);
+    }
+  }
+  return r;
+}
+
+// Add parents of `rels` not in it, and sort it, parents before children.
+static void add_parents(std::vector<std::filesystem::path> &rels) {
+  for (size_t i = 0, n = rels.size(); i < n; ++i) {
+    for (auto parent = rels[i].parent_path(); !parent.empty();
+         parent = parent.parent_path()) {
+      rels.push_back(parent);
+    }
+  }
+  std::sort(rels.begin(), rels.end());
+  rels.erase(std::unique(rels.begin(), rels.end()), rels.end());
+}
+
+// Log `mod_file_rels` created below `destdir` on success or not, and throw
+// the error `err` if `r` failed.
+static void finish_extract(const std::filesystem::path &destdir, fsman &fsman,
+                           std::vector<std::filesystem::path> &mod_file_rels,
+                           int r, const char *err) {
+  // parents created for entries of archives w/o directory entries, and
+  // parents sort before children, so rollback removes children first
+  add_parents(mod_file_rels);
+  for (const auto &mod_file_rel : mod_file_rels) {
+    fsman.log_create(destdir / mod_file_rel);
+  }
+
+  if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+    if (auto *task = fsman.get_task()) {
+      task->check_stop();
+    }
+    throw std::runtime_error{err};
+  }
+}
+
 std::vector<std::filesystem::path> copy_mod_a(
     const std::filesystem::path &filepath, const std::filesystem::path &destdir,
     fsman &fsman) {
-  std::vector<std::filesystem::path> outpaths;
-  char err[512];
+  std::vector<std::filesystem::path> mod_file_rels;
+  char err[ERR_SIZE];
+  int r;
 
-  int r = extract(filepath, destdir, err, sizeof(err), outpaths);
+  std::vector<archive_file> entries;
+  unsigned nworkers = 0;
+  if (r = scan_entries(filepath, entries, true, err, sizeof(err));
+      r == ARCHIVE_OK || r == ARCHIVE_WARN) {
+    nworkers = count_workers(entries);
+  }
 
-  std::sort(outpaths.begin(), outpaths.end());
-  for (const auto &outpath : outpaths) {
-    fsman.log_create(outpath);
+  auto *task = fsman.get_task();
+  if (nworkers > 1) {
+    if (task) {
+      uint64_t files = 0;
+      uint64_t bytes = 0;
+      for (const auto &entry : entries) {
+        if (!entry.is_dir) {
+          ++files;
+          bytes += std::max<la_int64_t>(entry.size, 0);
+        }
+      }
+      task->add_total(files, bytes);
+    }
+    r = extract_parallel(filepath, destdir, entries, nworkers, task, err,
+                         sizeof(err), mod_file_rels);
+  } else {
+    r = extract(filepath, destdir, task, err, sizeof(err), mod_file_rels, {});
   }
 
+  finish_extract(destdir, fsman, mod_file_rels, r, err);
+  return mod_file_rels;
+}
+
+std::vector<std::filesystem::path> copy_mod_a(
+    const std::filesystem::path &filepath, const std::filesystem::path &destdir,
+    fsman &fsman,
+    const std::function<bool(const std::filesystem::path &)> &filter) {
+  std::vector<std::filesystem::path> mod_file_rels;
+  char err[ERR_SIZE];
+  int r = extract(filepath, destdir, fsman.get_task(), err, sizeof(err),
+                  mod_file_rels, filter);
+  finish_extract(destdir, fsman, mod_file_rels, r, err);
+  return mod_file_rels;
+}
+
+// Append parents of `entries` not in it as directories, which extraction
+// creates for entries of archives w/o directory entries.
+static void add_parent_entries(std::vector<archive_file> &entries) {
+  std::set<std::filesystem::path> listed;
+  for (const auto &entry : entries) {
+    listed.insert(entry.rel);
+  }
+  for (size_t i = 0, n = entries.size(); i < n; ++i) {
+    for (auto parent = entries[i].rel.parent_path(); !parent.empty();
+         parent = parent.parent_path()) {
+      if (listed.insert(parent).second) {
+        entries.push_back({.rel = parent, .size = 0, .is_dir = true});
+      }
+    }
+  }
+}
+
+std::vector<archive_file> scan_archive(const std::filesystem::path &filepath) {
+  std::vector<archive_file> entries;
+  char err[ERR_SIZE];
+
+  int r = scan_entries(filepath, entries, false, err, sizeof(err));
   if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
     throw std::runtime_error{err};
   }
+  add_parent_entries(entries);
+  return entries;
+}
+
+std::optional<std::vector<archive_file>> scan_zip(
+    const std::filesystem::path &filepath) {
+  std::vector<archive_file> entries;
+  char err[ERR_SIZE];
 
-  std::vector<std::filesystem::path> mod_file_rels{};
-  mod_file_rels.reserve(outpaths.size());
-  for (auto &outpath : outpaths) {
-    mod_file_rels.push_back(std::filesystem::relative(outpath, destdir));
+  int r = scan_entries(filepath, entries, true, err, sizeof(err));
+  if (r == SCAN_NOT_ZIP) {
+    return std::nullopt;
+  }
+  if (r < ARCHIVE_OK && r != ARCHIVE_WARN) {
+    throw std::runtime_error{err};
   }
+  add_parent_entries(entries);
+  return entries;
+}
 
-  return mod_file_rels;
+static uint16_t le16(const unsigned char *p) {
+  return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const unsigned char *p) {
+  return le16(p) | static_cast<uint32_t>(le16(p + 2)) << 16;
+}
+
+// Whether extra fields `extra` of a zip entry hold a Unicode path, which
+// libarchive takes as the name instead.
+static bool has_unicode_path(const unsigned char *extra, size_t size) {
+  for (size_t pos = 0; pos + 4 <= size; pos += 4 + le16(extra + pos + 2)) {
+    if (le16(extra + pos) == ZIP_EXTRA_UNICODE_PATH) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::unordered_map<std::string, zip_crc> read_zip_crcs(
+    const std::filesystem::path &filepath) {
+  std::unordered_map<std::string, zip_crc> crcs;
+  std::error_code ec;
+  auto file_size = std::filesystem::file_size(filepath, ec);
+  std::ifstream in{filepath, std::ios::binary};
+  if (ec || !in || file_size < ZIP_EOCD_SIZE) {
+    return crcs;
+  }
+
+  // the end of central directory record, followed by a comment
+  auto tail_size =
+      std::min<uint64_t>(file_size, ZIP_EOCD_SIZE + ZIP_MAX_COMMENT);
+  std::vector<unsigned char> tail(tail_size);
+  in.seekg(static_cast<std::streamoff>(file_size - tail_size));
+  if (!in.read(reinterpret_cast<char *>(tail.data()),
+               static_cast<std::streamsize>(tail_size))) {
+    return crcs;
+  }
+  const unsigned char *eocd = nullptr;
+  for (size_t i = tail_size - ZIP_EOCD_SIZE + 1; i-- > 0;) {
+    if (le32(&tail[i]) == ZIP_EOCD_SIG) {
+      eocd = &tail[i];
+      break;
+    }
+  }
+  if (!eocd) {
+    return crcs;
+  }
+  uint32_t cd_size = le32(eocd + 12);
+  uint32_t cd_offset = le32(eocd + 16);
+  if (cd_offset == ZIP64_MARK ||
+      static_cast<uint64_t>(cd_offset) + cd_size > file_size) {
+    return crcs;
+  }
+
+  std::vector<unsigned char> cd(cd_size);
+  in.seekg(cd_offset);
+  if (!in.read(reinterpret_cast<char *>(cd.data()), cd_size)) {
+    return crcs;
+  }
+  for (size_t pos = 0; pos + ZIP_CDH_SIZE <= cd.size();) {
+    const auto *hdr = &cd[pos];
+    if (le32(hdr) != ZIP_CDH_SIG) {
+      break;
+    }
+    size_t name_size = le16(hdr + 28);
+    size_t extra_size = le16(hdr + 30);
+    size_t next = pos + ZIP_CDH_SIZE + name_size + extra_size + le16(hdr + 32);
+    if (next > cd.size()) {
+      break;
+    }
+    pos = next;
+
+    std::string name{reinterpret_cast<const char *>(hdr + ZIP_CDH_SIZE),
+                     name_size};
+    bool legacy_name = !(le16(hdr + 8) & ZIP_FLAG_UTF8) &&
+                       std::any_of(name.begin(), name.end(), [](char c) {
+                         return static_cast<unsigned char>(c) >= 0x80;
+                       });
+    // file type bits of unix hosts, 0 of others
+    auto type = hdr[5] == ZIP_HOST_UNIX ? (le32(hdr + 38) >> 16) & 0170000 : 0;
+    uint32_t size = le32(hdr + 24);
+    if (legacy_name || name.empty() || name.back() == '/' ||
+        (type != 0 && type != 0100000) || size == ZIP64_MARK ||
+        has_unicode_path(hdr + ZIP_CDH_SIZE + name_size, extra_size)) {
+      continue;
+    }
+    crcs.insert_or_assign(
+        path_to_utf8str(entry_rel_path(utf8str_to_path(std::move(name)))),
+        zip_crc{.crc = le32(hdr + 16), .size = size});
+  }
+  return crcs;
 }
 
-}  // namespace filemod
\ No newline at end of file
+}  // namespace filemod
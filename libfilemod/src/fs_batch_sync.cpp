@@ -0,0 +1,29 @@
+#include "filemod/private/fs_batch.hpp"
+
+namespace filemod {
+
+// no batches, changes are made one by one, on Windows and on Linux w/o
+// io_uring
+struct fs_batch::impl {};
+
+fs_batch::fs_batch(fsman &fsman) : m_fsman{fsman} {}
+
+fs_batch::~fs_batch() = default;
+
+void fs_batch::create_d(path_ref dest) {
+  if (!made_dir_(dest.view())) {
+    m_fsman.create_d(dest);
+    m_last_dir = dest.view();
+  }
+}
+
+void fs_batch::create_s(path_ref src, path_ref dest) {
+  m_fsman.create_s(src, dest);
+  m_fsman.report(1, 0);
+}
+
+void fs_batch::mv_f(path_ref src, path_ref dest) { m_fsman.mv_f(src, dest); }
+
+void fs_batch::flush() {}
+
+}  // namespace filemod
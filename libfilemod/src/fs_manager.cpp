@@ -4,24 +4,87 @@
 #include <filesystem>
 
 #include "filemod/fs_utils.hpp"
-#include "ranges"
+#include "filemod/private/utils.hpp"
 
 namespace filemod {
 
-// fs_rec_xx
+void fsman::create_d(path_ref dest) {
+  if (make_dir(dest)) {
+    log_create(dest);
+  }
+}
+
+void fsman::create_s(path_ref src, path_ref dest) {
+  make_symlink(src, dest);
+  log_create(dest);
+}
+
+void fsman::create_h(path_ref src, path_ref dest) {
+  std::filesystem::create_hard_link(src.path(), dest.path());
+  log_create(dest);
+}
+
+void fsman::mv_f(path_ref src, path_ref dest) {
+  cross_filesystem_mv(src, dest);
+  log_mv_f(src, dest);
+}
+
+void fsman::cp_f(path_ref src, path_ref dest) {
+  copy_file_cow(src, dest);
+  log_cp_f(dest);
+}
 
-void fs_rec_mv_f::revert() {
-  std::filesystem::create_directories(m_src.parent_path());
-  cross_filesystem_mv(m_dest, m_src);
+void fsman::rm_d(path_ref dest) {
+  if (remove_dir(dest)) {
+    log_rm_d(dest);
+  }
 }
 
-// fsman
+void fsman::exchange_d(path_ref src, path_ref dest) {
+  exchange_dirs(src.path(), dest.path());
+  log_(fs_rec_kind::exchange_d, src, dest);
+}
+
+void fsman::rename_d(path_ref src, path_ref dest) {
+  std::filesystem::rename(src.path(), dest.path());
+  log_rename_d(src, dest);
+}
+
+void fsman::revert_(const record &rec, size_t begin) {
+  std::filesystem::path src{native_view{m_paths}.substr(
+      begin, rec.src_end - begin)};
+  std::filesystem::path dest{native_view{m_paths}.substr(
+      rec.src_end, rec.dest_end - rec.src_end)};
+
+  switch (rec.kind) {
+    case fs_rec_kind::create:
+    case fs_rec_kind::cp_f:
+      std::filesystem::remove(dest);
+      break;
+    case fs_rec_kind::mv_f:
+      std::filesystem::create_directories(src.parent_path());
+      cross_filesystem_mv(dest, src);
+      break;
+    case fs_rec_kind::rm_d:
+      std::filesystem::create_directories(dest);
+      break;
+    case fs_rec_kind::rename_d:
+      std::filesystem::rename(dest, src);
+      break;
+    case fs_rec_kind::create_tree:
+      std::filesystem::remove_all(dest);
+      break;
+    case fs_rec_kind::exchange_d:
+      exchange_dirs(dest, src);
+      break;
+  }
+}
 
-void fsman::revert() {
-  for (const auto &recptr : std::ranges::reverse_view(m_recs)) {
+void fsman::revert(size_t first, size_t last) {
+  for (size_t i = last; i-- > first;) {
     // try our best to revert
     try {
-      recptr->revert();
+      revert_(m_recs[i], i ? m_recs[i - 1].dest_end : 0);
     } catch (std::filesystem::filesystem_error &ex) {
       std::fprintf(stderr, "revert error: %s\n", ex.what());
     } catch (std::exception &ex) {
@@ -30,4 +93,4 @@ void fsman::revert() {
   }
 }
 
-}  // namespace filemod
\ No newline at end of file
+}  // namespace filemod
@@ -6,16 +6,16 @@ namespace filemod {
 
 fs_tx::fs_tx(FS &fs) : m_fs{fs} { m_fs.begin_tx_(); }
 
-void fs_tx::rollback() { m_fs.m_curr_scope->rollback(); }
+void fs_tx::rollback() { m_fs.curr_scope_()->rollback(); }
 
 fs_tx::~fs_tx() {
   if (!m_committed) {
     try {
-      m_fs.m_curr_scope->rollback();
+      m_fs.curr_scope_()->rollback();
     } catch (...) {
     }
   }
-  m_fs.end_tx_();
+  m_fs.end_tx_(m_committed);
 }
 
 }  // namespace filemod
\ No newline at end of file
@@ -1,27 +1,66 @@
 #include "filemod/fs_utils.hpp"
 
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "filemod/private/utils.hpp"
 
 namespace filemod {
 
-void cross_filesystem_mv(const std::filesystem::path &src,
-                         const std::filesystem::path &dest) {
-  std::error_code ec;
-  std::filesystem::rename(src, dest, ec);
+void cross_filesystem_mv(path_ref src, path_ref dest) {
+  if (!rename_path(src, dest)) {
+    // cannot rename cross device, do copy and remove instead
+    std::filesystem::copy(src.path(), dest.path());
+    std::filesystem::remove(src.path());
+  }
+}
+
+void copy_file_cow(path_ref src, path_ref dest) {
+  if (!clone_file(src, dest)) {
+    std::filesystem::copy_file(src.path(), dest.path());
+  }
+}
 
-  if (!ec) {
+void exchange_dirs(const std::filesystem::path &a,
+                   const std::filesystem::path &b) {
+  if (exchange_paths(a, b)) {
     return;
   }
 
-  if (ec.value() == static_cast<int>(std::errc::cross_device_link)) {
-    // cannot rename cross device, do copy and remove instead
-    std::filesystem::copy(src, dest);
-    std::filesystem::remove(src);
-  } else {
-    // doesn't handle other errors
-    throw std::filesystem::filesystem_error("error mv from src to dest", src,
-                                            dest, ec);
+  auto tmp = a;
+  tmp += ".filemod_swap";
+  std::filesystem::rename(a, tmp);
+  std::filesystem::rename(b, a);
+  std::filesystem::rename(tmp, b);
+}
+
+bool same_content(const std::filesystem::path &a,
+                  const std::filesystem::path &b) {
+  if (std::filesystem::file_size(a) != std::filesystem::file_size(b)) {
+    return false;
+  }
+
+  constexpr std::streamsize BUF_SIZE = 64 * 1024;
+  std::vector<char> buf_a(BUF_SIZE);
+  std::vector<char> buf_b(BUF_SIZE);
+  std::ifstream ifs_a{a, std::ios::binary};
+  std::ifstream ifs_b{b, std::ios::binary};
+  if (!ifs_a || !ifs_b) {
+    return false;
+  }
+
+  while (ifs_a && ifs_b) {
+    ifs_a.read(buf_a.data(), BUF_SIZE);
+    ifs_b.read(buf_b.data(), BUF_SIZE);
+    if (ifs_a.gcount() != ifs_b.gcount() ||
+        !std::equal(buf_a.begin(), buf_a.begin() + ifs_a.gcount(),
+                    buf_b.begin())) {
+      return false;
+    }
   }
+  return true;
 }
 
 }  // namespace filemod
\ No newline at end of file
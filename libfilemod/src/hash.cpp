@@ -0,0 +1,157 @@
+#include "filemod/hash.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace filemod {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+constexpr size_t FILE_BUF_SIZE = 1024 * 1024;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+// little-endian reads, as on all supported platforms
+static inline uint64_t read64(const unsigned char *p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+  acc += input * PRIME2;
+  acc = rotl(acc, 31);
+  return acc * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+  acc ^= xxh_round(0, val);
+  return acc * PRIME1 + PRIME4;
+}
+
+// Consume 32-byte stripes of `p`, returns bytes consumed.
+static inline size_t consume_stripes(uint64_t (&acc)[4],
+                                     const unsigned char *p, size_t len) {
+  const unsigned char *begin = p;
+  const unsigned char *limit = p + len - 32;
+  // four independent lanes, keeps the multipliers busy
+  uint64_t v1 = acc[0], v2 = acc[1], v3 = acc[2], v4 = acc[3];
+  for (; p <= limit; p += 32) {
+    v1 = xxh_round(v1, read64(p));
+    v2 = xxh_round(v2, read64(p + 8));
+    v3 = xxh_round(v3, read64(p + 16));
+    v4 = xxh_round(v4, read64(p + 24));
+  }
+  acc[0] = v1, acc[1] = v2, acc[2] = v3, acc[3] = v4;
+  return p - begin;
+}
+
+xxh64::xxh64(uint64_t seed)
+    : m_acc{seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1},
+      m_seed{seed} {}
+
+void xxh64::update(const void *data, size_t len) {
+  const auto *p = static_cast<const unsigned char *>(data);
+  m_total_len += len;
+
+  if (m_buf_len + len < sizeof(m_buf)) {
+    std::memcpy(m_buf + m_buf_len, p, len);
+    m_buf_len += len;
+    return;
+  }
+
+  if (m_buf_len) {
+    size_t fill = sizeof(m_buf) - m_buf_len;
+    std::memcpy(m_buf + m_buf_len, p, fill);
+    consume_stripes(m_acc, m_buf, sizeof(m_buf));
+    p += fill;
+    len -= fill;
+    m_buf_len = 0;
+  }
+
+  if (len >= 32) {
+    size_t consumed = consume_stripes(m_acc, p, len);
+    p += consumed;
+    len -= consumed;
+  }
+
+  std::memcpy(m_buf, p, len);
+  m_buf_len = len;
+}
+
+uint64_t xxh64::digest() const {
+  uint64_t h;
+  if (m_total_len >= 32) {
+    h = rotl(m_acc[0], 1) + rotl(m_acc[1], 7) + rotl(m_acc[2], 12) +
+        rotl(m_acc[3], 18);
+    for (auto acc : m_acc) {
+      h = merge_round(h, acc);
+    }
+  } else {
+    h = m_seed + PRIME5;
+  }
+  h += m_total_len;
+
+  const unsigned char *p = m_buf;
+  const unsigned char *end = m_buf + m_buf_len;
+  for (; p + 8 <= end; p += 8) {
+    h ^= xxh_round(0, read64(p));
+    h = rotl(h, 27) * PRIME1 + PRIME4;
+  }
+  if (p + 4 <= end) {
+    h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+    h = rotl(h, 23) * PRIME2 + PRIME3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= (*p) * PRIME5;
+    h = rotl(h, 11) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+  return h;
+}
+
+std::string hash_to_str(uint64_t hash) {
+  char str[17];
+  std::snprintf(str, sizeof(str), "%016llx",
+                static_cast<unsigned long long>(hash));
+  return str;
+}
+
+std::string hash_file(const std::filesystem::path &path) {
+  std::ifstream file{path, std::ios_base::binary};
+  if (!file) {
+    throw std::runtime_error{"cannot open file for hashing: " +
+                             path.string()};
+  }
+
+  std::vector<char> buf(FILE_BUF_SIZE);
+  xxh64 hasher;
+  while (auto n = file.rdbuf()->sgetn(buf.data(),
+                                      static_cast<std::streamsize>(buf.size()))) {
+    hasher.update(buf.data(), static_cast<size_t>(n));
+  }
+  return hash_to_str(hasher.digest());
+}
+
+}  // namespace filemod
@@ -0,0 +1,451 @@
+#include "filemod/private/fs_batch.hpp"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <system_error>
+#include <vector>
+
+#include "filemod/private/utils.hpp"
+
+namespace filemod {
+
+// Queued changes are submitted once this many are, or on flush.
+constexpr unsigned RING_ENTRIES = 256;
+// Fewer changes are made one by one, not worth setting up a ring.
+constexpr size_t MIN_BATCH = 8;
+// result of an op whose completion was not seen, ops return 0 or -errno
+constexpr int NOT_DONE = 1;
+
+// Cleared once the kernel is found not to support the ring or its ops.
+static std::atomic<bool> s_ring_supported{true};
+
+// io_uring w/o liburing, submitting at most RING_ENTRIES ops and waiting for
+// all of them at once.
+class uring {
+ public:
+  // Returns null if cannot set up the ring, w/ `supported` cleared if the
+  // kernel does not support io_uring or the ops, not just lacks resources for
+  // now, e.g. file descriptors or memory.
+  static std::unique_ptr<uring> open(bool &supported) {
+    supported = true;
+    io_uring_params params{};
+    int fd = static_cast<int>(
+        syscall(__NR_io_uring_setup, RING_ENTRIES, &params));
+    if (fd < 0) {
+      // not built in, or disabled by sysctl or seccomp
+      supported = errno != ENOSYS && errno != EPERM;
+      return nullptr;
+    }
+    std::unique_ptr<uring> ret{new uring{fd}};
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !ret->probe_()) {
+      supported = false;
+      return nullptr;
+    }
+    if (!ret->map_(params)) {
+      return nullptr;
+    }
+    return ret;
+  }
+
+  uring(const uring &) = delete;
+  uring &operator=(const uring &) = delete;
+
+  ~uring() {
+    if (m_sqes != MAP_FAILED) {
+      munmap(m_sqes, m_sqes_size);
+    }
+    if (m_rings != MAP_FAILED) {
+      munmap(m_rings, m_rings_size);
+    }
+    close(m_fd);
+  }
+
+  // Next SQE to fill, zeroed, w/ `data` to tell its CQE.
+  io_uring_sqe &next(uint64_t data) {
+    unsigned idx = (*m_sq_tail + m_queued++) & *m_sq_mask;
+    auto &sqe = m_sqes[idx];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.user_data = data;
+    m_sq_array[idx] = idx;
+    return sqe;
+  }
+
+  // Submit SQEs filled and wait for their completion, calling
+  // `func(data, res)` for each. If submitting fails, still waits for those
+  // the kernel took and calls `func` for them before throwing; the ring
+  // cannot be used after.
+  template <typename Func>
+  void submit_wait(Func func) {
+    unsigned sq_end = *m_sq_tail + m_queued;
+    unsigned pending = m_queued;
+    __atomic_store_n(m_sq_tail, sq_end, __ATOMIC_RELEASE);
+    unsigned to_submit = m_queued;
+    m_queued = 0;
+    int error = 0;
+
+    while (pending > 0) {
+      int ret = static_cast<int>(syscall(__NR_io_uring_enter, m_fd, to_submit,
+                                         pending, IORING_ENTER_GETEVENTS,
+                                         nullptr, 0));
+      if (ret < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        if (error != 0) {
+          // cannot wait either, completions left are lost
+          break;
+        }
+        error = errno;
+        // those not taken never complete
+        pending -= sq_end - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+        to_submit = 0;
+        continue;
+      }
+      to_submit -= std::min(to_submit, static_cast<unsigned>(ret));
+
+      unsigned head = *m_cq_head;
+      unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+      for (; head != tail; ++head, --pending) {
+        const auto &cqe = m_cqes[head & *m_cq_mask];
+        func(cqe.user_data, cqe.res);
+      }
+      __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    if (error != 0) {
+      throw std::system_error{error, std::system_category(),
+                              "error io_uring_enter"};
+    }
+  }
+
+ private:
+  int m_fd;
+  void *m_rings = MAP_FAILED;
+  size_t m_rings_size = 0;
+  io_uring_sqe *m_sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+  size_t m_sqes_size = 0;
+  unsigned *m_sq_head = nullptr;
+  unsigned *m_sq_tail = nullptr;
+  unsigned *m_sq_mask = nullptr;
+  unsigned *m_sq_array = nullptr;
+  unsigned *m_cq_head = nullptr;
+  unsigned *m_cq_tail = nullptr;
+  unsigned *m_cq_mask = nullptr;
+  io_uring_cqe *m_cqes = nullptr;
+  // SQEs filled, not submitted yet
+  unsigned m_queued = 0;
+
+  explicit uring(int fd) : m_fd{fd} {}
+
+  bool probe_() {
+    constexpr unsigned OPS = 256;
+    std::vector<unsigned char> buf(sizeof(io_uring_probe) +
+                                   OPS * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(buf.data());
+    if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe,
+                OPS) < 0) {
+      return false;
+    }
+    for (auto op : {IORING_OP_MKDIRAT, IORING_OP_SYMLINKAT,
+                    IORING_OP_RENAMEAT}) {
+      if (op > probe->last_op ||
+          !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool map_(const io_uring_params &params) {
+    m_rings_size =
+        std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                 params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_rings = mmap(nullptr, m_rings_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (m_rings == MAP_FAILED) {
+      return false;
+    }
+    m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    m_sqes = static_cast<io_uring_sqe *>(
+        mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES));
+    if (m_sqes == MAP_FAILED) {
+      return false;
+    }
+
+    auto *base = static_cast<unsigned char *>(m_rings);
+    m_sq_head = reinterpret_cast<unsigned *>(base + params.sq_off.head);
+    m_sq_tail = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+    m_cq_head = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    return true;
+  }
+};
+
+// Directory fd `path.at_path()` is relative to.
+static int at_fd(path_ref path) {
+  return path.dir_fd() == NO_DIR_FD ? AT_FDCWD : path.dir_fd();
+}
+
+struct fs_batch::impl {
+  enum class op_kind : unsigned char { create_d, create_s, mv_f };
+
+  // Paths of an op are stored in `paths` as in `fsman`, NUL terminated.
+  struct op {
+    op_kind kind;
+    size_t src_end;
+    size_t dest_end;
+    int src_fd;
+    size_t src_at;
+    int dest_fd;
+    size_t dest_at;
+  };
+
+  std::vector<op> ops;
+  native_string paths;
+  std::unique_ptr<uring> ring;
+
+  void push(op_kind kind, path_ref src, path_ref dest) {
+    size_t src_begin = paths.size();
+    paths.append(src.view());
+    paths += native_char{};
+    size_t dest_begin = paths.size();
+    paths.append(dest.view());
+    paths += native_char{};
+    ops.push_back({.kind = kind,
+                   .src_end = dest_begin - 1,
+                   .dest_end = paths.size() - 1,
+                   .src_fd = src.dir_fd(),
+                   .src_at = src_begin + (src.at_path() - src.c_str()),
+                   .dest_fd = dest.dir_fd(),
+                   .dest_at = dest_begin + (dest.at_path() - dest.c_str())});
+  }
+
+  [[nodiscard]] path_ref src(size_t i) const {
+    size_t begin = i ? ops[i - 1].dest_end + 1 : 0;
+    const auto &op = ops[i];
+    return path_ref{native_view{paths}.substr(begin, op.src_end - begin),
+                    op.src_fd, op.src_at - begin};
+  }
+
+  [[nodiscard]] path_ref dest(size_t i) const {
+    size_t begin = ops[i].src_end + 1;
+    const auto &op = ops[i];
+    return path_ref{native_view{paths}.substr(begin, op.dest_end - begin),
+                    op.dest_fd, op.dest_at - begin};
+  }
+
+  void clear() {
+    ops.clear();
+    paths.clear();
+  }
+
+  // Whether an op whose completion was not seen is found made. Directories
+  // never are, one may have been there before.
+  static bool made_on_disk(op_kind kind, path_ref src, path_ref dest) {
+    struct stat st;
+    if (op_kind::create_d == kind ||
+        fstatat(at_fd(dest), dest.at_path(), &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      return false;
+    }
+    if (op_kind::create_s == kind) {
+      return S_ISLNK(st.st_mode);
+    }
+    return fstatat(at_fd(src), src.at_path(), &st, AT_SYMLINK_NOFOLLOW) != 0 &&
+           errno == ENOENT;
+  }
+};
+
+fs_batch::fs_batch(fsman &fsman) : m_fsman{fsman} {
+  if (s_ring_supported.load(std::memory_order_relaxed)) {
+    m_impl = std::make_unique<impl>();
+  }
+}
+
+fs_batch::~fs_batch() = default;
+
+void fs_batch::create_d(path_ref dest) {
+  if (made_dir_(dest.view())) {
+    return;
+  }
+  if (m_impl) {
+    m_impl->push(impl::op_kind::create_d, path_ref{native_view{}}, dest);
+    if (m_impl->ops.size() == RING_ENTRIES) {
+      flush();
+    }
+  } else {
+    m_fsman.create_d(dest);
+  }
+  m_last_dir = dest.view();
+}
+
+void fs_batch::create_s(path_ref src, path_ref dest) {
+  if (!m_impl) {
+    m_fsman.create_s(src, dest);
+    m_fsman.report(1, 0);
+    return;
+  }
+  m_impl->push(impl::op_kind::create_s, src, dest);
+  if (m_impl->ops.size() == RING_ENTRIES) {
+    flush();
+  }
+}
+
+void fs_batch::mv_f(path_ref src, path_ref dest) {
+  if (!m_impl) {
+    m_fsman.mv_f(src, dest);
+    return;
+  }
+  m_impl->push(impl::op_kind::mv_f, src, dest);
+  if (m_impl->ops.size() == RING_ENTRIES) {
+    flush();
+  }
+}
+
+void fs_batch::flush() {
+  if (!m_impl || m_impl->ops.empty()) {
+    return;
+  }
+  auto &ops = m_impl->ops;
+
+  if (!m_impl->ring && ops.size() >= MIN_BATCH &&
+      s_ring_supported.load(std::memory_order_relaxed)) {
+    bool supported;
+    m_impl->ring = uring::open(supported);
+    if (!supported) {
+      s_ring_supported.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  // one by one, as through fsman
+  if (!m_impl->ring) {
+    for (size_t i = 0; i < ops.size(); ++i) {
+      switch (ops[i].kind) {
+        case impl::op_kind::create_d:
+          m_fsman.create_d(m_impl->dest(i));
+          break;
+        case impl::op_kind::create_s:
+          m_fsman.create_s(m_impl->src(i), m_impl->dest(i));
+          m_fsman.report(1, 0);
+          break;
+        case impl::op_kind::mv_f:
+          m_fsman.mv_f(m_impl->src(i), m_impl->dest(i));
+          break;
+      }
+    }
+    m_impl->clear();
+    return;
+  }
+
+  auto &ring = *m_impl->ring;
+  for (size_t i = 0; i < ops.size(); ++i) {
+    auto src = m_impl->src(i);
+    auto dest = m_impl->dest(i);
+    auto &sqe = ring.next(i);
+    switch (ops[i].kind) {
+      case impl::op_kind::create_d:
+        // later ops may be in it, wait for all before and make them wait
+        sqe.opcode = IORING_OP_MKDIRAT;
+        sqe.flags = IOSQE_IO_DRAIN;
+        sqe.fd = at_fd(dest);
+        sqe.addr = reinterpret_cast<uint64_t>(dest.at_path());
+        sqe.len = 0777;
+        break;
+      case impl::op_kind::create_s:
+        sqe.opcode = IORING_OP_SYMLINKAT;
+        sqe.fd = at_fd(dest);
+        sqe.addr = reinterpret_cast<uint64_t>(src.c_str());
+        sqe.addr2 = reinterpret_cast<uint64_t>(dest.at_path());
+        break;
+      case impl::op_kind::mv_f:
+        sqe.opcode = IORING_OP_RENAMEAT;
+        sqe.fd = at_fd(src);
+        sqe.addr = reinterpret_cast<uint64_t>(src.at_path());
+        sqe.len = static_cast<uint32_t>(at_fd(dest));
+        sqe.addr2 = reinterpret_cast<uint64_t>(dest.at_path());
+        break;
+    }
+  }
+
+  std::vector<int> results(ops.size(), NOT_DONE);
+  std::exception_ptr error;
+  try {
+    ring.submit_wait([&](uint64_t i, int res) { results[i] = res; });
+  } catch (...) {
+    error = std::current_exception();
+    // SQEs not taken are left in it, set up anew on next flush
+    m_impl->ring.reset();
+  }
+
+  // log in queue order, so they are reverted in reverse, and throw the first
+  // error once all made are logged
+  for (size_t i = 0; i < ops.size(); ++i) {
+    auto src = m_impl->src(i);
+    auto dest = m_impl->dest(i);
+    int res = results[i];
+    if (res == NOT_DONE) {
+      // never submitted, or its completion lost when waiting failed
+      res = impl::made_on_disk(ops[i].kind, src, dest) ? 0 : -ECANCELED;
+    }
+    try {
+      switch (ops[i].kind) {
+        case impl::op_kind::create_d:
+          if (res == 0) {
+            m_fsman.log_create(dest);
+          } else if (res != -EEXIST ||
+                     stat_type(dest) != std::filesystem::file_type::directory) {
+            throw std::filesystem::filesystem_error(
+                "error create directory", dest.path(),
+                std::error_code{-res, std::system_category()});
+          }
+          break;
+        case impl::op_kind::create_s:
+          if (res != 0) {
+            throw std::filesystem::filesystem_error(
+                "error create symlink", dest.path(),
+                std::error_code{-res, std::system_category()});
+          }
+          m_fsman.log_create(dest);
+          m_fsman.report(1, 0);
+          break;
+        case impl::op_kind::mv_f:
+          if (res == -EXDEV) {
+            // copy and remove instead
+            m_fsman.mv_f(src, dest);
+          } else if (res != 0) {
+            throw std::filesystem::filesystem_error(
+                "error rename", src.path(), dest.path(),
+                std::error_code{-res, std::system_category()});
+          } else {
+            m_fsman.log_mv_f(src, dest);
+          }
+          break;
+      }
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  m_impl->clear();
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+}  // namespace filemod
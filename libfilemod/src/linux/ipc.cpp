@@ -0,0 +1,266 @@
+#include "filemod/ipc.hpp"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace filemod {
+
+// not to be killed by SIGPIPE when the peer goes away
+#ifdef MSG_NOSIGNAL
+constexpr int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+constexpr int SEND_FLAGS = 0;
+#endif
+
+// guards against garbage read as a length
+constexpr uint32_t MAX_STR_SIZE = 1 << 30;
+// a client stuck before sending its request does not block others for long
+constexpr time_t REQUEST_TIMEOUT_SECS = 5;
+
+class fd_guard {
+ public:
+  explicit fd_guard(int fd) noexcept : m_fd{fd} {}
+
+  fd_guard(const fd_guard &) = delete;
+
+  ~fd_guard() {
+    if (m_fd >= 0) {
+      close(m_fd);
+    }
+  }
+
+  [[nodiscard]] int get() const noexcept { return m_fd; }
+
+ private:
+  int m_fd;
+};
+
+static bool make_addr(const std::filesystem::path &socket_path,
+                      sockaddr_un &addr) {
+  const auto &native = socket_path.native();
+  if (native.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  std::memcpy(addr.sun_path, native.c_str(), native.size() + 1);
+  return true;
+}
+
+static bool connect_to(int fd, const sockaddr_un &addr) {
+  return connect(fd, reinterpret_cast<const sockaddr *>(&addr),
+                 sizeof(addr)) == 0;
+}
+
+static bool write_all(int fd, const std::string &data) {
+  const char *p = data.data();
+  size_t size = data.size();
+  while (size > 0) {
+    auto n = send(fd, p, size, SEND_FLAGS);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+static bool read_all(int fd, char *p, size_t size) {
+  while (size > 0) {
+    auto n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// Messages are lengths and strings in native byte order, both ends are on the
+// same machine.
+
+static void put_u32(std::string &buf, uint32_t value) {
+  buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+static void put_str(std::string &buf, const std::string &str) {
+  put_u32(buf, static_cast<uint32_t>(str.size()));
+  buf += str;
+}
+
+static bool read_u32(int fd, uint32_t &value) {
+  return read_all(fd, reinterpret_cast<char *>(&value), sizeof(value));
+}
+
+static bool read_str(int fd, std::string &str) {
+  uint32_t size;
+  if (!read_u32(fd, size) || size > MAX_STR_SIZE) {
+    return false;
+  }
+  str.resize(size);
+  return read_all(fd, str.data(), size);
+}
+
+static bool write_request(int fd, const ipc_request &request) {
+  std::string buf;
+  put_str(buf, request.cwd);
+  put_u32(buf, static_cast<uint32_t>(request.args.size()));
+  for (const auto &arg : request.args) {
+    put_str(buf, arg);
+  }
+  return write_all(fd, buf);
+}
+
+static bool read_request(int fd, ipc_request &request) {
+  uint32_t argc;
+  if (!read_str(fd, request.cwd) || !read_u32(fd, argc)) {
+    return false;
+  }
+  // grown as read, not trusting `argc`
+  for (uint32_t i = 0; i < argc; ++i) {
+    if (!read_str(fd, request.args.emplace_back())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool write_response(int fd, const ipc_response &response) {
+  std::string buf;
+  put_u32(buf, static_cast<uint32_t>(response.code));
+  put_str(buf, response.out);
+  put_str(buf, response.err);
+  return write_all(fd, buf);
+}
+
+static bool read_response(int fd, ipc_response &response) {
+  uint32_t code;
+  if (!read_u32(fd, code)) {
+    return false;
+  }
+  response.code = static_cast<int>(code);
+  return read_str(fd, response.out) && read_str(fd, response.err);
+}
+
+static void set_errno_fail(result_base &ret, const char *what,
+                           const std::filesystem::path &socket_path) {
+  ret.success = false;
+  ret.msg = "error: cannot ";
+  ret.msg += what;
+  ret.msg += " '";
+  ret.msg += socket_path.string();
+  ret.msg += "': ";
+  ret.msg += std::strerror(errno);
+}
+
+// Bind `fd` to `addr`, replacing a socket file nobody listens on.
+static bool bind_to(int fd, const sockaddr_un &addr) {
+  // only the current user may connect
+  auto mask = umask(077);
+  int rc = bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+  if (rc != 0 && errno == EADDRINUSE) {
+    fd_guard probe{socket(AF_UNIX, SOCK_STREAM, 0)};
+    if (probe.get() >= 0 && !connect_to(probe.get(), addr)) {
+      unlink(addr.sun_path);
+      rc = bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr));
+    } else {
+      errno = EADDRINUSE;
+    }
+  }
+  umask(mask);
+  return rc == 0;
+}
+
+result_base ipc_serve(const std::filesystem::path &socket_path,
+                      const ipc_handler &handler) {
+  result_base ret{.success = false};
+  sockaddr_un addr;
+  if (!make_addr(socket_path, addr)) {
+    ret.msg = "error: socket path too long: '" + socket_path.string() + "'";
+    return ret;
+  }
+
+  fd_guard server{socket(AF_UNIX, SOCK_STREAM, 0)};
+  if (server.get() < 0) {
+    set_errno_fail(ret, "create socket", socket_path);
+    return ret;
+  }
+  if (!bind_to(server.get(), addr)) {
+    set_errno_fail(ret, "bind", socket_path);
+    return ret;
+  }
+  if (listen(server.get(), SOMAXCONN) != 0) {
+    set_errno_fail(ret, "listen on", socket_path);
+    unlink(addr.sun_path);
+    return ret;
+  }
+
+  bool serving = true;
+  while (serving) {
+    fd_guard conn{accept(server.get(), nullptr, nullptr)};
+    if (conn.get() < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      set_errno_fail(ret, "accept on", socket_path);
+      unlink(addr.sun_path);
+      return ret;
+    }
+
+    timeval timeout{.tv_sec = REQUEST_TIMEOUT_SECS, .tv_usec = 0};
+    setsockopt(conn.get(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    ipc_request request;
+    if (!read_request(conn.get(), request)) {
+      // the client went away
+      continue;
+    }
+    ipc_response response;
+    serving = handler(request, response);
+    write_response(conn.get(), response);
+  }
+
+  unlink(addr.sun_path);
+  ret.success = true;
+  return ret;
+}
+
+result<ipc_response> ipc_send(const std::filesystem::path &socket_path,
+                              const ipc_request &request) {
+  result<ipc_response> ret{{.success = false}};
+  sockaddr_un addr;
+  if (!make_addr(socket_path, addr)) {
+    return ret;
+  }
+
+  fd_guard client{socket(AF_UNIX, SOCK_STREAM, 0)};
+  if (client.get() < 0 || !connect_to(client.get(), addr)) {
+    return ret;
+  }
+  if (!write_request(client.get(), request) ||
+      !read_response(client.get(), ret.data)) {
+    ret.msg =
+        "error: lost connection to server '" + socket_path.string() + "'";
+    return ret;
+  }
+  ret.success = true;
+  return ret;
+}
+
+}  // namespace filemod
@@ -0,0 +1,70 @@
+#include "filemod/lock.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+
+namespace filemod {
+
+// polled at growing intervals up to this, flock() cannot time out
+constexpr std::chrono::milliseconds MAX_POLL_INTERVAL{100};
+
+file_lock::~file_lock() { unlock(); }
+
+result_base file_lock::lock(const std::filesystem::path &lock_path,
+                            std::chrono::milliseconds timeout) {
+  unlock();
+  result_base ret{.success = false};
+
+  std::error_code ec;
+  std::filesystem::create_directories(lock_path.parent_path(), ec);
+  int fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    ret.msg = "error: cannot open '" + lock_path.string() +
+              "': " + std::strerror(errno);
+    return ret;
+  }
+
+  int op = LOCK_EX | LOCK_NB;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::chrono::milliseconds interval{1};
+  while (flock(fd, op) != 0) {
+    if (errno == EINTR) {
+      continue;
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (errno != EWOULDBLOCK || now >= deadline) {
+      ret.msg = errno == EWOULDBLOCK
+                    ? "error: timed out waiting for another filemod process"
+                    : "error: cannot lock '" + lock_path.string() +
+                          "': " + std::strerror(errno);
+      close(fd);
+      return ret;
+    }
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+        interval, deadline - now));
+    interval = std::min(interval * 2, MAX_POLL_INTERVAL);
+  }
+
+  m_fd = fd;
+  ret.success = true;
+  return ret;
+}
+
+void file_lock::unlock() noexcept {
+  if (m_fd >= 0) {
+    // closing the only descriptor of the open file releases its lock
+    close(m_fd);
+    m_fd = -1;
+  }
+}
+
+bool file_lock::locked() const noexcept { return m_fd >= 0; }
+
+}  // namespace filemod
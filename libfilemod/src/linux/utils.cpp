@@ -1,7 +1,21 @@
 #include "filemod/utils.hpp"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <memory>
+#include <system_error>
 
 #include "filemod/private/utils.hpp"
 
@@ -13,4 +27,221 @@ std::filesystem::path getexepath() {
 
 std::filesystem::path get_home() { return std::getenv("HOME"); }
 
-}  // namespace filemod
\ No newline at end of file
+// Directory fd `path.at_path()` is relative to.
+static int at_fd(path_ref path) {
+  return path.dir_fd() == NO_DIR_FD ? AT_FDCWD : path.dir_fd();
+}
+
+dir_handle::dir_handle(const std::filesystem::path &dir)
+    : m_fd{open(dir.c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC)} {
+  if (m_fd < 0) {
+    m_fd = NO_DIR_FD;
+  }
+}
+
+dir_handle::~dir_handle() {
+  if (m_fd != NO_DIR_FD) {
+    close(m_fd);
+  }
+}
+
+bool clone_file(path_ref src, path_ref dest) {
+#ifdef FICLONE
+  int src_fd = openat(at_fd(src), src.at_path(), O_RDONLY | O_CLOEXEC);
+  if (src_fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(src_fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(src_fd);
+    return false;
+  }
+
+  int dest_fd = openat(at_fd(dest), dest.at_path(),
+                       O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC,
+                       st.st_mode & 07777);
+  if (dest_fd < 0) {
+    close(src_fd);
+    return false;
+  }
+
+  bool cloned = ioctl(dest_fd, FICLONE, src_fd) == 0;
+  close(dest_fd);
+  close(src_fd);
+  if (!cloned) {
+    unlinkat(at_fd(dest), dest.at_path(), 0);
+  }
+  return cloned;
+#else
+  return false;
+#endif
+}
+
+bool exchange_paths(const std::filesystem::path &a,
+                    const std::filesystem::path &b) {
+#ifdef RENAME_EXCHANGE
+  if (renameat2(AT_FDCWD, a.c_str(), AT_FDCWD, b.c_str(), RENAME_EXCHANGE) ==
+      0) {
+    return true;
+  }
+  if (errno == EINVAL || errno == ENOSYS) {
+    return false;
+  }
+  throw std::filesystem::filesystem_error(
+      "error exchange paths", a, b,
+      std::error_code{errno, std::system_category()});
+#else
+  return false;
+#endif
+}
+
+static std::filesystem::file_type mode_to_type(unsigned mode) {
+  switch (mode & S_IFMT) {
+    case S_IFREG:
+      return std::filesystem::file_type::regular;
+    case S_IFDIR:
+      return std::filesystem::file_type::directory;
+    case S_IFLNK:
+      return std::filesystem::file_type::symlink;
+    default:
+      return std::filesystem::file_type::unknown;
+  }
+}
+
+file_meta lstat_meta(const std::filesystem::path &path) {
+  file_meta meta;
+#ifdef STATX_INO
+  // only ask for what we compare, and never sync with a network server
+  struct statx stx;
+  if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+            STATX_TYPE | STATX_INO | STATX_MTIME, &stx) == 0) {
+    meta.type = mode_to_type(stx.stx_mode);
+    meta.ino = stx.stx_ino;
+    meta.mtime =
+        stx.stx_mtime.tv_sec * INT64_C(1000000000) + stx.stx_mtime.tv_nsec;
+  }
+#else
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0) {
+    meta.type = mode_to_type(st.st_mode);
+    meta.ino = st.st_ino;
+    meta.mtime = st.st_mtim.tv_sec * INT64_C(1000000000) + st.st_mtim.tv_nsec;
+  }
+#endif
+  return meta;
+}
+
+[[noreturn]] static void throw_errno(const char *what, path_ref path) {
+  throw std::filesystem::filesystem_error(
+      what, path.path(), std::error_code{errno, std::system_category()});
+}
+
+std::filesystem::file_type stat_type(path_ref path) {
+  struct stat st;
+  if (fstatat(at_fd(path), path.at_path(), &st, 0) == 0) {
+    return mode_to_type(st.st_mode);
+  }
+  if (errno == ENOENT || errno == ENOTDIR) {
+    return std::filesystem::file_type::not_found;
+  }
+  throw_errno("error stat", path);
+}
+
+bool make_dir(path_ref path) {
+  if (mkdirat(at_fd(path), path.at_path(), 0777) == 0) {
+    return true;
+  }
+  if (errno == EEXIST &&
+      stat_type(path) == std::filesystem::file_type::directory) {
+    return false;
+  }
+  throw_errno("error create directory", path);
+}
+
+void make_symlink(path_ref target, path_ref link) {
+  if (symlinkat(target.c_str(), at_fd(link), link.at_path()) != 0) {
+    throw_errno("error create symlink", link);
+  }
+}
+
+bool rename_path(path_ref src, path_ref dest) {
+  if (renameat(at_fd(src), src.at_path(), at_fd(dest), dest.at_path()) == 0) {
+    return true;
+  }
+  if (errno == EXDEV) {
+    return false;
+  }
+  throw std::filesystem::filesystem_error(
+      "error rename", src.path(), dest.path(),
+      std::error_code{errno, std::system_category()});
+}
+
+bool remove_dir(path_ref path) {
+  return unlinkat(at_fd(path), path.at_path(), AT_REMOVEDIR) == 0;
+}
+
+uint64_t regular_size(path_ref path) {
+  struct stat st;
+  if (fstatat(at_fd(path), path.at_path(), &st, 0) != 0) {
+    throw_errno("error stat", path);
+  }
+  return S_ISREG(st.st_mode) ? st.st_size : 0;
+}
+
+using dir_ptr = std::unique_ptr<DIR, int (*)(DIR *)>;
+
+// Walk directory `dir_fd` of `file`, which it takes ownership of.
+static void walk_dir(int dir_fd, path_buf &file,
+                     const std::function<void(const path_buf &, bool)> &func) {
+  dir_ptr dir{fdopendir(dir_fd), closedir};
+  if (!dir) {
+    close(dir_fd);
+    throw_errno("error open directory", file);
+  }
+
+  while (auto *entry = readdir(dir.get())) {
+    const char *name = entry->d_name;
+    if (std::strcmp(name, ".") == 0 || std::strcmp(name, "..") == 0) {
+      continue;
+    }
+
+    bool descend = DT_DIR == entry->d_type;
+    bool is_dir = descend;
+    struct stat st;
+    if (DT_UNKNOWN == entry->d_type &&
+        fstatat(dirfd(dir.get()), name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+      descend = is_dir = S_ISDIR(st.st_mode);
+    }
+    if (!descend && (DT_LNK == entry->d_type || DT_UNKNOWN == entry->d_type) &&
+        fstatat(dirfd(dir.get()), name, &st, 0) == 0) {
+      is_dir = S_ISDIR(st.st_mode);
+    }
+
+    auto size = file.push(name);
+    func(file, is_dir);
+    if (descend) {
+      int fd = openat(dirfd(dir.get()), name,
+                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+      if (fd < 0) {
+        throw_errno("error open directory", file);
+      }
+      walk_dir(fd, file, func);
+    }
+    file.cut(size);
+  }
+}
+
+void walk_tree(const std::filesystem::path &dir, int dir_fd,
+               const std::function<void(const path_buf &, bool)> &func) {
+  int fd = dir_fd == NO_DIR_FD
+               ? open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+               : openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    throw_errno("error open directory", dir);
+  }
+  path_buf file{dir, dir_fd};
+  walk_dir(fd, file, func);
+}
+
+}  // namespace filemod
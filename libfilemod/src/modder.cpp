@@ -7,10 +7,23 @@
 #include <algorithm>
 #include <filesystem>
 #include <functional>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
 
+#include "filemod/bloom.hpp"
 #include "filemod/fs.hpp"
+#include "filemod/fs_archive.hpp"
 #include "filemod/fs_tx.hpp"
+#include "filemod/fs_utils.hpp"
+#include "filemod/hash.hpp"
+#include "filemod/parallel.hpp"
+#include "filemod/private/utils.hpp"
 #include "filemod/sql.hpp"
 #include "filemod/utils.hpp"
 
@@ -20,6 +33,14 @@ constexpr char ERR_TAR_NOT_EXIST[] = "error: target not exists";
 constexpr char ERR_MOD_NOT_EXIST[] = "error: mod not exists";
 constexpr char ERR_NOT_DIR[] = "error: directory not exists";
 constexpr char ERR_NOT_EXISTS[] = "error: file not exists";
+constexpr char ERR_PROFILE_NOT_EXIST[] = "error: profile not exists";
+constexpr char ERR_NO_PREV_GEN[] = "error: no previous generation";
+
+// hidden profile of mods installed before the last activation of a target
+constexpr char PREV_PROFILE[] = ".filemod_prev";
+
+// bloom filters are rebuilt with room for as many files again
+constexpr size_t MIN_BLOOM_CAPACITY = 4096;
 
 static void set_succeed(result_base& ret) {
   ret.success = true;
@@ -53,6 +74,18 @@ static bool check_directory(result_base& ret,
   return true;
 }
 
+// Ids of installed mods of target `tar_id`, ascending.
+static std::vector<int64_t> installed_mod_ids(DB& db, int64_t tar_id) {
+  std::vector<int64_t> mod_ids;
+  for (const auto& mod : db.query_mods_by_target(tar_id)) {
+    if (mod.status == ModStatus::Installed) {
+      mod_ids.push_back(mod.id);
+    }
+  }
+  std::sort(mod_ids.begin(), mod_ids.end());
+  return mod_ids;
+}
+
 static bool check_exists(result_base& ret, const std::filesystem::path& path) {
   if (!std::filesystem::exists(path)) {
     set_fail(ret, {ERR_NOT_EXISTS, ": '", path_to_utf8str(path).c_str(), "'"});
@@ -61,50 +94,16 @@ static bool check_exists(result_base& ret, const std::filesystem::path& path) {
   return true;
 }
 
-static std::vector<ModDto> find_conflict_mods(
-    const std::filesystem::path& cfg_mod, const ModDto& mod, DB& db) {
-  // filter out dirs
-  std::vector<std::string> mod_files_str;
-  for (const auto& mod_file_str : mod.files) {
-    if (!std::filesystem::is_directory(cfg_mod /
-                                       utf8str_to_path(mod_file_str))) {
-      mod_files_str.push_back(mod_file_str);
-    }
-  }
-
-  std::vector<ModDto> conflict_mods;
-  // query mods contain these files
-  auto candidates = db.query_mods_contain_files(mod_files_str);
-  // filter only current tar_id and installed mods
-  for (auto& candidate : candidates) {
-    if (candidate.tar_id == mod.tar_id &&
-        candidate.status == ModStatus::Installed) {
-      conflict_mods.push_back(candidate);
-    }
-  }
-  return conflict_mods;
-}
-
-template <typename Func>
-void modder::tx_wrapper_(Func func) {
-  fs_tx fstx{m_fs};
-  auto dbtx = m_db.begin();
-
-  auto& ret = func();
-  if (!ret.success) {
-    return;
-  }
-
-  dbtx.release();
-  fstx.commit();
-}
-
 modder::modder() : modder(get_config_dir(), get_db_path()) {}
+modder::modder(bool read_only)
+    : modder(get_config_dir(), get_db_path(), read_only) {}
 modder::~modder() = default;
 
 modder::modder(const std::filesystem::path& cfg_dir,
-               const std::filesystem::path& db_path)
-    : m_fs{cfg_dir}, m_db{path_to_utf8str(db_path)} {}
+               const std::filesystem::path& db_path, bool read_only)
+    : m_fs{cfg_dir}, m_db{path_to_utf8str(db_path), read_only} {}
+
+void modder::set_dedup(bool dedup) noexcept { m_dedup = dedup; }
 
 result<int64_t> modder::add_target(const std::filesystem::path& tar_dir_raw) {
   result<int64_t> ret;
@@ -133,6 +132,113 @@ result<int64_t> modder::add_target(const std::filesystem::path& tar_dir_raw) {
   return ret;
 }
 
+void modder::drop_stale_caches() {
+  // changes of this connection leave it as is
+  if (auto version = m_db.data_version(); version != m_data_version) {
+    m_owners.clear();
+    m_data_version = version;
+  }
+}
+
+result_base modder::set_atomic(int64_t tar_id, bool atomic) {
+  result_base ret;
+  if (m_db.update_target_atomic(tar_id, atomic) == 0) {
+    set_fail(ret, ERR_TAR_NOT_EXIST);
+  } else {
+    set_succeed(ret);
+  }
+  return ret;
+}
+
+result_base modder::set_nocase(int64_t tar_id, bool nocase) {
+  result_base ret;
+  if (m_db.update_target_nocase(tar_id, nocase) == 0) {
+    set_fail(ret, ERR_TAR_NOT_EXIST);
+  } else {
+    // keys of the index and bloom filter change, rebuild them on next use
+    m_owners.drop(tar_id);
+    m_db.delete_target_bloom(tar_id);
+    set_succeed(ret);
+  }
+  return ret;
+}
+
+bool modder::nocase_(int64_t tar_id) {
+  auto tar_ret = m_db.query_target(tar_id);
+  return tar_ret.success && tar_ret.data.nocase;
+}
+
+template <typename Func>
+bool modder::generation_wrapper_(int64_t tar_id, Func func) {
+  auto tar_ret = m_db.query_target(tar_id);
+  if (!tar_ret.success || !tar_ret.data.atomic) {
+    return func();
+  }
+
+  auto tar_dir = utf8str_to_path(std::move(tar_ret.data.dir));
+  auto installed = installed_mod_ids(m_db, tar_id);
+  m_generations[tar_id] = m_fs.begin_generation(tar_dir);
+  bool succeeded;
+  try {
+    succeeded = func();
+  } catch (...) {
+    m_generations.erase(tar_id);
+    throw;
+  }
+
+  auto gen_dir = std::move(m_generations[tar_id]);
+  m_generations.erase(tar_id);
+  if (succeeded) {
+    m_fs.activate_generation(tar_dir, gen_dir);
+    m_db.save_profile(tar_id, PREV_PROFILE, installed);
+  }
+  return succeeded;
+}
+
+template <typename Job, typename Func>
+void modder::for_each_target_(std::vector<Job>& jobs, Func func) {
+  // jobs of a target in order, targets in order of their first jobs
+  std::vector<std::vector<Job*>> groups;
+  std::vector<const std::filesystem::path*> group_dirs;
+  std::unordered_map<int64_t, size_t> group_of;
+  for (auto& job : jobs) {
+    auto [it, inserted] = group_of.try_emplace(job.tar_id, groups.size());
+    if (inserted) {
+      groups.emplace_back();
+      group_dirs.push_back(&job.tar_dir);
+    }
+    groups[it->second].push_back(&job);
+  }
+
+  // a target inside another shares files with it, run all in order then
+  for (size_t i = 0; i < group_dirs.size() && groups.size() > 1; ++i) {
+    for (size_t j = 0; j < group_dirs.size(); ++j) {
+      auto rel = group_dirs[j]->lexically_relative(*group_dirs[i]);
+      if (i != j && !rel.empty() && *rel.begin() != "..") {
+        groups.assign(1, {});
+        for (auto& job : jobs) {
+          groups[0].push_back(&job);
+        }
+        break;
+      }
+    }
+  }
+
+  m_fs.parallel_tx(groups.size(), [&](size_t i) {
+    for (auto* job : groups[i]) {
+      func(*job);
+    }
+  });
+}
+
+std::filesystem::path modder::tar_dir_(int64_t tar_id,
+                                       std::string&& tar_dir_str) {
+  if (auto it = m_generations.find(tar_id); it != m_generations.end()) {
+    return it->second;
+  }
+  return utf8str_to_path(std::move(tar_dir_str));
+}
+
 result<int64_t> modder::add_mod_(int64_t tar_id, const std::string& mod_name,
                                  const std::filesystem::path& mod_src_raw,
                                  copy_mod_t cp_mod_fn) {
@@ -170,12 +276,44 @@ result<int64_t> modder::add_mod_(int64_t tar_id, const std::string& mod_name,
     ret.data = m_db.insert_mod_w_files(
         tar_id, mod_name, static_cast<int64_t>(ModStatus::Uninstalled),
         mod_file_strs);
+    hash_mod_files_(ret.data,
+                    m_fs.get_cfg_mod(tar_id, utf8str_to_path(mod_name)),
+                    mod_file_strs);
     return ret;
   });
 
   return ret;
 }
 
+void modder::hash_mod_files_(int64_t mod_id,
+                             const std::filesystem::path& cfg_mod,
+                             const std::vector<std::string>& mod_file_strs) {
+  std::vector<FileHashDto> file_hashes;
+  std::vector<std::filesystem::path> cfg_mod_files;
+  for (const auto& mod_file_str : mod_file_strs) {
+    auto cfg_mod_file = cfg_mod / utf8str_to_path(mod_file_str);
+    // directories and symlinks are not hashed
+    if (std::filesystem::is_regular_file(
+            std::filesystem::symlink_status(cfg_mod_file))) {
+      file_hashes.push_back({.dir = mod_file_str});
+      cfg_mod_files.push_back(std::move(cfg_mod_file));
+    }
+  }
+
+  parallel_for(cfg_mod_files.size(), [&](size_t i) {
+    file_hashes[i].hash = hash_file(cfg_mod_files[i]);
+  });
+
+  if (m_dedup) {
+    for (size_t i = 0; i < cfg_mod_files.size(); ++i) {
+      file_hashes[i].blob =
+          m_fs.link_blob(cfg_mod_files[i], file_hashes[i].hash);
+    }
+  }
+
+  m_db.update_mod_file_hashes(mod_id, file_hashes);
+}
+
 result<int64_t> modder::add_mod(int64_t tar_id, const std::string& mod_name,
                                 const std::filesystem::path& mod_dir_raw) {
   return add_mod_(tar_id, mod_name, mod_dir_raw, copy_mod);
@@ -191,81 +329,240 @@ result_base modder::install_mod_(int64_t mod_id) {
   result_base ret{.success = true};
 
   tx_wrapper_([&]() -> auto& {
-    auto mods = m_db.query_mods_w_files(std::vector<int64_t>{mod_id});
-    if (mods.empty()) {
-      set_fail(ret, ERR_MOD_NOT_EXIST);
+    std::vector<install_job> jobs;
+    if (!plan_install_(ret, mod_id, jobs)) {
       return ret;
     }
-
-    auto& mod = mods[0];
-    if (ModStatus::Installed == mod.status) {
-      // if already installed, do nothing
-      return ret;
+    for (auto& job : jobs) {
+      install_files_(job);
+      commit_install_(job);
     }
 
-    auto cfg_mod = m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir));
+    set_succeed(ret);
+    return ret;
+  });
 
-    // check if missing files
-    for (auto& mod_file_str : mod.files) {
-      if (auto cfg_mod_file = cfg_mod / utf8str_to_path(mod_file_str);
-          !std::filesystem::exists(cfg_mod_file)) {
-        set_fail(ret, {ERR_NOT_EXISTS, ": ", cfg_mod_file.string().c_str()});
-        return ret;
-      }
+  return ret;
+}
+
+bool modder::plan_install_(result_base& ret, int64_t mod_id,
+                           std::vector<install_job>& jobs) {
+  auto views = m_db.query_mod_views(std::vector<int64_t>{mod_id});
+  if (views.mods.empty()) {
+    set_fail(ret, ERR_MOD_NOT_EXIST);
+    return false;
+  }
+
+  auto& mod = views.mods[0];
+  if (ModStatus::Installed == mod.status ||
+      std::any_of(jobs.begin(), jobs.end(),
+                  [&](const auto& job) { return job.mod_id == mod_id; })) {
+    // if already installed, do nothing
+    return true;
+  }
+
+  auto cfg_mod = m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir));
+
+  // check if missing files
+  for (auto mod_file_str : mod.files) {
+    if (auto cfg_mod_file = cfg_mod / utf8str_to_path(mod_file_str);
+        !std::filesystem::exists(cfg_mod_file)) {
+      set_fail(ret, {ERR_NOT_EXISTS, ": ", cfg_mod_file.string().c_str()});
+      return false;
     }
+  }
 
-    // check if conflict with other installed mods
-    if (auto conflict_mods = find_conflict_mods(cfg_mod, mod, m_db);
-        !conflict_mods.empty()) {
-      set_fail(ret, "ERROR: cannot install mod, conflict with mod ids: ");
-      for (auto& conflict_mod : conflict_mods) {
-        ret.msg += std::to_string(conflict_mod.id);
-        ret.msg += " ";
+  // check if conflict with other installed mods, filter out dirs
+  std::vector<std::string_view> mod_file_strs;
+  for (auto mod_file_str : mod.files) {
+    if (!std::filesystem::is_directory(cfg_mod /
+                                       utf8str_to_path(mod_file_str))) {
+      mod_file_strs.push_back(mod_file_str);
+    }
+  }
+  // mods planned before are not in the database yet, check against them too
+  if (!m_owners.loaded(mod.tar_id) &&
+      std::any_of(jobs.begin(), jobs.end(), [&](const auto& job) {
+        return job.tar_id == mod.tar_id;
+      })) {
+    load_owners_(mod.tar_id);
+    for (const auto& job : jobs) {
+      if (job.tar_id == mod.tar_id) {
+        m_owners.add(job.tar_id, job.mod_id, job.mod_views.mods[0].files);
       }
-      return ret;
     }
+  }
+  if (!check_conflicts_(ret, mod.tar_id, mod_file_strs)) {
+    return false;
+  }
 
-    auto tar_ret = m_db.query_target(mod.tar_id);
-    if (!tar_ret.success) {
-      set_fail(ret,
-               {ERR_TAR_NOT_EXIST, ": ", std::to_string(mod.tar_id).c_str()});
-      return ret;
-    }
+  auto tar_ret = m_db.query_target(mod.tar_id);
+  if (!tar_ret.success) {
+    set_fail(ret,
+             {ERR_TAR_NOT_EXIST, ": ", std::to_string(mod.tar_id).c_str()});
+    return false;
+  }
 
-    auto tar_dir = utf8str_to_path(std::move(tar_ret.data.dir));
+  auto tar_dir = tar_dir_(mod.tar_id, std::move(tar_ret.data.dir));
 
-    // check target dir exists
-    if (!check_directory(ret, tar_dir)) {
-      return ret;
+  // check target dir exists
+  if (!check_directory(ret, tar_dir)) {
+    return false;
+  }
+
+  m_owners.add(mod.tar_id, mod.id, mod.files);
+  add_to_bloom_(mod.tar_id, mod.files);
+  if (auto* task = m_fs.get_task()) {
+    task->add_total(mod_file_strs.size(), 0);
+  }
+  // views of the arena stay valid as it is moved
+  jobs.push_back({.mod_id = mod.id,
+                  .tar_id = mod.tar_id,
+                  .cfg_mod = std::move(cfg_mod),
+                  .tar_dir = std::move(tar_dir),
+                  .nocase = tar_ret.data.nocase,
+                  .mod_views = std::move(views),
+                  .mod_file_strs = std::move(mod_file_strs)});
+  return true;
+}
+
+void modder::install_files_(install_job& job) {
+  auto bak_file_rels = m_fs.install_mod(job.cfg_mod, job.tar_dir, job.nocase);
+
+  job.bak_file_strs.reserve(bak_file_rels.size());
+  for (auto& bak_file_rel : bak_file_rels) {
+    job.bak_file_strs.push_back(path_to_utf8str(bak_file_rel));
+  }
+}
+
+void modder::commit_install_(const install_job& job) {
+  m_db.install_mod(job.mod_id, job.bak_file_strs);
+  record_links_(job.mod_id, job.tar_dir, job.nocase, job.mod_file_strs);
+}
+
+void modder::record_links_(int64_t mod_id,
+                           const std::filesystem::path& tar_dir, bool nocase,
+                           std::span<const std::string_view> mod_file_strs) {
+  // found up front, `tar_paths` is not thread-safe
+  std::vector<std::filesystem::path> nocase_files;
+  if (nocase) {
+    tar_paths tar{tar_dir, true};
+    nocase_files.reserve(mod_file_strs.size());
+    for (auto mod_file_str : mod_file_strs) {
+      nocase_files.push_back(tar_dir / tar.rel(utf8str_to_path(mod_file_str)));
     }
+  }
+
+  std::vector<LinkMetaDto> link_metas(mod_file_strs.size());
+  parallel_for(mod_file_strs.size(), [&](size_t i) {
+    auto meta =
+        lstat_meta(nocase ? nocase_files[i]
+                          : tar_dir / utf8str_to_path(mod_file_strs[i]));
+    link_metas[i] = {.dir = std::string{mod_file_strs[i]},
+                     .ino = meta.ino,
+                     .mtime = meta.mtime};
+  });
+  m_db.update_link_metas(mod_id, link_metas);
+}
 
-    auto bak_file_rels = m_fs.install_mod(cfg_mod, tar_dir);
+void modder::load_owners_(int64_t tar_id) {
+  if (!m_owners.loaded(tar_id)) {
+    m_owners.load(tar_id, m_db.query_installed_files(tar_id), nocase_(tar_id));
+  }
+}
 
-    std::vector<std::string> bak_file_strs;
-    bak_file_strs.reserve(bak_file_rels.size());
-    for (auto& bak_file_rel : bak_file_rels) {
-      bak_file_strs.push_back(path_to_utf8str(bak_file_rel));
+bloom_filter modder::load_bloom_(int64_t tar_id, bool nocase) {
+  if (auto bloom_ret = m_db.query_target_bloom(tar_id); bloom_ret.success) {
+    if (auto bloom = bloom_filter::from_bytes(bloom_ret.data)) {
+      return std::move(*bloom);
     }
+    // malformed, rebuilt below
+    m_db.delete_target_bloom(tar_id);
+  }
 
-    m_db.install_mod(mod.id, bak_file_strs);
+  auto files = m_db.query_installed_files(tar_id);
+  bloom_filter bloom{std::max(MIN_BLOOM_CAPACITY, 2 * files.size())};
+  for (const auto& [file, _] : files) {
+    bloom.add(nocase ? ascii_fold(file) : file);
+  }
+  m_db.update_target_bloom(tar_id, bloom.to_bytes());
+  return bloom;
+}
 
-    set_succeed(ret);
-    return ret;
-  });
+void modder::add_to_bloom_(int64_t tar_id,
+                           std::span<const std::string_view> mod_file_strs) {
+  auto bloom_ret = m_db.query_target_bloom(tar_id);
+  if (!bloom_ret.success) {
+    return;
+  }
 
-  return ret;
+  auto bloom = bloom_filter::from_bytes(bloom_ret.data);
+  if (!bloom || bloom->size() + mod_file_strs.size() > bloom->capacity()) {
+    // malformed or full, rebuilt on next use
+    m_db.delete_target_bloom(tar_id);
+    return;
+  }
+  bool nocase = nocase_(tar_id);
+  for (auto mod_file_str : mod_file_strs) {
+    bloom->add(nocase ? ascii_fold(mod_file_str) : mod_file_str);
+  }
+  m_db.update_target_bloom(tar_id, bloom->to_bytes());
+}
+
+bool modder::check_conflicts_(
+    result_base& ret, int64_t tar_id,
+    std::span<const std::string_view> mod_file_strs) {
+  if (!m_owners.loaded(tar_id)) {
+    // most mods conflict with nothing, rule them out without loading the
+    // installed files
+    bool nocase = nocase_(tar_id);
+    auto bloom = load_bloom_(tar_id, nocase);
+    if (std::none_of(mod_file_strs.begin(), mod_file_strs.end(),
+                     [&](const auto& mod_file_str) {
+                       if (nocase) {
+                         return bloom.may_contain(ascii_fold(mod_file_str));
+                       }
+                       return bloom.may_contain(mod_file_str);
+                     })) {
+      return true;
+    }
+  }
+
+  load_owners_(tar_id);
+  std::set<int64_t> conflict_ids;
+  for (auto mod_file_str : mod_file_strs) {
+    for (auto mod_id : m_owners.owners(tar_id, mod_file_str)) {
+      conflict_ids.insert(mod_id);
+    }
+  }
+  if (conflict_ids.empty()) {
+    return true;
+  }
+
+  set_fail(ret, "ERROR: cannot install mod, conflict with mod ids: ");
+  for (auto conflict_id : conflict_ids) {
+    ret.msg += std::to_string(conflict_id);
+    ret.msg += " ";
+  }
+  return false;
 }
 
 result_base modder::install_mods(const std::vector<int64_t>& mod_ids) {
   result_base ret{.success = true};
 
   tx_wrapper_([&]() -> auto& {
+    // all checked before any file changes, database written by this thread
+    std::vector<install_job> jobs;
     for (const auto& mod_id : mod_ids) {
-      if (auto inst_ret = install_mod_(mod_id); !inst_ret.success) {
-        set_fail(ret, std::move(inst_ret.msg));
+      if (!plan_install_(ret, mod_id, jobs)) {
         return ret;
       }
     }
+    for_each_target_(jobs, [&](install_job& job) { install_files_(job); });
+    for (const auto& job : jobs) {
+      commit_install_(job);
+    }
+
     set_succeed(ret);
     return ret;
   });
@@ -284,13 +581,18 @@ result_base modder::install_target(int64_t tar_id) {
     }
 
     auto& tar = tars[0];
-    for (auto& mod : tar.ModDtos) {
-      if (ModStatus::Uninstalled == mod.status) {
-        if (auto inst_ret = install_mod_(mod.id); !inst_ret.success) {
-          set_fail(ret, std::move(inst_ret.msg));
-          return ret;
-        }
-      }
+    if (!generation_wrapper_(tar_id, [&] {
+          for (auto& mod : tar.ModDtos) {
+            if (ModStatus::Uninstalled == mod.status) {
+              if (auto inst_ret = install_mod_(mod.id); !inst_ret.success) {
+                set_fail(ret, std::move(inst_ret.msg));
+                return false;
+              }
+            }
+          }
+          return true;
+        })) {
+      return ret;
     }
 
     set_succeed(ret);
@@ -345,55 +647,84 @@ result<ModDto> modder::uninstall_mod_(int64_t mod_id) {
   ret.success = true;
 
   tx_wrapper_([&]() -> auto& {
-    auto mods = m_db.query_mods_w_files(std::vector<int64_t>{mod_id});
-    if (mods.empty()) {
-      set_fail(ret, {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
-      return ret;
+    std::vector<uninstall_job> jobs;
+    if (plan_uninstall_(ret, mod_id, jobs)) {
+      for (const auto& job : jobs) {
+        uninstall_files_(job);
+      }
     }
+    return ret;
+  });
+
+  return ret;
+}
 
-    ret.data = std::move(mods[0]);
-    const auto& mod = ret.data;
+bool modder::plan_uninstall_(result<ModDto>& ret, int64_t mod_id,
+                             std::vector<uninstall_job>& jobs) {
+  auto views = m_db.query_mod_views(std::vector<int64_t>{mod_id});
+  if (views.mods.empty()) {
+    set_fail(ret, {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
+    return false;
+  }
 
-    if (ModStatus::Uninstalled == mod.status) {
-      // not considered error, just do nothing
-      return ret;
-    }
+  const auto& mod = views.mods[0];
+  ret.data = {.id = mod.id,
+              .tar_id = mod.tar_id,
+              .dir = mod.dir,
+              .status = mod.status};
 
-    m_db.uninstall_mod(mod_id);
+  if (ModStatus::Uninstalled == mod.status) {
+    // not considered error, just do nothing
+    return true;
+  }
 
-    auto tar_ret = m_db.query_target(mod.tar_id);
-    // if tar_ret.success == false, that means we have a dangling mod so don't
-    // need to uninstall anything in filesystem.
-    if (tar_ret.success == true) {
-      auto make_paths_from_strs = [](auto& file_strs) {
-        std::vector<std::filesystem::path> paths;
-        paths.reserve(file_strs.size());
-        for (auto& file_str : file_strs) {
-          paths.push_back(utf8str_to_path(std::move(file_str)));
-        }
-        return paths;
-      };
+  m_db.uninstall_mod(mod_id);
+  m_owners.remove(mod.tar_id, mod_id, mod.files);
+
+  auto tar_ret = m_db.query_target(mod.tar_id);
+  // if tar_ret.success == false, that means we have a dangling mod so don't
+  // need to uninstall anything in filesystem.
+  if (tar_ret.success == true) {
+    auto make_paths_from_strs = [](const auto& file_strs) {
+      std::vector<std::filesystem::path> paths;
+      paths.reserve(file_strs.size());
+      for (const auto& file_str : file_strs) {
+        paths.push_back(utf8str_to_path(file_str));
+      }
+      return paths;
+    };
 
-      m_fs.uninstall_mod(m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir)),
-                         utf8str_to_path(std::move(tar_ret.data.dir)),
-                         make_paths_from_strs(mod.files),
-                         make_paths_from_strs(mod.bak_files));
+    if (auto* task = m_fs.get_task()) {
+      task->add_total(mod.files.size(), 0);
     }
-    return ret;
-  });
+    jobs.push_back(
+        {.tar_id = mod.tar_id,
+         .cfg_mod = m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir)),
+         .tar_dir = tar_dir_(mod.tar_id, std::move(tar_ret.data.dir)),
+         .nocase = tar_ret.data.nocase,
+         .mod_file_rels = make_paths_from_strs(mod.files),
+         .bak_file_rels = make_paths_from_strs(mod.bak_files)});
+  }
+  return true;
+}
 
-  return ret;
+void modder::uninstall_files_(const uninstall_job& job) {
+  m_fs.uninstall_mod(job.cfg_mod, job.tar_dir, job.mod_file_rels,
+                     job.bak_file_rels, job.nocase);
 }
 
 result_base modder::uninstall_mods(const std::vector<int64_t>& mod_ids) {
   result_base ret{.success = true};
   tx_wrapper_([&]() -> auto& {
+    std::vector<uninstall_job> jobs;
     for (auto mod_id : mod_ids) {
-      if (auto unin_ret = uninstall_mod_(mod_id); !unin_ret.success) {
+      if (result<ModDto> unin_ret; !plan_uninstall_(unin_ret, mod_id, jobs)) {
         set_fail(ret, std::move(unin_ret.msg));
         return ret;
       }
     }
+    for_each_target_(jobs,
+                     [&](const uninstall_job& job) { uninstall_files_(job); });
     set_succeed(ret);
     return ret;
   });
@@ -409,14 +740,19 @@ result_base modder::uninstall_target(int64_t tar_id) {
       return ret;
     }
 
-    for (auto& mod : tars[0].ModDtos) {
-      // filter installed mods only
-      if (ModStatus::Installed == mod.status) {
-        if (auto unin_ret = uninstall_mod_(mod.id); !unin_ret.success) {
-          set_fail(ret, std::move(unin_ret.msg));
-          return ret;
-        }
-      }
+    if (!generation_wrapper_(tar_id, [&] {
+          for (auto& mod : tars[0].ModDtos) {
+            // filter installed mods only
+            if (ModStatus::Installed == mod.status) {
+              if (auto unin_ret = uninstall_mod_(mod.id); !unin_ret.success) {
+                set_fail(ret, std::move(unin_ret.msg));
+                return false;
+              }
+            }
+          }
+          return true;
+        })) {
+      return ret;
     }
 
     set_succeed(ret);
@@ -436,9 +772,11 @@ result_base modder::remove_mod_(int64_t mod_id) {
     }
 
     auto& unin_mod = unin_ret.data;
+    auto unref_blobs = m_db.release_blobs(mod_id);
     m_db.delete_mod(mod_id);
     m_fs.remove_mod(m_fs.get_cfg_mod(unin_mod.tar_id,
                                      utf8str_to_path(std::move(unin_mod.dir))));
+    m_fs.remove_blobs(unref_blobs);
 
     return ret;
   });
@@ -481,6 +819,7 @@ result_base modder::remove_target(int64_t tar_id) {
       }
     }
     m_db.delete_target(tar_id);
+    m_owners.drop(tar_id);
     m_fs.remove_target(tar_id);
     set_succeed(ret);
     return ret;
@@ -489,6 +828,65 @@ result_base modder::remove_target(int64_t tar_id) {
   return ret;
 }
 
+result<std::vector<ModDto>> modder::which(
+    const std::filesystem::path& path_raw) {
+  result<std::vector<ModDto>> ret;
+  ret.success = true;
+
+  auto path = std::filesystem::absolute(path_raw).lexically_normal();
+  if (!path.has_filename()) {
+    path = path.parent_path();
+  }
+
+  // the innermost target containing `path`
+  int64_t tar_id = 0;
+  size_t tar_dir_len = 0;
+  std::filesystem::path file_rel;
+  for (auto& tar : m_db.query_targets_mods({})) {
+    auto rel = path.lexically_relative(utf8str_to_path(tar.dir));
+    if (rel.empty() || rel == "." || *rel.begin() == "..") {
+      continue;
+    }
+    if (tar.dir.size() > tar_dir_len) {
+      tar_id = tar.id;
+      tar_dir_len = tar.dir.size();
+      file_rel = std::move(rel);
+    }
+  }
+  if (tar_dir_len == 0) {
+    set_fail(ret, {"error: not in any target: '",
+                   path_to_utf8str(path).c_str(), "'"});
+    return ret;
+  }
+
+  load_owners_(tar_id);
+  for (auto mod_id : m_owners.owners(tar_id, path_to_utf8str(file_rel))) {
+    if (auto mod_ret = m_db.query_mod(mod_id); mod_ret.success) {
+      ret.data.push_back(std::move(mod_ret.data));
+    }
+  }
+  std::sort(ret.data.begin(), ret.data.end(),
+            [](const auto& a, const auto& b) { return a.id < b.id; });
+  return ret;
+}
+
+result<std::vector<std::pair<std::string, int64_t>>> modder::find_files(
+    int64_t tar_id, const std::string& pattern, bool installed) {
+  result<std::vector<std::pair<std::string, int64_t>>> ret;
+  ret.success = true;
+
+  if (!m_db.query_target(tar_id).success) {
+    set_fail(ret, {ERR_TAR_NOT_EXIST, ": ", std::to_string(tar_id).c_str()});
+    return ret;
+  }
+
+  // files are recorded w/ native separators
+  ret.data = m_db.find_files(
+      tar_id, path_to_utf8str(utf8str_to_path(pattern).make_preferred()),
+      installed);
+  return ret;
+}
+
 std::vector<ModDto> modder::query_mods(const std::vector<int64_t>& mod_ids) {
   return m_db.query_mods_w_files(mod_ids);
 }
@@ -500,72 +898,186 @@ std::vector<TargetDto> modder::query_targets(
 
 constexpr char MARGIN[] = "    ";
 
-static void _list_files(const std::vector<std::string>& file_strs,
-                        std::string_view& margin, std::string& ret) {
-  for (auto& file_str : file_strs) {
-    ret += margin;
-    ret += '\'';
-    ret += file_str;
-    ret += '\'';
-    ret += '\n';
-  }
-}
-
-static std::string _list_mods(const std::vector<ModDto>& mods,
-                              bool verbose = false, uint8_t indent = 0) {
-  std::string ret;
-
-  std::string full_margin;
-  for (int i = 0; i < indent + 2; ++i) {
-    full_margin += MARGIN;
-  }
-  std::string_view margin1{full_margin.c_str(), indent * length_s(MARGIN)};
-  std::string_view margin2{full_margin.c_str(),
-                           (indent + 1) * length_s(MARGIN)};
-  std::string_view margin3{full_margin.c_str(),
-                           (indent + 2) * length_s(MARGIN)};
-
-  for (auto& mod : mods) {
-    ret += margin1;
-    ret += "MOD_ID ";
-    ret += std::to_string(mod.id);
-    ret += " DIR '";
-    ret += mod.dir;
-    ret += "' STATUS ";
-    ret += mod.status == ModStatus::Installed ? "installed" : "not_installed";
-    ret += '\n';
+static const char* status_str(ModStatus status) {
+  return status == ModStatus::Installed ? "installed" : "not_installed";
+}
+
+static void write_margin(std::ostream& out, int indent) {
+  for (int i = 0; i < indent; ++i) {
+    out << MARGIN;
+  }
+}
+
+// Write `str` as a JSON string, UTF-8 is written as is.
+static void write_json_str(std::ostream& out, std::string_view str) {
+  out << '"';
+  for (auto c : str) {
+    switch (c) {
+      case '"':
+        out << "\\\"";
+        break;
+      case '\\':
+        out << "\\\\";
+        break;
+      case '\n':
+        out << "\\n";
+        break;
+      case '\t':
+        out << "\\t";
+        break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          constexpr char HEX[] = "0123456789abcdef";
+          out << "\\u00" << HEX[c >> 4] << HEX[c & 0xf];
+        } else {
+          out << c;
+        }
+    }
+  }
+  out << '"';
+}
+
+// Writes items of a listing, separated as `format` requires.
+class list_writer {
+ public:
+  list_writer(std::ostream& out, ListFormat format)
+      : m_out{out}, m_format{format} {}
+
+  list_writer(const list_writer&) = delete;
+
+  // Ends a JSON array, items of other formats end themselves.
+  ~list_writer() {
+    if (ListFormat::Json == m_format) {
+      m_out << (m_empty ? "[]" : "\n]");
+    }
+  }
+
+  // Separate the next item from the previous one.
+  std::ostream& next() {
+    if (ListFormat::Json == m_format) {
+      m_out << (m_empty ? "[\n" : ",\n");
+    } else if (ListFormat::NdJson == m_format && !m_empty) {
+      m_out << '\n';
+    }
+    m_empty = false;
+    return m_out;
+  }
+
+ private:
+  std::ostream& m_out;
+  ListFormat m_format;
+  bool m_empty = true;
+};
+
+using for_each_file_t = void (DB::*)(
+    int64_t, const std::function<void(const std::string&)>&);
+
+// Write files of mod `mod_id` read by `for_each` as a JSON array.
+static void write_json_files(std::ostream& out, DB& db, int64_t mod_id,
+                             for_each_file_t for_each) {
+  out << '[';
+  bool first = true;
+  (db.*for_each)(mod_id, [&](const std::string& file_str) {
+    if (!first) {
+      out << ',';
+    }
+    first = false;
+    write_json_str(out, file_str);
+  });
+  out << ']';
+}
+
+// Write `mod`, w/ its files read from `db` if `verbose`.
+static void write_mod(std::ostream& out, DB& db, const ModDto& mod,
+                      ListFormat format, bool verbose, int indent) {
+  if (ListFormat::Text != format) {
+    out << "{\"id\":" << mod.id;
+    if (verbose) {
+      out << ",\"target_id\":" << mod.tar_id;
+    }
+    out << ",\"dir\":";
+    write_json_str(out, mod.dir);
+    out << ",\"status\":\"" << status_str(mod.status) << '"';
     if (verbose) {
-      ret += margin2;
-      ret += "MOD_FILES\n";
-      _list_files(mod.files, margin3, ret);
-      ret += margin2;
-      ret += "BACKUP_FILES\n";
-      _list_files(mod.bak_files, margin3, ret);
+      out << ",\"files\":";
+      write_json_files(out, db, mod.id, &DB::for_each_mod_file);
+      out << ",\"backup_files\":";
+      write_json_files(out, db, mod.id, &DB::for_each_backup_file);
     }
+    out << '}';
+    return;
   }
 
-  return ret;
+  write_margin(out, indent);
+  out << "MOD_ID " << mod.id << " DIR '" << mod.dir << "' STATUS "
+      << status_str(mod.status) << '\n';
+  if (verbose) {
+    auto write_file = [&](const std::string& file_str) {
+      write_margin(out, indent + 2);
+      out << '\'' << file_str << "'\n";
+    };
+    write_margin(out, indent + 1);
+    out << "MOD_FILES\n";
+    db.for_each_mod_file(mod.id, write_file);
+    write_margin(out, indent + 1);
+    out << "BACKUP_FILES\n";
+    db.for_each_backup_file(mod.id, write_file);
+  }
 }
 
-std::string modder::list_mods(const std::vector<int64_t>& mod_ids) {
-  return _list_mods(query_mods(mod_ids), true);
+void modder::list_mods(std::ostream& out, const std::vector<int64_t>& mod_ids,
+                       const ListOptions& opts) {
+  // one snapshot of the database
+  auto dbtx = m_db.begin();
+  list_writer writer{out, opts.format};
+  m_db.for_each_mod(mod_ids, opts.limit, opts.offset, [&](const ModDto& mod) {
+    write_mod(writer.next(), m_db, mod, opts.format, true, 0);
+  });
 }
 
-std::string modder::list_targets(const std::vector<int64_t>& tar_ids) {
-  std::string ret;
+void modder::list_targets(std::ostream& out,
+                          const std::vector<int64_t>& tar_ids,
+                          const ListOptions& opts) {
+  auto dbtx = m_db.begin();
+  list_writer writer{out, opts.format};
+  m_db.for_each_target(
+      tar_ids, opts.limit, opts.offset, [&](const TargetDto& tar) {
+        auto& item = writer.next();
+        if (ListFormat::Text == opts.format) {
+          item << "TARGET_ID " << tar.id << " DIR '" << tar.dir << "'\n";
+          m_db.for_each_mod_of_target(tar.id, [&](const ModDto& mod) {
+            write_mod(item, m_db, mod, opts.format, false, 1);
+          });
+          return;
+        }
 
-  auto tars = query_targets(tar_ids);
-  for (auto& tar : tars) {
-    ret += "TARGET_ID ";
-    ret += std::to_string(tar.id);
-    ret += " DIR '";
-    ret += tar.dir;
-    ret += "'\n";
+        item << "{\"id\":" << tar.id << ",\"dir\":";
+        write_json_str(item, tar.dir);
+        item << ",\"atomic\":" << (tar.atomic ? "true" : "false")
+             << ",\"nocase\":" << (tar.nocase ? "true" : "false")
+             << ",\"mods\":[";
+        bool first = true;
+        m_db.for_each_mod_of_target(tar.id, [&](const ModDto& mod) {
+          if (!first) {
+            item << ',';
+          }
+          first = false;
+          write_mod(item, m_db, mod, opts.format, false, 0);
+        });
+        item << "]}";
+      });
+}
 
-    ret += _list_mods(tar.ModDtos, false, 1);
-  }
+std::string modder::list_mods(const std::vector<int64_t>& mod_ids) {
+  std::ostringstream oss;
+  list_mods(oss, mod_ids);
+  return oss.str();
+}
 
-  return ret;
+std::string modder::list_targets(const std::vector<int64_t>& tar_ids) {
+  std::ostringstream oss;
+  list_targets(oss, tar_ids);
+  return oss.str();
 }
 
 result_base modder::rename_mod(int64_t mid, const std::string& newname) {
@@ -590,4 +1102,774 @@ result_base modder::rename_mod(int64_t mid, const std::string& newname) {
   return ret;
 }
 
-}  // namespace filemod
\ No newline at end of file
+// Returns the issue of a mod file, `tar_file` is empty if the mod is not
+// installed.
+static std::optional<FileIssue> verify_file(
+    const FileHashDto& file_hash, const std::filesystem::path& cfg_mod_file,
+    const std::filesystem::path& tar_file) {
+  std::error_code ec;
+  auto status = std::filesystem::symlink_status(cfg_mod_file, ec);
+  if (!std::filesystem::exists(status)) {
+    return FileIssue::Missing;
+  }
+
+  // mods added before hashes were recorded are only checked for existence
+  if (!file_hash.hash.empty()) {
+    try {
+      if (hash_file(cfg_mod_file) != file_hash.hash) {
+        return FileIssue::Modified;
+      }
+    } catch (std::exception&) {
+      // cannot read it back
+      return FileIssue::Modified;
+    }
+  }
+
+  if (!tar_file.empty()) {
+    if (std::filesystem::is_directory(status)) {
+      if (!std::filesystem::is_directory(
+              std::filesystem::symlink_status(tar_file, ec))) {
+        return FileIssue::Unlinked;
+      }
+    } else if (auto link = std::filesystem::read_symlink(tar_file, ec);
+               ec || link.lexically_normal() !=
+                         cfg_mod_file.lexically_normal()) {
+      return FileIssue::Unlinked;
+    }
+  }
+
+  return std::nullopt;
+}
+
+result<std::vector<FileIssueDto>> modder::verify_mods(
+    const std::vector<int64_t>& mod_ids) {
+  result<std::vector<FileIssueDto>> ret;
+  ret.success = true;
+
+  struct verify_job {
+    int64_t mod_id;
+    const FileHashDto* file_hash;
+    std::filesystem::path cfg_mod_file;
+    std::filesystem::path tar_file;
+  };
+
+  // owns the FileHashDto referenced by jobs
+  std::vector<std::vector<FileHashDto>> mods_file_hashes;
+  mods_file_hashes.reserve(mod_ids.size());
+  std::vector<verify_job> jobs;
+
+  for (auto mod_id : mod_ids) {
+    auto mod_ret = m_db.query_mod(mod_id);
+    if (!mod_ret.success) {
+      set_fail(ret, {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
+      return ret;
+    }
+    auto& mod = mod_ret.data;
+
+    auto cfg_mod =
+        m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(std::move(mod.dir)));
+    std::filesystem::path tar_dir;
+    bool nocase = false;
+    if (mod.status == ModStatus::Installed) {
+      auto tar = m_db.query_target(mod.tar_id).data;
+      tar_dir = utf8str_to_path(tar.dir);
+      nocase = tar.nocase;
+    }
+    tar_paths tar{tar_dir, nocase};
+
+    for (auto& file_hash :
+         mods_file_hashes.emplace_back(m_db.query_mod_file_hashes(mod_id))) {
+      auto file_rel = utf8str_to_path(file_hash.dir);
+      auto tar_file = tar_dir.empty() ? tar_dir : tar_dir / tar.rel(file_rel);
+      jobs.push_back({.mod_id = mod_id,
+                      .file_hash = &file_hash,
+                      .cfg_mod_file = cfg_mod / file_rel,
+                      .tar_file = std::move(tar_file)});
+    }
+  }
+
+  std::vector<std::optional<FileIssue>> issues(jobs.size());
+  parallel_for(jobs.size(), [&](size_t i) {
+    issues[i] =
+        verify_file(*jobs[i].file_hash, jobs[i].cfg_mod_file, jobs[i].tar_file);
+  });
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (issues[i]) {
+      ret.data.push_back({.mod_id = jobs[i].mod_id,
+                          .dir = jobs[i].file_hash->dir,
+                          .issue = *issues[i]});
+    }
+  }
+
+  return ret;
+}
+
+result<std::vector<FileIssueDto>> modder::verify_target(int64_t tar_id) {
+  if (!m_db.query_target(tar_id).success) {
+    result<std::vector<FileIssueDto>> ret;
+    set_fail(ret, ERR_TAR_NOT_EXIST);
+    return ret;
+  }
+
+  std::vector<int64_t> mod_ids;
+  for (const auto& mod : m_db.query_mods_by_target(tar_id)) {
+    mod_ids.push_back(mod.id);
+  }
+  return verify_mods(mod_ids);
+}
+
+// Returns the drift of an installed mod file.
+static std::optional<FileDrift> check_link(
+    const LinkMetaDto& link_meta, const std::filesystem::path& cfg_mod_file,
+    const std::filesystem::path& tar_file) {
+  auto meta = lstat_meta(tar_file);
+  switch (meta.type) {
+    case std::filesystem::file_type::not_found:
+      return FileDrift::Missing;
+    case std::filesystem::file_type::symlink: {
+      // a recreated or retargeted link has a new inode or mtime
+      if (link_meta.mtime != 0 && meta.ino == link_meta.ino &&
+          meta.mtime == link_meta.mtime) {
+        return std::nullopt;
+      }
+      std::error_code ec;
+      auto link = std::filesystem::read_symlink(tar_file, ec);
+      if (!ec &&
+          link.lexically_normal() == cfg_mod_file.lexically_normal()) {
+        return std::nullopt;
+      }
+      return FileDrift::Replaced;
+    }
+    case std::filesystem::file_type::directory:
+      // directories are created, not linked
+      if (lstat_meta(cfg_mod_file).type ==
+          std::filesystem::file_type::directory) {
+        return std::nullopt;
+      }
+      return FileDrift::Replaced;
+    default:
+      return FileDrift::Replaced;
+  }
+}
+
+result<std::vector<FileDriftDto>> modder::status(
+    const std::vector<int64_t>& tar_ids) {
+  result<std::vector<FileDriftDto>> ret;
+  ret.success = true;
+
+  auto tars = m_db.query_targets_mods(tar_ids);
+  for (auto tar_id : tar_ids) {
+    if (std::none_of(tars.begin(), tars.end(),
+                     [=](const auto& tar) { return tar.id == tar_id; })) {
+      set_fail(ret, {ERR_TAR_NOT_EXIST, ": ", std::to_string(tar_id).c_str()});
+      return ret;
+    }
+  }
+
+  struct status_job {
+    int64_t mod_id;
+    LinkMetaDto link_meta;
+    std::filesystem::path cfg_mod_file;
+    std::filesystem::path tar_file;
+    bool backup;  // `tar_file` is a backup file
+  };
+  std::vector<status_job> jobs;
+
+  for (auto& tar : tars) {
+    auto tar_dir = utf8str_to_path(tar.dir);
+    auto bak_dir = FS::get_bak_dir(m_fs.get_cfg_tar(tar.id));
+    tar_paths paths{tar_dir, nocase_(tar.id)};
+
+    for (auto& mod : tar.ModDtos) {
+      if (mod.status != ModStatus::Installed) {
+        continue;
+      }
+      auto cfg_mod = m_fs.get_cfg_mod(tar.id, utf8str_to_path(mod.dir));
+
+      for (auto& link_meta : m_db.query_link_metas(mod.id)) {
+        auto file_rel = utf8str_to_path(link_meta.dir);
+        jobs.push_back({.mod_id = mod.id,
+                        .link_meta = std::move(link_meta),
+                        .cfg_mod_file = cfg_mod / file_rel,
+                        .tar_file = tar_dir / paths.rel(file_rel),
+                        .backup = false});
+      }
+      for (auto& bak_file : m_db.query_backup_files(mod.id)) {
+        auto bak_file_path = bak_dir / utf8str_to_path(bak_file);
+        jobs.push_back({.mod_id = mod.id,
+                        .link_meta = {.dir = std::move(bak_file)},
+                        .cfg_mod_file = {},
+                        .tar_file = std::move(bak_file_path),
+                        .backup = true});
+      }
+    }
+  }
+
+  std::vector<std::optional<FileDrift>> drifts(jobs.size());
+  parallel_for(jobs.size(), [&](size_t i) {
+    const auto& job = jobs[i];
+    if (!job.backup) {
+      drifts[i] = check_link(job.link_meta, job.cfg_mod_file, job.tar_file);
+    } else if (lstat_meta(job.tar_file).type ==
+               std::filesystem::file_type::not_found) {
+      drifts[i] = FileDrift::BackupMissing;
+    }
+  });
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (drifts[i]) {
+      ret.data.push_back({.mod_id = jobs[i].mod_id,
+                          .dir = std::move(jobs[i].link_meta.dir),
+                          .drift = *drifts[i]});
+    }
+  }
+
+  return ret;
+}
+
+result_base modder::repair_mod_(int64_t mod_id) {
+  result_base ret{.success = true};
+
+  tx_wrapper_([&]() -> auto& {
+    auto mod_ret = m_db.query_mod(mod_id);
+    if (!mod_ret.success) {
+      set_fail(ret, {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
+      return ret;
+    }
+    auto& mod = mod_ret.data;
+    if (mod.status != ModStatus::Installed) {
+      return ret;
+    }
+
+    auto tar_ret = m_db.query_target(mod.tar_id);
+    if (!tar_ret.success) {
+      set_fail(ret,
+               {ERR_TAR_NOT_EXIST, ": ", std::to_string(mod.tar_id).c_str()});
+      return ret;
+    }
+    auto tar_dir = utf8str_to_path(std::move(tar_ret.data.dir));
+    if (!check_directory(ret, tar_dir)) {
+      return ret;
+    }
+    bool nocase = tar_ret.data.nocase;
+    auto cfg_mod = m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir));
+
+    // ordered by file, parent directories come first
+    auto link_metas = m_db.query_link_metas(mod_id);
+    tar_paths tar{tar_dir, nocase};
+    std::vector<std::filesystem::path> tar_files;
+    tar_files.reserve(link_metas.size());
+    for (const auto& link_meta : link_metas) {
+      tar_files.push_back(tar_dir / tar.rel(utf8str_to_path(link_meta.dir)));
+    }
+    std::vector<std::optional<FileDrift>> drifts(link_metas.size());
+    parallel_for(link_metas.size(), [&](size_t i) {
+      drifts[i] = check_link(link_metas[i],
+                             cfg_mod / utf8str_to_path(link_metas[i].dir),
+                             tar_files[i]);
+    });
+
+    auto bak_file_strs = m_db.query_backup_files(mod_id);
+    std::vector<std::string> new_bak_file_strs;
+    std::vector<std::string> relinked_file_strs;
+
+    for (size_t i = 0; i < link_metas.size(); ++i) {
+      if (!drifts[i]) {
+        continue;
+      }
+      auto& file_str = link_metas[i].dir;
+      auto file_rel = utf8str_to_path(file_str);
+      auto cfg_mod_file = cfg_mod / file_rel;
+      bool is_dir = std::filesystem::is_directory(cfg_mod_file);
+
+      if (!is_dir && std::filesystem::is_directory(
+                         std::filesystem::symlink_status(tar_files[i]))) {
+        set_fail(ret, {"error: cannot repair, directory in place of file: '",
+                       path_to_utf8str(tar_files[i]).c_str(), "'"});
+        return ret;
+      }
+
+      if (auto bak_file_rel = m_fs.repair_file(cfg_mod, tar, file_rel);
+          !bak_file_rel.empty()) {
+        auto bak_file_str = path_to_utf8str(bak_file_rel);
+        if (std::find(bak_file_strs.begin(), bak_file_strs.end(),
+                      bak_file_str) == bak_file_strs.end()) {
+          new_bak_file_strs.push_back(std::move(bak_file_str));
+        }
+      }
+      if (!is_dir) {
+        relinked_file_strs.push_back(std::move(file_str));
+      }
+    }
+
+    m_db.insert_backup_files(mod_id, new_bak_file_strs);
+    record_links_(mod_id, tar_dir, nocase, views_of(relinked_file_strs));
+    return ret;
+  });
+
+  return ret;
+}
+
+result_base modder::repair_mods(const std::vector<int64_t>& mod_ids) {
+  result_base ret{.success = true};
+
+  tx_wrapper_([&]() -> auto& {
+    for (auto mod_id : mod_ids) {
+      if (auto rep_ret = repair_mod_(mod_id); !rep_ret.success) {
+        set_fail(ret, std::move(rep_ret.msg));
+        return ret;
+      }
+    }
+    set_succeed(ret);
+    return ret;
+  });
+
+  return ret;
+}
+
+result_base modder::repair_target(int64_t tar_id) {
+  if (!m_db.query_target(tar_id).success) {
+    result_base ret;
+    set_fail(ret, ERR_TAR_NOT_EXIST);
+    return ret;
+  }
+
+  std::vector<int64_t> mod_ids;
+  for (const auto& mod : m_db.query_mods_by_target(tar_id)) {
+    if (mod.status == ModStatus::Installed) {
+      mod_ids.push_back(mod.id);
+    }
+  }
+  return repair_mods(mod_ids);
+}
+
+result<int64_t> modder::save_profile(int64_t tar_id, const std::string& name) {
+  std::vector<int64_t> mod_ids;
+  for (const auto& mod : m_db.query_mods_by_target(tar_id)) {
+    if (mod.status == ModStatus::Installed) {
+      mod_ids.push_back(mod.id);
+    }
+  }
+  return save_profile(tar_id, name, mod_ids);
+}
+
+result<int64_t> modder::save_profile(int64_t tar_id, const std::string& name,
+                                     const std::vector<int64_t>& mod_ids) {
+  result<int64_t> ret;
+  ret.success = true;
+
+  tx_wrapper_([&]() -> auto& {
+    if (!m_db.query_target(tar_id).success) {
+      set_fail(ret, ERR_TAR_NOT_EXIST);
+      return ret;
+    }
+
+    for (auto mod_id : mod_ids) {
+      if (auto mod_ret = m_db.query_mod(mod_id);
+          !mod_ret.success || mod_ret.data.tar_id != tar_id) {
+        set_fail(ret,
+                 {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
+        return ret;
+      }
+    }
+
+    ret.data = m_db.save_profile(tar_id, name, mod_ids);
+    return ret;
+  });
+
+  return ret;
+}
+
+result_base modder::switch_profile(int64_t tar_id, const std::string& name) {
+  result_base ret{.success = true};
+
+  tx_wrapper_([&]() -> auto& {
+    if (!m_db.query_target(tar_id).success) {
+      set_fail(ret, ERR_TAR_NOT_EXIST);
+      return ret;
+    }
+
+    auto profile_ret = m_db.query_profile(tar_id, name);
+    if (!profile_ret.success) {
+      set_fail(ret, {ERR_PROFILE_NOT_EXIST, ": ", name.c_str()});
+      return ret;
+    }
+
+    if (!switch_mods_(ret, tar_id, profile_ret.data.mod_ids)) {
+      return ret;
+    }
+
+    set_succeed(ret);
+    return ret;
+  });
+
+  return ret;
+}
+
+result_base modder::activate_prev(int64_t tar_id) {
+  result_base ret{.success = true};
+
+  tx_wrapper_([&]() -> auto& {
+    auto tar_ret = m_db.query_target(tar_id);
+    if (!tar_ret.success) {
+      set_fail(ret, ERR_TAR_NOT_EXIST);
+      return ret;
+    }
+
+    auto profile_ret = m_db.query_profile(tar_id, PREV_PROFILE);
+    if (!tar_ret.data.atomic || !profile_ret.success ||
+        !std::filesystem::is_directory(
+            FS::get_prev_gen(utf8str_to_path(std::move(tar_ret.data.dir))))) {
+      set_fail(ret, ERR_NO_PREV_GEN);
+      return ret;
+    }
+
+    if (!switch_mods_(ret, tar_id, profile_ret.data.mod_ids)) {
+      return ret;
+    }
+
+    set_succeed(ret);
+    return ret;
+  });
+
+  return ret;
+}
+
+bool modder::switch_mods_(result_base& ret, int64_t tar_id,
+                          const std::vector<int64_t>& wanted) {
+  auto installed = installed_mod_ids(m_db, tar_id);
+
+  // uninstall first, so mods to install do not conflict with them
+  std::vector<int64_t> to_uninstall;
+  std::set_difference(installed.begin(), installed.end(), wanted.begin(),
+                      wanted.end(), std::back_inserter(to_uninstall));
+  std::vector<int64_t> to_install;
+  std::set_difference(wanted.begin(), wanted.end(), installed.begin(),
+                      installed.end(), std::back_inserter(to_install));
+
+  return generation_wrapper_(tar_id, [&] {
+    for (auto mod_id : to_uninstall) {
+      if (auto unin_ret = uninstall_mod_(mod_id); !unin_ret.success) {
+        set_fail(ret, std::move(unin_ret.msg));
+        return false;
+      }
+    }
+    for (auto mod_id : to_install) {
+      if (auto inst_ret = install_mod_(mod_id); !inst_ret.success) {
+        set_fail(ret, std::move(inst_ret.msg));
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+result_base modder::remove_profile(int64_t tar_id, const std::string& name) {
+  result_base ret{.success = true};
+
+  auto profile_ret = m_db.query_profile(tar_id, name);
+  if (!profile_ret.success) {
+    set_fail(ret, {ERR_PROFILE_NOT_EXIST, ": ", name.c_str()});
+    return ret;
+  }
+  m_db.delete_profile(profile_ret.data.id);
+  set_succeed(ret);
+  return ret;
+}
+
+std::vector<ProfileDto> modder::query_profiles(int64_t tar_id) {
+  auto profiles = m_db.query_profiles(tar_id);
+  std::erase_if(profiles, [](const ProfileDto& profile) {
+    return PREV_PROFILE == profile.name;
+  });
+  return profiles;
+}
+
+// Differences of a new version of a mod from its manifest, sorted.
+struct mod_diff {
+  std::vector<std::string> removed;
+  std::vector<std::string> changed;  // non-directories in both versions
+  std::vector<std::string> added;
+};
+
+// Whether the new version of a mod file has the same content. Sizes are
+// compared first; mtimes are not trusted, since files written within one
+// timestamp tick share it.
+static bool same_mod_file(const std::filesystem::path& mod_file,
+                          const std::filesystem::path& cfg_mod_file,
+                          const std::string& hash) {
+  if (std::filesystem::file_size(mod_file) !=
+      std::filesystem::file_size(cfg_mod_file)) {
+    return false;
+  }
+  return hash.empty() ? same_content(mod_file, cfg_mod_file)
+                      : hash_file(mod_file) == hash;
+}
+
+// A file of a new version of a mod and whether it is a directory.
+using new_mod_file = std::pair<std::string, bool>;
+
+static std::vector<new_mod_file> list_mod_files(
+    const std::filesystem::path& mod_dir) {
+  std::vector<new_mod_file> new_files;
+  for (auto& mod_file :
+       std::filesystem::recursive_directory_iterator(mod_dir)) {
+    new_files.emplace_back(
+        path_to_utf8str(std::filesystem::relative(mod_file, mod_dir)),
+        mod_file.is_directory());
+  }
+  return new_files;
+}
+
+// Files of the new version are `new_files`, those changed or added found in
+// `mod_dir`. `old_files` are ordered by file. Files in both versions and in
+// `same_files` are unchanged w/o reading them.
+static mod_diff diff_mod_files(const std::filesystem::path& mod_dir,
+                               const std::filesystem::path& cfg_mod,
+                               std::vector<new_mod_file>&& new_files,
+                               const std::vector<FileHashDto>& old_files,
+                               const std::set<std::string>& same_files) {
+  std::sort(new_files.begin(), new_files.end());
+
+  mod_diff diff;
+  std::vector<std::pair<const FileHashDto*, bool>> common;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < old_files.size() || j < new_files.size()) {
+    if (j == new_files.size() ||
+        (i < old_files.size() && old_files[i].dir < new_files[j].first)) {
+      diff.removed.push_back(old_files[i++].dir);
+    } else if (i == old_files.size() || new_files[j].first < old_files[i].dir) {
+      diff.added.push_back(new_files[j++].first);
+    } else {
+      common.emplace_back(&old_files[i++], new_files[j++].second);
+    }
+  }
+
+  // 0 unchanged, 1 changed, 2 type changed
+  std::vector<char> states(common.size());
+  parallel_for(common.size(), [&](size_t k) {
+    auto& [old_file, is_dir] = common[k];
+    if (same_files.contains(old_file->dir)) {
+      return;
+    }
+    auto file_rel = utf8str_to_path(old_file->dir);
+    auto cfg_mod_file = cfg_mod / file_rel;
+    if (std::filesystem::is_directory(cfg_mod_file) != is_dir) {
+      states[k] = 2;
+    } else if (!is_dir && !same_mod_file(mod_dir / file_rel, cfg_mod_file,
+                                         old_file->hash)) {
+      states[k] = 1;
+    }
+  });
+
+  for (size_t k = 0; k < common.size(); ++k) {
+    if (states[k] == 1) {
+      diff.changed.push_back(common[k].first->dir);
+    } else if (states[k] == 2) {
+      diff.removed.push_back(common[k].first->dir);
+      diff.added.push_back(common[k].first->dir);
+    }
+  }
+  std::sort(diff.removed.begin(), diff.removed.end());
+  std::sort(diff.added.begin(), diff.added.end());
+  return diff;
+}
+
+static std::vector<std::filesystem::path> strs_to_paths(
+    const std::vector<std::string>& strs) {
+  std::vector<std::filesystem::path> paths;
+  paths.reserve(strs.size());
+  for (const auto& str : strs) {
+    paths.push_back(utf8str_to_path(str));
+  }
+  return paths;
+}
+
+// Directory deleted w/ its contents once out of scope.
+class tmp_dir_guard {
+ public:
+  explicit tmp_dir_guard(std::filesystem::path dir) : m_dir{std::move(dir)} {}
+
+  tmp_dir_guard(const tmp_dir_guard&) = delete;
+
+  ~tmp_dir_guard() {
+    std::error_code ec;
+    std::filesystem::remove_all(m_dir, ec);
+  }
+
+ private:
+  std::filesystem::path m_dir;
+};
+
+result_base modder::update_mod(int64_t mod_id,
+                               const std::filesystem::path& mod_src_raw) {
+  result_base ret{.success = true};
+
+  if (!check_exists(ret, mod_src_raw)) {
+    return ret;
+  }
+
+  auto mod_src = std::filesystem::absolute(mod_src_raw);
+  std::string archive_hash;
+  std::optional<tmp_dir_guard> staging_guard;
+  std::unordered_map<std::string, zip_crc> zip_crcs;
+  std::vector<new_mod_file> new_files;
+  std::set<std::string> same_files;
+  if (!std::filesystem::is_directory(mod_src)) {
+    // stage the archive to diff it like a directory
+    auto staging_dir = (FS::get_tmp_dir() /= TMP_EXTRACTED) /=
+        std::to_string(mod_id);
+    std::filesystem::remove_all(staging_dir);
+    std::filesystem::create_directories(staging_dir);
+    staging_guard.emplace(staging_dir);
+    archive_hash = hash_file(mod_src);
+    fsman unlogged{false};
+
+    // files of a zip archive w/ the recorded CRC-32 and size are unchanged,
+    // only others are extracted
+    zip_crcs = read_zip_crcs(mod_src);
+    if (auto mod_ret = m_db.query_mod(mod_id);
+        mod_ret.success && !zip_crcs.empty()) {
+      auto cfg_mod = m_fs.get_cfg_mod(mod_ret.data.tar_id,
+                                      utf8str_to_path(mod_ret.data.dir));
+      for (const auto& old_file : m_db.query_mod_file_hashes(mod_id)) {
+        auto it = zip_crcs.find(old_file.dir);
+        std::error_code ec;
+        if (it != zip_crcs.end() && it->second.crc == old_file.crc &&
+            it->second.size ==
+                std::filesystem::file_size(
+                    cfg_mod / utf8str_to_path(old_file.dir), ec)) {
+          same_files.insert(old_file.dir);
+        }
+      }
+      for (auto& file : scan_archive(mod_src)) {
+        new_files.emplace_back(path_to_utf8str(file.rel), file.is_dir);
+      }
+      copy_mod_a(mod_src, staging_dir, unlogged,
+                 [&](const std::filesystem::path& file_rel) {
+                   return !same_files.contains(path_to_utf8str(file_rel));
+                 });
+    } else {
+      copy_mod_a(mod_src, staging_dir, unlogged);
+    }
+    mod_src = std::move(staging_dir);
+  }
+  if (new_files.empty()) {
+    new_files = list_mod_files(mod_src);
+  }
+
+  tx_wrapper_([&]() -> auto& {
+    auto mod_ret = m_db.query_mod(mod_id);
+    if (!mod_ret.success) {
+      set_fail(ret, {ERR_MOD_NOT_EXIST, ": ", std::to_string(mod_id).c_str()});
+      return ret;
+    }
+    auto& mod = mod_ret.data;
+    bool installed = mod.status == ModStatus::Installed;
+    auto cfg_mod = m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(mod.dir));
+
+    auto diff = diff_mod_files(mod_src, cfg_mod, std::move(new_files),
+                               m_db.query_mod_file_hashes(mod_id), same_files);
+
+    // stored files replaced in place keep their links
+    std::vector<std::string> outdated{diff.removed};
+    outdated.insert(outdated.end(), diff.changed.begin(), diff.changed.end());
+    std::sort(outdated.begin(), outdated.end());
+    std::vector<std::string> updated{diff.added};
+    updated.insert(updated.end(), diff.changed.begin(), diff.changed.end());
+    std::sort(updated.begin(), updated.end());
+
+    auto unref_blobs = m_db.delete_mod_files(mod_id, outdated);
+
+    std::filesystem::path tar_dir;
+    bool nocase = false;
+    if (installed) {
+      auto tar = m_db.query_target(mod.tar_id).data;
+      tar_dir = utf8str_to_path(tar.dir);
+      nocase = tar.nocase;
+
+      std::vector<std::string> added_files;
+      for (const auto& file_str : diff.added) {
+        if (!std::filesystem::is_directory(mod_src /
+                                           utf8str_to_path(file_str))) {
+          added_files.push_back(file_str);
+        }
+      }
+      // files of this mod in place of removed ones, e.g. a directory turned
+      // into a file, do not conflict
+      m_owners.remove(mod.tar_id, mod_id, views_of(diff.removed));
+      if (!check_conflicts_(ret, mod.tar_id, views_of(added_files))) {
+        return ret;
+      }
+
+      // unlink removed files, and restore their backups, recorded in the
+      // case found in target
+      auto bak_file_strs = m_db.query_backup_files(mod_id);
+      std::vector<std::string> restored;
+      if (nocase) {
+        std::set<std::string> folded_removed;
+        for (const auto& file_str : diff.removed) {
+          folded_removed.insert(ascii_fold(file_str));
+        }
+        std::copy_if(bak_file_strs.begin(), bak_file_strs.end(),
+                     std::back_inserter(restored), [&](const auto& bak_str) {
+                       return folded_removed.contains(ascii_fold(bak_str));
+                     });
+      } else {
+        std::set_intersection(diff.removed.begin(), diff.removed.end(),
+                              bak_file_strs.begin(), bak_file_strs.end(),
+                              std::back_inserter(restored));
+      }
+      m_fs.uninstall_mod(cfg_mod, tar_dir, strs_to_paths(diff.removed),
+                         strs_to_paths(restored), nocase);
+      m_db.delete_backup_files(mod_id, restored);
+    }
+
+    m_fs.remove_mod_files(cfg_mod, strs_to_paths(outdated));
+    m_fs.remove_blobs(unref_blobs);
+    m_fs.copy_mod_files(mod_src, cfg_mod, strs_to_paths(updated));
+    m_db.insert_mod_files(mod_id, updated);
+    hash_mod_files_(mod_id, cfg_mod, updated);
+    record_zip_crcs_(mod_id, zip_crcs);
+
+    if (installed) {
+      // linked as by install_mod, original files in place backed up
+      tar_paths tar{tar_dir, nocase};
+      std::vector<std::string> new_bak_file_strs;
+      for (const auto& file_str : diff.added) {
+        auto file_rel = utf8str_to_path(file_str);
+        auto tar_file = tar_dir / tar.rel(file_rel);
+        if (!std::filesystem::is_directory(cfg_mod / file_rel) &&
+            std::filesystem::is_directory(
+                std::filesystem::symlink_status(tar_file))) {
+          set_fail(ret, {"error: cannot update, directory in place of file: '",
+                         path_to_utf8str(tar_file).c_str(), "'"});
+          return ret;
+        }
+        if (auto bak_file_rel = m_fs.repair_file(cfg_mod, tar, file_rel);
+            !bak_file_rel.empty()) {
+          new_bak_file_strs.push_back(path_to_utf8str(bak_file_rel));
+        }
+      }
+      m_db.insert_backup_files(mod_id, new_bak_file_strs);
+      auto added_views = views_of(diff.added);
+      m_owners.add(mod.tar_id, mod_id, added_views);
+      add_to_bloom_(mod.tar_id, added_views);
+      record_links_(mod_id, tar_dir, nocase, views_of(updated));
+    }
+
+    if (archive_hash.empty()) {
+      m_db.delete_archive(mod_id);
+    } else {
+      m_db.insert_archive(mod_id, archive_hash);
+    }
+    set_succeed(ret);
+    return ret;
+  });
+
+  return ret;
+}
+
+}  // namespace filemod
@@ -1,15 +1,107 @@
+#include <exception>
 #include <filesystem>
+#include <optional>
 #include <string>
+#include <system_error>
+#include <vector>
 
 #include "filemod/fs_archive.hpp"
+#include "filemod/hash.hpp"
 #include "filemod/modder.hpp"
 #include "filemod/utils.hpp"
 
 namespace filemod {
 
+// Whether `cfg_mod` holds exactly `file_hashes`, the recorded files of its
+// mod, w/ the recorded content.
+static bool same_mod_tree(const std::filesystem::path& cfg_mod,
+                          const std::vector<FileHashDto>& file_hashes) {
+  std::error_code ec;
+  size_t count = 0;
+  for (std::filesystem::recursive_directory_iterator it{cfg_mod, ec}, end;
+       !ec && it != end; it.increment(ec)) {
+    ++count;
+  }
+  if (ec || count != file_hashes.size()) {
+    return false;
+  }
+
+  for (const auto& file_hash : file_hashes) {
+    auto cfg_mod_file = cfg_mod / utf8str_to_path(file_hash.dir);
+    auto status = std::filesystem::symlink_status(cfg_mod_file, ec);
+    if (!std::filesystem::exists(status)) {
+      return false;
+    }
+    if (!std::filesystem::is_regular_file(status)) {
+      // directories and symlinks are not hashed
+      continue;
+    }
+    // mods added before hashes were recorded cannot be trusted
+    try {
+      if (file_hash.hash.empty() || hash_file(cfg_mod_file) != file_hash.hash) {
+        return false;
+      }
+    } catch (std::exception&) {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::filesystem::path modder::find_archive_cache_(const std::string& hash) {
+  for (auto& mod : m_db.query_mods_by_archive(hash)) {
+    auto cfg_mod =
+        m_fs.get_cfg_mod(mod.tar_id, utf8str_to_path(std::move(mod.dir)));
+    if (std::filesystem::is_directory(cfg_mod) &&
+        same_mod_tree(cfg_mod, m_db.query_mod_file_hashes(mod.id))) {
+      return cfg_mod;
+    }
+  }
+  return {};
+}
+
 result<int64_t> modder::add_mod_a(int64_t tar_id, const std::string& mod_name,
                                   const std::filesystem::path& path) {
-  return add_mod_(tar_id, mod_name, path, copy_mod_a);
+  if (!std::filesystem::is_regular_file(path)) {
+    // reported by add_mod_
+    return add_mod_(tar_id, mod_name, path, copy_mod_a);
+  }
+
+  result<int64_t> ret;
+  ret.success = true;
+
+  tx_wrapper_([&]() -> auto& {
+    auto hash = hash_file(path);
+
+    // an identical archive was added before, clone its extracted tree instead
+    // of decompressing it again
+    auto cached_mod = find_archive_cache_(hash);
+    auto add_ret = cached_mod.empty()
+                       ? add_mod_(tar_id, mod_name, path, copy_mod_a)
+                       : add_mod_(tar_id, mod_name, cached_mod, copy_mod);
+    if (!add_ret.success) {
+      ret.success = false;
+      ret.msg = std::move(add_ret.msg);
+      return ret;
+    }
+    ret.data = add_ret.data;
+
+    m_db.insert_archive(ret.data, hash);
+    record_zip_crcs_(ret.data, read_zip_crcs(path));
+    return ret;
+  });
+
+  return ret;
+}
+
+void modder::record_zip_crcs_(
+    int64_t mod_id, const std::unordered_map<std::string, zip_crc>& crcs) {
+  std::vector<FileHashDto> file_crcs;
+  file_crcs.reserve(crcs.size());
+  for (const auto& [file_str, crc] : crcs) {
+    file_crcs.push_back({.dir = file_str, .crc = crc.crc});
+  }
+  m_db.update_mod_file_crcs(mod_id, file_crcs);
 }
 
 result<int64_t> modder::add_mod_a(int64_t tar_id,
@@ -18,9 +110,54 @@ result<int64_t> modder::add_mod_a(int64_t tar_id,
   return add_mod_a(tar_id, mod_name, path);
 }
 
+result_base modder::check_archive_conflicts_(
+    int64_t tar_id, const std::filesystem::path& path) {
+  result_base ret{.success = true};
+
+  if (!std::filesystem::exists(path)) {
+    // reported by add_mod_a
+    return ret;
+  }
+
+  std::optional<std::vector<archive_file>> files;
+  try {
+    files = scan_zip(path);
+  } catch (std::exception& ex) {
+    ret.success = false;
+    ((ret.msg = "error: cannot read archive '") += path_to_utf8str(path)) +=
+        "': ";
+    ret.msg += ex.what();
+    return ret;
+  }
+  if (!files) {
+    // scanning other archives decompresses them whole, conflicts are found
+    // once installing the extracted mod instead
+    return ret;
+  }
+
+  std::vector<std::string> mod_file_strs;
+  for (auto& file : *files) {
+    if (!file.is_dir) {
+      mod_file_strs.push_back(path_to_utf8str(file.rel));
+    }
+  }
+  check_conflicts_(ret, tar_id, views_of(mod_file_strs));
+
+  return ret;
+}
+
 result<int64_t> modder::install_path_a(int64_t tar_id,
                                        const std::string& mod_name,
                                        const std::filesystem::path& path) {
+  // reject conflicting archives before extracting any data
+  if (auto check_ret = check_archive_conflicts_(tar_id, path);
+      !check_ret.success) {
+    result<int64_t> ret;
+    ret.success = false;
+    ret.msg = std::move(check_ret.msg);
+    return ret;
+  }
+
   return install_path_(tar_id, mod_name, path, &modder::add_mod_a);
 }
 
@@ -5,12 +5,15 @@
 #include "filemod/sql.hpp"
 
 #include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Exception.h>
 #include <SQLiteCpp/Savepoint.h>
 #include <SQLiteCpp/Statement.h>
 
 #include <algorithm>
 #include <cassert>
+#include <filesystem>
 #include <memory>
+#include <unordered_map>
 #include <unordered_set>
 #include <utility>
 
@@ -35,15 +38,120 @@ static const char CREATE_IX_MOD[] =
     "CREATE INDEX if not exists ix_mod on mod (target_id, dir, status, id)";
 static const char CREATE_IX_MOD_FILES[] =
     "CREATE INDEX if not exists ix_mod_files on mod_files (dir, mod_id)";
+static const char CREATE_T_ARCHIVE[] =
+    "CREATE TABLE if not exists archive (mod_id integer primary key, hash "
+    "text)";
+static const char CREATE_IX_ARCHIVE[] =
+    "CREATE INDEX if not exists ix_archive on archive (hash, mod_id)";
+
+static const char ALTER_MOD_FILES_HASH[] =
+    "ALTER TABLE mod_files ADD COLUMN hash text";
+static const char ALTER_MOD_FILES_BLOB[] =
+    "ALTER TABLE mod_files ADD COLUMN blob integer default 0";
+static const char ALTER_MOD_FILES_LINK_INO[] =
+    "ALTER TABLE mod_files ADD COLUMN link_ino integer";
+static const char ALTER_MOD_FILES_LINK_MTIME[] =
+    "ALTER TABLE mod_files ADD COLUMN link_mtime integer";
+static const char ALTER_MOD_FILES_CRC[] =
+    "ALTER TABLE mod_files ADD COLUMN crc integer";
+static const char CREATE_T_BLOB[] =
+    "CREATE TABLE if not exists blob (hash text primary key, refcount "
+    "integer) without rowid";
+
+static const char ALTER_TARGET_ATOMIC[] =
+    "ALTER TABLE target ADD COLUMN atomic integer default 0";
+static const char ALTER_TARGET_NOCASE[] =
+    "ALTER TABLE target ADD COLUMN nocase integer default 0";
+
+// Trigram index of mod files for `find_files` patterns w/o a literal prefix.
+// FTS5 needs rowids, which mod_files lacks, so file_path numbers its rows and
+// is kept in sync with mod_files by triggers. The index itself is updated in
+// bulk by DB methods changing mod_files, in rowid order: FTS5 flushes on every
+// out-of-order rowid and every statement, so per-row triggers are slow.
+static const char CREATE_T_FILE_PATH[] =
+    "CREATE TABLE if not exists file_path (id integer primary key, mod_id "
+    "integer, dir text)";
+static const char CREATE_IX_FILE_PATH[] =
+    "CREATE UNIQUE INDEX if not exists ix_file_path on file_path (mod_id, dir)";
+static const char CREATE_T_FILE_TRIGRAM[] =
+    "CREATE VIRTUAL TABLE if not exists file_trigram using fts5(dir, "
+    "content='file_path', content_rowid='id', tokenize='trigram')";
+static const char CREATE_TR_MOD_FILES_INSERT[] =
+    "CREATE TRIGGER if not exists tr_mod_files_insert after insert on "
+    "mod_files begin insert into file_path (mod_id, dir) values (new.mod_id, "
+    "new.dir); end";
+static const char CREATE_TR_MOD_FILES_DELETE[] =
+    "CREATE TRIGGER if not exists tr_mod_files_delete after delete on "
+    "mod_files begin delete from file_path where mod_id=old.mod_id and "
+    "dir=old.dir; end";
+static const char FILL_FILE_PATH[] =
+    "insert into file_path (mod_id, dir) select mod_id, dir from mod_files";
+static const char FILL_FILE_TRIGRAM[] =
+    "insert into file_trigram (file_trigram) values ('rebuild')";
+static const char PROBE_TRIGRAM[] =
+    "CREATE VIRTUAL TABLE temp.filemod_probe using fts5(dir, "
+    "tokenize='trigram'); DROP TABLE temp.filemod_probe";
+static const char CREATE_T_TARGET_BLOOM[] =
+    "CREATE TABLE if not exists target_bloom (target_id integer primary key, "
+    "bloom blob)";
+static const char CREATE_T_PROFILE[] =
+    "CREATE TABLE if not exists profile (id integer primary key, target_id "
+    "integer, name text)";
+static const char CREATE_IX_PROFILE[] =
+    "CREATE UNIQUE INDEX if not exists ix_profile on profile (target_id, "
+    "name)";
+static const char CREATE_T_PROFILE_MODS[] =
+    "CREATE TABLE if not exists profile_mods (profile_id integer, mod_id "
+    "integer, primary key (profile_id, mod_id)) without rowid";
+static const char CREATE_IX_PROFILE_MODS[] =
+    "CREATE INDEX if not exists ix_profile_mods on profile_mods (mod_id)";
+
+// Schema changes after 0.0.3, `PRAGMA user_version` is the number of applied
+// ones. Append new changes to the end.
+static const std::vector<std::vector<const char *>> SCHEMA_UPGRADES{
+    {CREATE_T_ARCHIVE, CREATE_IX_ARCHIVE},
+    {ALTER_MOD_FILES_HASH, ALTER_MOD_FILES_BLOB, CREATE_T_BLOB},
+    {ALTER_MOD_FILES_LINK_INO, ALTER_MOD_FILES_LINK_MTIME},
+    {CREATE_T_PROFILE, CREATE_IX_PROFILE, CREATE_T_PROFILE_MODS,
+     CREATE_IX_PROFILE_MODS},
+    {ALTER_TARGET_ATOMIC},
+    {CREATE_T_TARGET_BLOOM},
+    {ALTER_TARGET_NOCASE},
+    {CREATE_T_FILE_PATH, CREATE_IX_FILE_PATH, CREATE_T_FILE_TRIGRAM,
+     FILL_FILE_PATH, FILL_FILE_TRIGRAM, CREATE_TR_MOD_FILES_INSERT,
+     CREATE_TR_MOD_FILES_DELETE},
+    {ALTER_MOD_FILES_CRC},
+};
+// upgrade skipped if SQLite lacks FTS5 or its trigram tokenizer
+constexpr size_t TRIGRAM_UPGRADE = 7;
+
+// readers of a database in WAL mode do not block its writer, nor the reverse
+static const char SET_JOURNAL_WAL[] = "PRAGMA journal_mode=WAL";
+// waited out for other connections, e.g. while one checkpoints the WAL
+constexpr int BUSY_TIMEOUT_MS = 5000;
 
+static const char QUERY_DATA_VERSION[] = "PRAGMA data_version";
+static const char QUERY_TARGETS[] = "select * from target";
 static const char QUERY_TARGET[] = "select * from target where id=?";
 static const char QUERY_TARGET_BY_DIR[] = "select * from target where dir=?";
 static const char INSERT_TARGET[] = "insert into target (dir) values (?)";
 static const char DELETE_TARGET[] = "delete from target where id=?";
+static const char UPDATE_TARGET_ATOMIC[] =
+    "update target set atomic=? where id=?";
+static const char UPDATE_TARGET_NOCASE[] =
+    "update target set nocase=? where id=?";
+static const char QUERY_TARGET_BLOOM[] =
+    "select bloom from target_bloom where target_id=?";
+static const char UPSERT_TARGET_BLOOM[] =
+    "insert or replace into target_bloom (target_id, bloom) values (?,?)";
+static const char DELETE_TARGET_BLOOM[] =
+    "delete from target_bloom where target_id=?";
 
 static const char QUERY_MODS[] = "select * from mod";
 static const char QUERY_MODS_BY_TARGEDID[] =
     "select * from mod where target_id=?";
+static const char QUERY_MODS_BY_TARGEDID_ORDERED[] =
+    "select * from mod where target_id=? order by id";
 static const char QUERY_MOD_BY_TARGEDID_DIR[] =
     "select * from mod where target_id=? and dir=?";
 static const char INSERT_MOD[] =
@@ -54,13 +162,110 @@ static const char UPDATE_MOD_STATUS[] = "update mod set status=? where id=?";
 static const char QUERY_MODS_CONTAIN_FILES[] =
     "select m.id, m.target_id, m.dir, m.status from mod_files mf inner join "
     "mod m on m.id = mf.mod_id";
-static const char INSERT_MOD_FILES[] = "insert into mod_files values (?,?)";
+// ?1 and ?2 bound a range of ix_mod_files, ?3 is the pattern, ?4 the target
+// and ?5 the least status. Cross joins keep the file index driving the query,
+// `+` keeps ix_mod out of it.
+static const char FIND_FILES_BY_PREFIX[] =
+    "select mf.dir, m.id from mod_files mf cross join mod m on m.id = "
+    "mf.mod_id where mf.dir >= ?1 and mf.dir < ?2 and mf.dir glob ?3 and "
+    "+m.target_id=?4 and m.status>=?5 order by mf.dir, m.id";
+static const char FIND_FILES_BY_TRIGRAM[] =
+    "select p.dir, m.id from file_trigram t cross join file_path p on p.id = "
+    "t.rowid cross join mod m on m.id = p.mod_id where t.dir glob ?3 and "
+    "+m.target_id=?4 and m.status>=?5 order by p.dir, m.id";
+static const char FIND_FILES_BY_SCAN[] =
+    "select mf.dir, m.id from mod_files mf cross join mod m on m.id = "
+    "mf.mod_id where mf.dir glob ?3 and +m.target_id=?4 and m.status>=?5 "
+    "order by mf.dir, m.id";
+static const char QUERY_INSTALLED_FILES[] =
+    "select mf.dir, m.id from mod m inner join mod_files mf on mf.mod_id = "
+    "m.id where m.target_id=? and m.status=1";
+static const char INSERT_MOD_FILES[] =
+    "insert into mod_files (mod_id, dir) values (?,?)";
+static const char QUERY_MOD_FILE_HASHES[] =
+    "select dir, hash, blob, crc from mod_files where mod_id=? order by dir";
+static const char UPDATE_MOD_FILE_CRC[] =
+    "update mod_files set crc=? where mod_id=? and dir=?";
+static const char UPDATE_MOD_FILE_HASH[] =
+    "update mod_files set hash=?, blob=? where mod_id=? and dir=?";
 static const char DELETE_MOD_FILES[] = "delete from mod_files where mod_id=?";
+static const char DELETE_MOD_FILE[] =
+    "delete from mod_files where mod_id=? and dir=?";
+static const char QUERY_MAX_FILE_PATH_ID[] =
+    "select coalesce(max(id), 0) from file_path";
+static const char INDEX_FILE_TRIGRAMS[] =
+    "insert into file_trigram (rowid, dir) select id, dir from file_path "
+    "where id>? order by id";
+static const char UNINDEX_MOD_TRIGRAMS[] =
+    "insert into file_trigram (file_trigram, rowid, dir) select 'delete', id, "
+    "dir from file_path where mod_id=? order by id";
+static const char UNINDEX_FILE_TRIGRAM[] =
+    "insert into file_trigram (file_trigram, rowid, dir) select 'delete', id, "
+    "dir from file_path where mod_id=? and dir=?";
 
 static const char INSERT_BACKUP_FILES[] =
     "insert into backup_files values (?,?)";
 static const char DELETE_BACKUP_FILES[] =
     "delete from backup_files where mod_id=?";
+static const char DELETE_BACKUP_FILE[] =
+    "delete from backup_files where mod_id=? and dir=?";
+
+static const char QUERY_MODS_BY_ARCHIVE[] =
+    "select m.id, m.target_id, m.dir, m.status from archive a inner join mod "
+    "m on m.id = a.mod_id where a.hash=? order by m.id";
+static const char INSERT_ARCHIVE[] =
+    "insert or replace into archive (mod_id, hash) values (?,?)";
+static const char DELETE_ARCHIVE[] = "delete from archive where mod_id=?";
+
+static const char UPDATE_LINK_META[] =
+    "update mod_files set link_ino=?, link_mtime=? where mod_id=? and dir=?";
+static const char CLEAR_LINK_METAS[] =
+    "update mod_files set link_ino=null, link_mtime=null where mod_id=?";
+static const char QUERY_LINK_METAS[] =
+    "select dir, link_ino, link_mtime from mod_files where mod_id=? order by "
+    "dir";
+static const char QUERY_BACKUP_FILES[] =
+    "select dir from backup_files where mod_id=? order by dir";
+static const char QUERY_FILES_OF_MOD[] =
+    "select dir from mod_files where mod_id=? order by dir";
+
+static const char ACQUIRE_BLOB[] =
+    "insert into blob (hash, refcount) values (?,1) on conflict (hash) do "
+    "update set refcount=refcount+1";
+// a mod takes one reference for each of its linked files
+static const char RELEASE_MOD_BLOBS[] =
+    "update blob set refcount=refcount-(select count(*) from mod_files where "
+    "mod_id=?1 and blob=1 and hash=blob.hash) where hash in (select hash from "
+    "mod_files where mod_id=?1 and blob=1)";
+static const char RELEASE_MOD_FILE_BLOB[] =
+    "update blob set refcount=refcount-1 where hash=(select hash from "
+    "mod_files where mod_id=? and dir=? and blob=1)";
+static const char QUERY_UNREF_BLOBS[] =
+    "select hash from blob where refcount<=0";
+static const char DELETE_UNREF_BLOBS[] = "delete from blob where refcount<=0";
+
+static const char QUERY_PROFILE_BY_TARGETID_NAME[] =
+    "select id, target_id, name from profile where target_id=? and name=?";
+static const char QUERY_PROFILES_BY_TARGETID[] =
+    "select p.id, p.target_id, p.name, pm.mod_id from profile p left join "
+    "profile_mods pm on pm.profile_id = p.id where p.target_id=? order by "
+    "p.name, pm.mod_id";
+static const char QUERY_PROFILE_MODS[] =
+    "select mod_id from profile_mods where profile_id=? order by mod_id";
+static const char INSERT_PROFILE[] =
+    "insert into profile (target_id, name) values (?,?)";
+static const char INSERT_PROFILE_MOD[] =
+    "insert or ignore into profile_mods (profile_id, mod_id) values (?,?)";
+static const char DELETE_PROFILE[] = "delete from profile where id=?";
+static const char DELETE_PROFILE_MODS[] =
+    "delete from profile_mods where profile_id=?";
+static const char DELETE_MOD_FROM_PROFILES[] =
+    "delete from profile_mods where mod_id=?";
+static const char DELETE_TARGET_PROFILE_MODS[] =
+    "delete from profile_mods where profile_id in (select id from profile "
+    "where target_id=?)";
+static const char DELETE_TARGET_PROFILES[] =
+    "delete from profile where target_id=?";
 
 static const char QUERY_MOD_FILES[] = "select mod_id, dir from mod_files";
 static const char QUERY_MOD_BACKUP_FILES[] =
@@ -98,6 +303,28 @@ static constexpr std::string buildstr_query_mods(size_t sz) {
   return str;
 }
 
+static const std::string QUERY_MOD = buildstr_query_mods(1);
+
+// `base` of `size` ids of `id_col` if any, ordered by it, w/ trailing limit and
+// offset parameters.
+static std::string buildstr_query_page(const char *base, const char *id_col,
+                                       size_t size) {
+  std::string str{base};
+  if (size) {
+    str += " where ";
+    str += id_col;
+    str += " in (";
+    for (size_t i = 0; i < size - 1; ++i) {
+      str += "?,";
+    }
+    str += "?)";
+  }
+  str += " order by ";
+  str += id_col;
+  str += " limit ? offset ?";
+  return str;
+}
+
 static constexpr std::string buildstr_query_mod_files(const char *base,
                                                       size_t sz) {
   std::string str{base};
@@ -112,14 +339,6 @@ static constexpr std::string buildstr_query_mod_files(const char *base,
   return str;
 }
 
-static constexpr std::string buildstr_insert_mod_files(size_t size) {
-  std::string str{INSERT_MOD_FILES};
-  for (size_t i = 0; i < size - 1; ++i) {
-    str += ",(?,?)";
-  }
-  return str;
-}
-
 static constexpr std::string buildstr_insert_backup_files(size_t size) {
   std::string str{INSERT_BACKUP_FILES};
   for (size_t i = 0; i < size - 1; ++i) {
@@ -162,7 +381,41 @@ static void push_uniq_mod(std::vector<ModDto> &mods,
   }
 }
 
+static size_t schema_version(SQLite::Database &db) {
+  SQLite::Statement stmt{db, "PRAGMA user_version"};
+  return stmt.executeStep() ? stmt.getColumn(0).getInt() : 0;
+}
+
+static bool has_trigram(SQLite::Database &db) {
+  try {
+    db.exec(PROBE_TRIGRAM);
+    return true;
+  } catch (const SQLite::Exception &) {
+    return false;
+  }
+}
+
+static void upgrade_db(SQLite::Database &db) {
+  size_t version = schema_version(db);
+  if (version >= SCHEMA_UPGRADES.size()) {
+    return;
+  }
+
+  SQLite::Savepoint tx{db, FILEMOD};
+  for (; version < SCHEMA_UPGRADES.size(); ++version) {
+    if (TRIGRAM_UPGRADE == version && !has_trigram(db)) {
+      continue;
+    }
+    for (auto sql : SCHEMA_UPGRADES[version]) {
+      db.exec(sql);
+    }
+  }
+  db.exec("PRAGMA user_version=" + std::to_string(version));
+  tx.release();
+}
+
 static void init_db(SQLite::Database &db) {
+  db.exec(SET_JOURNAL_WAL);
   if (!db.tableExists("target")) {
     db.exec(CREATE_T_TARGET);
     db.exec(CREATE_T_MOD);
@@ -172,10 +425,45 @@ static void init_db(SQLite::Database &db) {
     db.exec(CREATE_IX_MOD);
     db.exec(CREATE_IX_MOD_FILES);
   }
+  upgrade_db(db);
 }
 
+// Statement cached by `DB::db_wrap`, reset when released so that it does not
+// keep a read open between calls.
+class cached_stmt {
+ public:
+  explicit cached_stmt(SQLite::Statement &stmt) noexcept : m_stmt{stmt} {}
+
+  cached_stmt(const cached_stmt &) = delete;
+
+  ~cached_stmt() {
+    m_stmt.tryReset();
+    m_stmt.clearBindings();
+  }
+
+  SQLite::Statement &operator*() noexcept { return m_stmt; }
+
+  SQLite::Statement *operator->() noexcept { return &m_stmt; }
+
+ private:
+  SQLite::Statement &m_stmt;
+};
+
 struct DB::db_wrap {
   SQLite::Database db;
+  // statements of constant SQL strings prepared once, by address of the SQL,
+  // destroyed before `db`
+  std::unordered_map<const char *, SQLite::Statement> stmts{};
+  // whether file_trigram exists, see `TRIGRAM_UPGRADE`
+  bool trigram = false;
+
+  cached_stmt cached(const char *sql) {
+    auto it = stmts.find(sql);
+    if (it == stmts.end()) {
+      it = stmts.emplace(sql, SQLite::Statement{db, sql}).first;
+    }
+    return cached_stmt{it->second};
+  }
 };
 
 struct DB::sp_wrap::impl {
@@ -190,10 +478,23 @@ void DB::sp_wrap::release() { m_impl->sp.release(); }
 
 void DB::sp_wrap::rollback() { m_impl->sp.rollback(); }
 
-DB::DB(const std::string &path)
-    : m_dr{std::make_unique<db_wrap>(SQLite::Database(
-          path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE))} {
-  init_db(m_dr->db);
+DB::DB(const std::string &path, bool read_only) {
+  if (read_only && std::filesystem::exists(utf8str_to_path(path))) {
+    SQLite::Database db{path, SQLite::OPEN_READONLY, BUSY_TIMEOUT_MS};
+    if (db.tableExists("target") &&
+        schema_version(db) >= SCHEMA_UPGRADES.size()) {
+      m_dr = std::make_unique<db_wrap>(std::move(db));
+      m_dr->trigram = m_dr->db.tableExists("file_trigram");
+      return;
+    }
+  }
+
+  // a missing or outdated database is created or upgraded even if read only
+  SQLite::Database db{path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE,
+                      BUSY_TIMEOUT_MS};
+  init_db(db);
+  m_dr = std::make_unique<db_wrap>(std::move(db));
+  m_dr->trigram = m_dr->db.tableExists("file_trigram");
 }
 
 DB::~DB() = default;
@@ -205,6 +506,12 @@ DB::sp_wrap DB::begin() {
       new sp_wrap::impl{.sp = SQLite::Savepoint{m_dr->db, FILEMOD}}});
 }
 
+int64_t DB::data_version() {
+  auto stmt = m_dr->cached(QUERY_DATA_VERSION);
+  stmt->executeStep();
+  return stmt->getColumn(0).getInt64();
+}
+
 std::vector<TargetDto> DB::query_targets_mods(const std::vector<int64_t> &ids) {
   SQLite::Statement stmt{m_dr->db, buildstr_query_targets_mods(ids.size())};
   for (size_t i = 0; i < ids.size(); ++i) {
@@ -234,130 +541,197 @@ std::vector<TargetDto> DB::query_targets_mods(const std::vector<int64_t> &ids) {
   return tars;
 }
 
-[[nodiscard]] static std::vector<std::pair<int64_t, std::string>>
-query_mod_files(SQLite::Database &db, const std::vector<int64_t> &ids,
-                const char *buildstr) {
-  SQLite::Statement stmt{db, buildstr};
-  for (size_t i = 0; i < ids.size(); ++i) {
-    stmt.bind(i + 1, ids[i]);
-  }
-
-  std::vector<std::pair<int64_t, std::string>> ret;
-  while (stmt.executeStep()) {  // ordered by mod_id
-    ret.emplace_back(stmt.getColumn(0).getInt64(), stmt.getColumn(1).getText());
-  }
-  return ret;
-}
-
-using get_mod_file_ref = std::vector<std::string> &(*)(ModDto &);
-
-// This function assumes mods, mod_files are ordered by mod_id,
-// and mods.size() >= unique mod_ids in mod_files.
-static void push_files_to_mods(
-    std::vector<std::pair<int64_t, std::string>> &&mod_files,
-    std::vector<ModDto> &mods, get_mod_file_ref get_ref) {
-  for (size_t lower_bound = 0, upper_bound = 1, mod_index = 0;
-       lower_bound < mod_files.size(); lower_bound = upper_bound++) {
-    int64_t mod_id = mod_files[lower_bound].first;
-
-    // calculate range in mod_files with the same mod_id
-    for (; upper_bound < mod_files.size(); ++upper_bound) {
-      if (mod_files[upper_bound].first != mod_id) {
-        break;
-      }
-    }
-    // range is [lower_bound, upper_bound)
-
-    // get mod file container reference, caller specify, either mod.files or
-    // mod.bak_files
+// Push files of `stmt` ordered by mod_id to `paths`, and the range of those of
+// each of `mods` ordered by id to `ranges`.
+static void push_files_to_arena(
+    SQLite::Statement &stmt, const std::vector<ModViewDto> &mods,
+    string_arena &paths, std::vector<std::pair<size_t, size_t>> &ranges) {
+  ranges.assign(mods.size(), {0, 0});
+  int64_t last_mod_id = 0;
+  size_t mod_index = 0;
+  while (stmt.executeStep()) {
+    int64_t mod_id = stmt.getColumn(0).getInt64();
     while (mods[mod_index].id < mod_id) {
       ++mod_index;
     }
     assert(mods[mod_index].id == mod_id);
-    auto &cont_ref = get_ref(mods[mod_index]);
-    cont_ref.reserve(cont_ref.size() + upper_bound - lower_bound);
-
-    // push files to mod
-    for (size_t i = lower_bound; i < upper_bound; ++i) {
-      cont_ref.push_back(std::move(mod_files[i].second));
+    if (mod_id != last_mod_id) {
+      ranges[mod_index].first = paths.size();
+      last_mod_id = mod_id;
     }
+
+    auto dir = stmt.getColumn(1);
+    paths.push_back({dir.getText(), static_cast<size_t>(dir.getBytes())});
+    ranges[mod_index].second = paths.size();
   }
 }
 
 std::vector<ModDto> DB::query_mods_w_files(const std::vector<int64_t> &ids) {
+  auto views = query_mod_views(ids);
+  std::vector<ModDto> mods;
+  mods.reserve(views.mods.size());
+  for (auto &mod : views.mods) {
+    mods.push_back({.id = mod.id,
+                    .tar_id = mod.tar_id,
+                    .dir = std::move(mod.dir),
+                    .status = mod.status,
+                    .files = {mod.files.begin(), mod.files.end()},
+                    .bak_files = {mod.bak_files.begin(), mod.bak_files.end()}});
+  }
+  return mods;
+}
+
+ModViewsDto DB::query_mod_views(const std::vector<int64_t> &ids) {
   SQLite::Savepoint tx{m_dr->db, FILEMOD};
 
   // get mods
-  std::vector<ModDto> mods;
+  ModViewsDto views;
   SQLite::Statement stmt{m_dr->db, buildstr_query_mods(ids.size())};
   for (size_t i = 0; i < ids.size(); ++i) {
     stmt.bind(i + 1, ids[i]);
   }
   while (stmt.executeStep()) {  // ordered by mod.id
-    mods.push_back(mod_from_stmt(stmt));
+    auto mod = mod_from_stmt(stmt);
+    views.mods.push_back({.id = mod.id,
+                          .tar_id = mod.tar_id,
+                          .dir = std::move(mod.dir),
+                          .status = mod.status});
   }
 
-  // get mod_files
-  auto mod_files = query_mod_files(
-      m_dr->db, ids,
-      buildstr_query_mod_files(QUERY_MOD_FILES, ids.size()).c_str());
-  push_files_to_mods(std::move(mod_files), mods,
-                     [](ModDto &mod) -> auto & { return mod.files; });
-
-  // get backup_files
-  auto bak_files = query_mod_files(
-      m_dr->db, ids,
-      buildstr_query_mod_files(QUERY_MOD_BACKUP_FILES, ids.size()).c_str());
-  push_files_to_mods(std::move(bak_files), mods,
-                     [](ModDto &mod) -> auto & { return mod.bak_files; });
+  // get mod_files and backup_files, spans are taken once the arena stops
+  // growing
+  std::vector<std::pair<size_t, size_t>> file_ranges;
+  std::vector<std::pair<size_t, size_t>> bak_ranges;
+  for (auto [base, ranges] :
+       {std::pair{QUERY_MOD_FILES, &file_ranges},
+        std::pair{QUERY_MOD_BACKUP_FILES, &bak_ranges}}) {
+    SQLite::Statement files_stmt{m_dr->db,
+                                 buildstr_query_mod_files(base, ids.size())};
+    for (size_t i = 0; i < ids.size(); ++i) {
+      files_stmt.bind(i + 1, ids[i]);
+    }
+    push_files_to_arena(files_stmt, views.mods, views.paths, *ranges);
+  }
+  for (size_t i = 0; i < views.mods.size(); ++i) {
+    views.mods[i].files =
+        views.paths.views(file_ranges[i].first, file_ranges[i].second);
+    views.mods[i].bak_files =
+        views.paths.views(bak_ranges[i].first, bak_ranges[i].second);
+  }
 
   tx.release();
-  return mods;
+  return views;
+}
+
+static void bind_page(SQLite::Statement &stmt, const std::vector<int64_t> &ids,
+                      int64_t limit, int64_t offset) {
+  int index = 1;
+  for (auto id : ids) {
+    stmt.bind(index++, id);
+  }
+  stmt.bind(index++, limit < 0 ? -1 : limit);
+  stmt.bind(index, offset < 0 ? 0 : offset);
+}
+
+void DB::for_each_target(const std::vector<int64_t> &ids, int64_t limit,
+                         int64_t offset,
+                         const std::function<void(const TargetDto &)> &func) {
+  SQLite::Statement stmt{m_dr->db,
+                         buildstr_query_page(QUERY_TARGETS, "id", ids.size())};
+  bind_page(stmt, ids, limit, offset);
+  while (stmt.executeStep()) {
+    func({.id = stmt.getColumn(0).getInt64(),
+          .dir = stmt.getColumn(1).getString(),
+          .atomic = stmt.getColumn(2).getInt() != 0,
+          .nocase = stmt.getColumn(3).getInt() != 0});
+  }
+}
+
+void DB::for_each_mod(const std::vector<int64_t> &ids, int64_t limit,
+                      int64_t offset,
+                      const std::function<void(const ModDto &)> &func) {
+  SQLite::Statement stmt{m_dr->db,
+                         buildstr_query_page(QUERY_MODS, "id", ids.size())};
+  bind_page(stmt, ids, limit, offset);
+  while (stmt.executeStep()) {
+    func(mod_from_stmt(stmt));
+  }
+}
+
+void DB::for_each_mod_of_target(
+    int64_t tar_id, const std::function<void(const ModDto &)> &func) {
+  auto stmt = m_dr->cached(QUERY_MODS_BY_TARGEDID_ORDERED);
+  stmt->bind(1, tar_id);
+  while (stmt->executeStep()) {
+    func(mod_from_stmt(*stmt));
+  }
+}
+
+void DB::for_each_mod_file(
+    int64_t mod_id, const std::function<void(const std::string &)> &func) {
+  auto stmt = m_dr->cached(QUERY_FILES_OF_MOD);
+  stmt->bind(1, mod_id);
+  while (stmt->executeStep()) {
+    func(stmt->getColumn(0).getString());
+  }
+}
+
+void DB::for_each_backup_file(
+    int64_t mod_id, const std::function<void(const std::string &)> &func) {
+  auto stmt = m_dr->cached(QUERY_BACKUP_FILES);
+  stmt->bind(1, mod_id);
+  while (stmt->executeStep()) {
+    func(stmt->getColumn(0).getString());
+  }
 }
 
 result<TargetDto> DB::query_target(int64_t id) {
-  SQLite::Statement stmt{m_dr->db, QUERY_TARGET};
-  stmt.bind(1, id);
+  auto stmt = m_dr->cached(QUERY_TARGET);
+  stmt->bind(1, id);
   result<TargetDto> ret{{.success = false}};
-  if (stmt.executeStep()) {
+  if (stmt->executeStep()) {
     ret.success = true;
-    ret.data = {.id = stmt.getColumn(0).getInt64(),
-                .dir = stmt.getColumn(1).getString()};
+    ret.data = {.id = stmt->getColumn(0).getInt64(),
+                .dir = stmt->getColumn(1).getString(),
+                .atomic = stmt->getColumn(2).getInt() != 0,
+                .nocase = stmt->getColumn(3).getInt() != 0};
   }
   return ret;
 }
 
 result<TargetDto> DB::query_target_by_dir(const std::string &dir) {
-  SQLite::Statement stmt{m_dr->db, QUERY_TARGET_BY_DIR};
-  stmt.bind(1, dir);
+  auto stmt = m_dr->cached(QUERY_TARGET_BY_DIR);
+  stmt->bind(1, dir);
   result<TargetDto> ret{{.success = false}};
-  if (stmt.executeStep()) {
+  if (stmt->executeStep()) {
     ret.success = true;
-    ret.data = {.id = stmt.getColumn(0).getInt64(),
-                .dir = stmt.getColumn(1).getString()};
+    ret.data = {.id = stmt->getColumn(0).getInt64(),
+                .dir = stmt->getColumn(1).getString(),
+                .atomic = stmt->getColumn(2).getInt() != 0,
+                .nocase = stmt->getColumn(3).getInt() != 0};
   }
   return ret;
 }
 
 std::vector<ModDto> DB::query_mods_by_target(int64_t tar_id) {
-  SQLite::Statement stmt{m_dr->db, QUERY_MODS_BY_TARGEDID};
-  stmt.bind(1, tar_id);
+  auto stmt = m_dr->cached(QUERY_MODS_BY_TARGEDID);
+  stmt->bind(1, tar_id);
   std::vector<ModDto> dtos;
-  while (stmt.executeStep()) {
-    dtos.push_back(mod_from_stmt(stmt));
+  while (stmt->executeStep()) {
+    dtos.push_back(mod_from_stmt(*stmt));
   }
   return dtos;
 }
 
 result<ModDto> DB::query_mod_by_targetid_dir(int64_t tar_id,
                                              const std::string &dir) {
-  SQLite::Statement stmt{m_dr->db, QUERY_MOD_BY_TARGEDID_DIR};
-  stmt.bind(1, tar_id);
-  stmt.bindNoCopy(2, dir);
+  auto stmt = m_dr->cached(QUERY_MOD_BY_TARGEDID_DIR);
+  stmt->bind(1, tar_id);
+  stmt->bindNoCopy(2, dir);
   result<ModDto> ret{{.success = false}};
-  if (stmt.executeStep()) {
+  if (stmt->executeStep()) {
     ret.success = true;
-    ret.data = mod_from_stmt(stmt);
+    ret.data = mod_from_stmt(*stmt);
   }
   return ret;
 }
@@ -372,8 +746,61 @@ int64_t DB::insert_target(const std::string &dir) {
 }
 
 int DB::delete_target(int64_t id) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+
+  for (auto sql : {DELETE_TARGET_PROFILE_MODS, DELETE_TARGET_PROFILES,
+                   DELETE_TARGET_BLOOM}) {
+    SQLite::Statement stmt{m_dr->db, sql};
+    stmt.bind(1, id);
+    stmt.exec();
+  }
+
   SQLite::Statement stmt{m_dr->db, DELETE_TARGET};
   stmt.bind(1, id);
+  int cnt = stmt.exec();
+
+  tx.release();
+  return cnt;
+}
+
+int DB::update_target_atomic(int64_t id, bool atomic) {
+  SQLite::Statement stmt{m_dr->db, UPDATE_TARGET_ATOMIC};
+  stmt.bind(1, static_cast<int>(atomic));
+  stmt.bind(2, id);
+  return stmt.exec();
+}
+
+int DB::update_target_nocase(int64_t id, bool nocase) {
+  SQLite::Statement stmt{m_dr->db, UPDATE_TARGET_NOCASE};
+  stmt.bind(1, static_cast<int>(nocase));
+  stmt.bind(2, id);
+  return stmt.exec();
+}
+
+result<std::vector<unsigned char>> DB::query_target_bloom(int64_t tar_id) {
+  auto stmt = m_dr->cached(QUERY_TARGET_BLOOM);
+  stmt->bind(1, tar_id);
+  result<std::vector<unsigned char>> ret{{.success = false}};
+  if (stmt->executeStep()) {
+    ret.success = true;
+    auto column = stmt->getColumn(0);
+    auto data = static_cast<const unsigned char *>(column.getBlob());
+    ret.data.assign(data, data + column.getBytes());
+  }
+  return ret;
+}
+
+void DB::update_target_bloom(int64_t tar_id,
+                             const std::vector<unsigned char> &bloom) {
+  SQLite::Statement stmt{m_dr->db, UPSERT_TARGET_BLOOM};
+  stmt.bind(1, tar_id);
+  stmt.bindNoCopy(2, bloom.data(), static_cast<int>(bloom.size()));
+  stmt.exec();
+}
+
+int DB::delete_target_bloom(int64_t tar_id) {
+  SQLite::Statement stmt{m_dr->db, DELETE_TARGET_BLOOM};
+  stmt.bind(1, tar_id);
   return stmt.exec();
 }
 
@@ -397,12 +824,12 @@ result_base DB::delete_target_all(int64_t id) {
 }
 
 result<ModDto> DB::query_mod(int64_t id) {
-  SQLite::Statement stmt{m_dr->db, buildstr_query_mods(1)};
-  stmt.bind(1, id);
+  auto stmt = m_dr->cached(QUERY_MOD.c_str());
+  stmt->bind(1, id);
   result<ModDto> ret{{.success = false}};
-  if (stmt.executeStep()) {
+  if (stmt->executeStep()) {
     ret.success = true;
-    ret.data = mod_from_stmt(stmt);
+    ret.data = mod_from_stmt(*stmt);
   }
   return ret;
 }
@@ -441,6 +868,11 @@ int DB::delete_mod(int64_t id) {
   SQLite::Savepoint tx{m_dr->db, FILEMOD};
 
   delete_mod_files_(id);
+  delete_archive(id);
+
+  SQLite::Statement profile_stmt{m_dr->db, DELETE_MOD_FROM_PROFILES};
+  profile_stmt.bind(1, id);
+  profile_stmt.exec();
 
   SQLite::Statement stmt{m_dr->db, DELETE_MOD};
   stmt.bind(1, id);
@@ -450,6 +882,83 @@ int DB::delete_mod(int64_t id) {
   return cnt;
 }
 
+std::vector<std::pair<std::string, int64_t>> DB::query_installed_files(
+    int64_t tar_id) {
+  auto stmt = m_dr->cached(QUERY_INSTALLED_FILES);
+  stmt->bind(1, tar_id);
+  std::vector<std::pair<std::string, int64_t>> files;
+  while (stmt->executeStep()) {
+    files.emplace_back(stmt->getColumn(0).getString(),
+                       stmt->getColumn(1).getInt64());
+  }
+  return files;
+}
+
+static bool is_glob_meta(char c) { return '*' == c || '?' == c || '[' == c; }
+
+// Least string greater than all strings starting w/ `prefix`, empty if none.
+static std::string prefix_upper_bound(std::string prefix) {
+  while (!prefix.empty()) {
+    auto &last = reinterpret_cast<unsigned char &>(prefix.back());
+    if (last < 0xff) {
+      ++last;
+      return prefix;
+    }
+    prefix.pop_back();
+  }
+  return prefix;
+}
+
+// Length of the longest run of literal characters in GLOB `pattern`.
+static size_t longest_literal(const std::string &pattern) {
+  size_t longest = 0;
+  size_t run = 0;
+  bool in_class = false;
+  for (auto c : pattern) {
+    if (in_class) {
+      in_class = ']' != c;
+    } else if (is_glob_meta(c)) {
+      in_class = '[' == c;
+      run = 0;
+    } else {
+      longest = std::max(longest, ++run);
+    }
+  }
+  return longest;
+}
+
+std::vector<std::pair<std::string, int64_t>> DB::find_files(
+    int64_t tar_id, const std::string &pattern, bool installed) {
+  auto prefix = pattern.substr(
+      0, std::find_if(pattern.begin(), pattern.end(), is_glob_meta) -
+             pattern.begin());
+  auto upper = prefix_upper_bound(prefix);
+
+  // trigrams need 3 literal characters
+  const char *sql = FIND_FILES_BY_SCAN;
+  if (!upper.empty()) {
+    sql = FIND_FILES_BY_PREFIX;
+  } else if (longest_literal(pattern) >= 3 && m_dr->trigram) {
+    sql = FIND_FILES_BY_TRIGRAM;
+  }
+
+  auto stmt = m_dr->cached(sql);
+  if (FIND_FILES_BY_PREFIX == sql) {
+    stmt->bind(1, prefix);
+    stmt->bind(2, upper);
+  }
+  stmt->bind(3, pattern);
+  stmt->bind(4, tar_id);
+  stmt->bind(5, static_cast<int>(installed ? ModStatus::Installed
+                                           : ModStatus::Uninstalled));
+  std::vector<std::pair<std::string, int64_t>> files;
+  while (stmt->executeStep()) {
+    files.emplace_back(stmt->getColumn(0).getString(),
+                       stmt->getColumn(1).getInt64());
+  }
+  return files;
+}
+
 std::vector<ModDto> DB::query_mods_contain_files(
     const std::vector<std::string> &files) {
   std::vector<ModDto> mods;
@@ -474,21 +983,78 @@ std::vector<ModDto> DB::query_mods_contain_files(
 
 int DB::insert_mod_files_(int64_t mod_id,
                           const std::vector<std::string> &files) {
-  if (files.empty()) {
-    return 0;
+  // one row per statement, a multi-row insert of a large mod exceeds the
+  // host parameter limit
+  int64_t last_id = 0;
+  if (m_dr->trigram) {
+    auto max_stmt = m_dr->cached(QUERY_MAX_FILE_PATH_ID);
+    max_stmt->executeStep();
+    last_id = max_stmt->getColumn(0).getInt64();
   }
 
-  SQLite::Statement stmt{m_dr->db, buildstr_insert_mod_files(files.size())};
-  int i = 0;
+  SQLite::Statement stmt{m_dr->db, INSERT_MOD_FILES};
+  int cnt = 0;
   for (const auto &dir : files) {
-    stmt.bind(++i, mod_id);
-    stmt.bindNoCopy(++i, dir);
+    stmt.bind(1, mod_id);
+    stmt.bindNoCopy(2, dir);
+    cnt += stmt.exec();
+    stmt.reset();
   }
 
-  return stmt.exec();
+  // rows added by the trigger are numbered after `last_id`
+  if (m_dr->trigram && cnt) {
+    auto index_stmt = m_dr->cached(INDEX_FILE_TRIGRAMS);
+    index_stmt->bind(1, last_id);
+    index_stmt->exec();
+  }
+  return cnt;
+}
+
+int DB::insert_mod_files(int64_t mod_id,
+                         const std::vector<std::string> &files) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  int cnt = insert_mod_files_(mod_id, files);
+  tx.release();
+  return cnt;
+}
+
+std::vector<std::string> DB::delete_mod_files(
+    int64_t mod_id, const std::vector<std::string> &files) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  SQLite::Statement release_stmt{m_dr->db, RELEASE_MOD_FILE_BLOB};
+  SQLite::Statement stmt{m_dr->db, DELETE_MOD_FILE};
+
+  for (const auto &dir : files) {
+    release_stmt.bind(1, mod_id);
+    release_stmt.bindNoCopy(2, dir);
+    release_stmt.exec();
+    release_stmt.reset();
+
+    if (m_dr->trigram) {
+      auto unindex_stmt = m_dr->cached(UNINDEX_FILE_TRIGRAM);
+      unindex_stmt->bind(1, mod_id);
+      unindex_stmt->bindNoCopy(2, dir);
+      unindex_stmt->exec();
+    }
+
+    stmt.bind(1, mod_id);
+    stmt.bindNoCopy(2, dir);
+    stmt.exec();
+    stmt.reset();
+  }
+
+  auto hashes = delete_unref_blobs_();
+  tx.release();
+  return hashes;
 }
 
 int DB::delete_mod_files_(int64_t mod_id) {
+  if (m_dr->trigram) {
+    auto unindex_stmt = m_dr->cached(UNINDEX_MOD_TRIGRAMS);
+    unindex_stmt->bind(1, mod_id);
+    unindex_stmt->exec();
+  }
+
   SQLite::Statement stmt{m_dr->db, DELETE_MOD_FILES};
   stmt.bind(1, mod_id);
   return stmt.exec();
@@ -523,13 +1089,268 @@ void DB::install_mod(int64_t id, const std::vector<std::string> &backup_files) {
   tx.release();
 }
 
+int DB::insert_backup_files(int64_t id,
+                            const std::vector<std::string> &backup_files) {
+  return insert_backup_files_(id, backup_files);
+}
+
+int DB::delete_backup_files(int64_t id,
+                            const std::vector<std::string> &backup_files) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  SQLite::Statement stmt{m_dr->db, DELETE_BACKUP_FILE};
+  int cnt = 0;
+  for (const auto &bak_file : backup_files) {
+    stmt.bind(1, id);
+    stmt.bindNoCopy(2, bak_file);
+    cnt += stmt.exec();
+    stmt.reset();
+  }
+  tx.release();
+  return cnt;
+}
+
 void DB::uninstall_mod(int64_t id) {
   SQLite::Savepoint tx(m_dr->db, FILEMOD);
   update_mod_status_(id, static_cast<int>(ModStatus::Uninstalled));
   delete_backup_files_(id);
+
+  SQLite::Statement stmt{m_dr->db, CLEAR_LINK_METAS};
+  stmt.bind(1, id);
+  stmt.exec();
+
+  tx.release();
+}
+
+void DB::update_link_metas(int64_t mod_id,
+                           const std::vector<LinkMetaDto> &link_metas) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  SQLite::Statement stmt{m_dr->db, UPDATE_LINK_META};
+  for (const auto &link_meta : link_metas) {
+    stmt.bind(1, static_cast<int64_t>(link_meta.ino));
+    stmt.bind(2, link_meta.mtime);
+    stmt.bind(3, mod_id);
+    stmt.bindNoCopy(4, link_meta.dir);
+    stmt.exec();
+    stmt.reset();
+  }
   tx.release();
 }
 
+std::vector<LinkMetaDto> DB::query_link_metas(int64_t mod_id) {
+  auto stmt = m_dr->cached(QUERY_LINK_METAS);
+  stmt->bind(1, mod_id);
+  std::vector<LinkMetaDto> link_metas;
+  while (stmt->executeStep()) {
+    // null reads as 0
+    link_metas.push_back(
+        {.dir = stmt->getColumn(0).getString(),
+         .ino = static_cast<uint64_t>(stmt->getColumn(1).getInt64()),
+         .mtime = stmt->getColumn(2).getInt64()});
+  }
+  return link_metas;
+}
+
+std::vector<std::string> DB::query_backup_files(int64_t mod_id) {
+  auto stmt = m_dr->cached(QUERY_BACKUP_FILES);
+  stmt->bind(1, mod_id);
+  std::vector<std::string> bak_files;
+  while (stmt->executeStep()) {
+    bak_files.push_back(stmt->getColumn(0).getString());
+  }
+  return bak_files;
+}
+
+std::vector<ModDto> DB::query_mods_by_archive(const std::string &hash) {
+  SQLite::Statement stmt{m_dr->db, QUERY_MODS_BY_ARCHIVE};
+  stmt.bindNoCopy(1, hash);
+  std::vector<ModDto> mods;
+  while (stmt.executeStep()) {
+    mods.push_back(mod_from_stmt(stmt));
+  }
+  return mods;
+}
+
+int DB::insert_archive(int64_t mod_id, const std::string &hash) {
+  SQLite::Statement stmt{m_dr->db, INSERT_ARCHIVE};
+  stmt.bind(1, mod_id);
+  stmt.bindNoCopy(2, hash);
+  return stmt.exec();
+}
+
+int DB::delete_archive(int64_t mod_id) {
+  SQLite::Statement stmt{m_dr->db, DELETE_ARCHIVE};
+  stmt.bind(1, mod_id);
+  return stmt.exec();
+}
+
+void DB::update_mod_file_hashes(int64_t mod_id,
+                                const std::vector<FileHashDto> &file_hashes) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  SQLite::Statement stmt{m_dr->db, UPDATE_MOD_FILE_HASH};
+  SQLite::Statement blob_stmt{m_dr->db, ACQUIRE_BLOB};
+
+  for (const auto &file_hash : file_hashes) {
+    stmt.bindNoCopy(1, file_hash.hash);
+    stmt.bind(2, static_cast<int>(file_hash.blob));
+    stmt.bind(3, mod_id);
+    stmt.bindNoCopy(4, file_hash.dir);
+    stmt.exec();
+    stmt.reset();
+
+    if (file_hash.blob) {
+      blob_stmt.bindNoCopy(1, file_hash.hash);
+      blob_stmt.exec();
+      blob_stmt.reset();
+    }
+  }
+
+  tx.release();
+}
+
+std::vector<FileHashDto> DB::query_mod_file_hashes(int64_t mod_id) {
+  auto stmt = m_dr->cached(QUERY_MOD_FILE_HASHES);
+  stmt->bind(1, mod_id);
+  std::vector<FileHashDto> file_hashes;
+  while (stmt->executeStep()) {
+    auto crc = stmt->getColumn(3);
+    file_hashes.push_back({.dir = stmt->getColumn(0).getString(),
+                           .hash = stmt->getColumn(1).getString(),
+                           .blob = stmt->getColumn(2).getInt() != 0,
+                           .crc = crc.isNull() ? -1 : crc.getInt64()});
+  }
+  return file_hashes;
+}
+
+void DB::update_mod_file_crcs(int64_t mod_id,
+                              const std::vector<FileHashDto> &file_crcs) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  SQLite::Statement stmt{m_dr->db, UPDATE_MOD_FILE_CRC};
+  for (const auto &file_crc : file_crcs) {
+    if (file_crc.crc < 0) {
+      stmt.bind(1);
+    } else {
+      stmt.bind(1, file_crc.crc);
+    }
+    stmt.bind(2, mod_id);
+    stmt.bindNoCopy(3, file_crc.dir);
+    stmt.exec();
+    stmt.reset();
+  }
+  tx.release();
+}
+
+std::vector<std::string> DB::release_blobs(int64_t mod_id) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+  std::vector<std::string> hashes;
+
+  SQLite::Statement release_stmt{m_dr->db, RELEASE_MOD_BLOBS};
+  release_stmt.bind(1, mod_id);
+  if (release_stmt.exec()) {
+    hashes = delete_unref_blobs_();
+  }
+
+  tx.release();
+  return hashes;
+}
+
+int64_t DB::save_profile(int64_t tar_id, const std::string &name,
+                         const std::vector<int64_t> &mod_ids) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+
+  int64_t id = 0;
+  if (auto profile_ret = query_profile(tar_id, name); profile_ret.success) {
+    id = profile_ret.data.id;
+    SQLite::Statement stmt{m_dr->db, DELETE_PROFILE_MODS};
+    stmt.bind(1, id);
+    stmt.exec();
+  } else {
+    SQLite::Statement stmt{m_dr->db, INSERT_PROFILE};
+    stmt.bind(1, tar_id);
+    stmt.bindNoCopy(2, name);
+    stmt.exec();
+    id = m_dr->db.getLastInsertRowid();
+  }
+
+  SQLite::Statement stmt{m_dr->db, INSERT_PROFILE_MOD};
+  for (auto mod_id : mod_ids) {
+    stmt.bind(1, id);
+    stmt.bind(2, mod_id);
+    stmt.exec();
+    stmt.reset();
+  }
+
+  tx.release();
+  return id;
+}
+
+result<ProfileDto> DB::query_profile(int64_t tar_id, const std::string &name) {
+  SQLite::Statement stmt{m_dr->db, QUERY_PROFILE_BY_TARGETID_NAME};
+  stmt.bind(1, tar_id);
+  stmt.bindNoCopy(2, name);
+  result<ProfileDto> ret{{.success = false}};
+  if (!stmt.executeStep()) {
+    return ret;
+  }
+
+  ret.success = true;
+  ret.data = {.id = stmt.getColumn(0).getInt64(),
+              .tar_id = stmt.getColumn(1).getInt64(),
+              .name = stmt.getColumn(2).getString()};
+
+  SQLite::Statement mods_stmt{m_dr->db, QUERY_PROFILE_MODS};
+  mods_stmt.bind(1, ret.data.id);
+  while (mods_stmt.executeStep()) {
+    ret.data.mod_ids.push_back(mods_stmt.getColumn(0).getInt64());
+  }
+  return ret;
+}
+
+std::vector<ProfileDto> DB::query_profiles(int64_t tar_id) {
+  SQLite::Statement stmt{m_dr->db, QUERY_PROFILES_BY_TARGETID};
+  stmt.bind(1, tar_id);
+
+  std::vector<ProfileDto> profiles;
+  while (stmt.executeStep()) {  // ordered by profile name, mod_id
+    int64_t id = stmt.getColumn(0).getInt64();
+    if (profiles.empty() || profiles.back().id != id) {
+      profiles.push_back({.id = id,
+                          .tar_id = stmt.getColumn(1).getInt64(),
+                          .name = stmt.getColumn(2).getString()});
+    }
+    if (!stmt.getColumn(3).isNull()) {
+      profiles.back().mod_ids.push_back(stmt.getColumn(3).getInt64());
+    }
+  }
+  return profiles;
+}
+
+int DB::delete_profile(int64_t id) {
+  SQLite::Savepoint tx{m_dr->db, FILEMOD};
+
+  SQLite::Statement mods_stmt{m_dr->db, DELETE_PROFILE_MODS};
+  mods_stmt.bind(1, id);
+  mods_stmt.exec();
+
+  SQLite::Statement stmt{m_dr->db, DELETE_PROFILE};
+  stmt.bind(1, id);
+  int cnt = stmt.exec();
+
+  tx.release();
+  return cnt;
+}
+
+std::vector<std::string> DB::delete_unref_blobs_() {
+  std::vector<std::string> hashes;
+  SQLite::Statement stmt{m_dr->db, QUERY_UNREF_BLOBS};
+  while (stmt.executeStep()) {
+    hashes.push_back(stmt.getColumn(0).getString());
+  }
+  if (!hashes.empty()) {
+    m_dr->db.exec(DELETE_UNREF_BLOBS);
+  }
+  return hashes;
+}
+
 int DB::rename_mod(int64_t mid, const std::string &newname) {
   SQLite::Statement stmt{m_dr->db, RENAME_MOD};
   stmt.bindNoCopy(1, newname);
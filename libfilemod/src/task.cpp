@@ -0,0 +1,33 @@
+#include "filemod/task.hpp"
+
+namespace filemod {
+
+void task::add_total(uint64_t files, uint64_t bytes) {
+  std::lock_guard lock{m_mtx};
+  m_progress.files_total += files;
+  m_progress.bytes_total += bytes;
+}
+
+void task::add_done(uint64_t files, uint64_t bytes) {
+  {
+    std::lock_guard lock{m_mtx};
+    m_progress.files_done += files;
+    m_progress.bytes_done += bytes;
+  }
+  if (!m_on_progress) {
+    return;
+  }
+
+  // copy the latest progress once it is our turn to report, so reports never
+  // go backwards, and report it w/o holding `m_mtx`, which the callback may
+  // need, e.g. for add_total()
+  std::lock_guard report_lock{m_report_mtx};
+  progress current;
+  {
+    std::lock_guard lock{m_mtx};
+    current = m_progress;
+  }
+  m_on_progress(current);
+}
+
+}  // namespace filemod
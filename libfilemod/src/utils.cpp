@@ -6,6 +6,12 @@
 
 #include <filesystem>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "filemod/ipc.hpp"
+#include "filemod/lock.hpp"
 #include "filemod/private/utils.hpp"
 
 namespace filemod {
@@ -37,4 +43,37 @@ std::filesystem::path get_db_path() {
   return (get_config_dir() += '/') += DBFILE;
 }
 
+std::filesystem::path get_socket_path() {
+  return (get_config_dir() += '/') += SOCKFILE;
+}
+
+std::filesystem::path get_lock_path() {
+  return (get_config_dir() += '/') += LOCKFILE;
+}
+
+std::string ascii_fold(std::string_view str) {
+  std::string folded(str);
+  char *data = folded.data();
+  size_t i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+  // bytes >= 0x80 are negative as signed, so never in 'A'..'Z'
+  const __m128i before_a = _mm_set1_epi8('A' - 1);
+  const __m128i after_z = _mm_set1_epi8('Z' + 1);
+  const __m128i lower_bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= folded.size(); i += 16) {
+    auto *p = reinterpret_cast<__m128i *>(data + i);
+    __m128i chars = _mm_loadu_si128(p);
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chars, before_a),
+                                  _mm_cmplt_epi8(chars, after_z));
+    _mm_storeu_si128(p, _mm_or_si128(chars, _mm_and_si128(upper, lower_bit)));
+  }
+#endif
+  for (; i < folded.size(); ++i) {
+    if (data[i] >= 'A' && data[i] <= 'Z') {
+      data[i] |= 0x20;
+    }
+  }
+  return folded;
+}
+
 }  // namespace filemod
\ No newline at end of file
@@ -0,0 +1,16 @@
+#include "filemod/ipc.hpp"
+
+namespace filemod {
+
+// Not supported yet, clients always run commands in process.
+
+result_base ipc_serve(const std::filesystem::path &, const ipc_handler &) {
+  return {.success = false, .msg = UnSupportedOS};
+}
+
+result<ipc_response> ipc_send(const std::filesystem::path &,
+                              const ipc_request &) {
+  return {{.success = false}};
+}
+
+}  // namespace filemod
@@ -0,0 +1,70 @@
+#include "filemod/lock.hpp"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+namespace filemod {
+
+// polled at growing intervals up to this, LockFileEx() cannot time out
+constexpr std::chrono::milliseconds MAX_POLL_INTERVAL{100};
+
+file_lock::~file_lock() { unlock(); }
+
+result_base file_lock::lock(const std::filesystem::path &lock_path,
+                            std::chrono::milliseconds timeout) {
+  unlock();
+  result_base ret{.success = false};
+
+  std::error_code ec;
+  std::filesystem::create_directories(lock_path.parent_path(), ec);
+  HANDLE handle = CreateFileW(
+      lock_path.c_str(), GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    ret.msg = "error: cannot open '" + path_to_utf8str(lock_path) + "'";
+    return ret;
+  }
+
+  DWORD flags = LOCKFILE_FAIL_IMMEDIATELY | LOCKFILE_EXCLUSIVE_LOCK;
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  std::chrono::milliseconds interval{1};
+  while (true) {
+    OVERLAPPED overlapped{};
+    if (LockFileEx(handle, flags, 0, 1, 0, &overlapped)) {
+      break;
+    }
+    auto now = std::chrono::steady_clock::now();
+    bool held = GetLastError() == ERROR_LOCK_VIOLATION;
+    if (!held || now >= deadline) {
+      ret.msg = held ? "error: timed out waiting for another filemod process"
+                     : "error: cannot lock '" + path_to_utf8str(lock_path) +
+                           "'";
+      CloseHandle(handle);
+      return ret;
+    }
+    std::this_thread::sleep_for(std::min<std::chrono::nanoseconds>(
+        interval, deadline - now));
+    interval = std::min(interval * 2, MAX_POLL_INTERVAL);
+  }
+
+  m_handle = handle;
+  ret.success = true;
+  return ret;
+}
+
+void file_lock::unlock() noexcept {
+  if (m_handle != INVALID_HANDLE_VALUE) {
+    OVERLAPPED overlapped{};
+    UnlockFileEx(m_handle, 0, 1, 0, &overlapped);
+    CloseHandle(m_handle);
+    m_handle = INVALID_HANDLE_VALUE;
+  }
+}
+
+bool file_lock::locked() const noexcept {
+  return m_handle != INVALID_HANDLE_VALUE;
+}
+
+}  // namespace filemod
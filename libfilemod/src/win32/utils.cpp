@@ -59,6 +59,83 @@ std::filesystem::path getexepath() {
   throw std::runtime_error{wstr_to_cp(WinErrToStr(ec), CP_UTF8)};
 }
 
+// Block cloning is limited to ReFS, not worth it here.
+bool clone_file(path_ref, path_ref) { return false; }
+
+// No atomic exchange of directories on Windows.
+bool exchange_paths(const std::filesystem::path &,
+                    const std::filesystem::path &) {
+  return false;
+}
+
+// Native paths below are converted to std::filesystem::path, which allocates.
+
+// no handles, paths are looked up in full
+dir_handle::dir_handle(const std::filesystem::path & /*dir*/) {}
+
+dir_handle::~dir_handle() = default;
+
+std::filesystem::file_type stat_type(path_ref path) {
+  return std::filesystem::status(path.path()).type();
+}
+
+bool make_dir(path_ref path) {
+  return std::filesystem::create_directory(path.path());
+}
+
+void make_symlink(path_ref target, path_ref link) {
+  std::filesystem::create_symlink(target.path(), link.path());
+}
+
+bool rename_path(path_ref src, path_ref dest) {
+  std::error_code ec;
+  std::filesystem::rename(src.path(), dest.path(), ec);
+  if (ec == std::errc::cross_device_link) {
+    return false;
+  }
+  if (ec) {
+    throw std::filesystem::filesystem_error("error rename", src.path(),
+                                            dest.path(), ec);
+  }
+  return true;
+}
+
+bool remove_dir(path_ref path) {
+  std::error_code ec;
+  return std::filesystem::remove(path.path(), ec);
+}
+
+uint64_t regular_size(path_ref path) {
+  std::filesystem::directory_entry entry{path.path()};
+  return entry.is_regular_file() ? entry.file_size() : 0;
+}
+
+void walk_tree(const std::filesystem::path &dir, int /*dir_fd*/,
+               const std::function<void(const path_buf &, bool)> &func) {
+  path_buf file{dir};
+  for (const auto &entry :
+       std::filesystem::recursive_directory_iterator(dir)) {
+    file.join(entry.path().lexically_relative(dir).native());
+    func(file, entry.is_directory());
+  }
+}
+
+file_meta lstat_meta(const std::filesystem::path &path) {
+  file_meta meta;
+  std::error_code ec;
+  auto status = std::filesystem::symlink_status(path, ec);
+  // attributes of a reparse point itself, not its target
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!ec &&
+      GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+    meta.type = status.type();
+    meta.mtime = (static_cast<int64_t>(data.ftLastWriteTime.dwHighDateTime)
+                  << 32) |
+                 data.ftLastWriteTime.dwLowDateTime;
+  }
+  return meta;
+}
+
 std::wstring cp_to_wstr(std::string_view sv, UINT cp) {
   int sz = MultiByteToWideChar(cp, 0, sv.data(), sv.size() + 1, NULL, 0);
   // sz include null terminator
@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "filemod/bloom.hpp"
+
+TEST(BloomTest, may_contain) {
+  filemod::bloom_filter bloom{1000};
+  for (int i = 0; i < 1000; ++i) {
+    bloom.add("dir/file" + std::to_string(i));
+  }
+  EXPECT_EQ(1000, bloom.size());
+  EXPECT_EQ(1000, bloom.capacity());
+
+  // no false negatives
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(bloom.may_contain("dir/file" + std::to_string(i)));
+  }
+
+  // about 1% false positives
+  int positives = 0;
+  for (int i = 0; i < 10000; ++i) {
+    positives += bloom.may_contain("other/file" + std::to_string(i));
+  }
+  EXPECT_LT(positives, 300);
+}
+
+TEST(BloomTest, empty) {
+  filemod::bloom_filter bloom;
+  EXPECT_FALSE(bloom.may_contain("file"));
+
+  // a filter of capacity 0 cannot rule anything out once added to
+  bloom.add("file");
+  EXPECT_TRUE(bloom.may_contain("file"));
+  EXPECT_TRUE(bloom.may_contain("other"));
+}
+
+TEST(BloomTest, to_bytes) {
+  filemod::bloom_filter bloom{10};
+  bloom.add("a");
+  bloom.add("b/c");
+
+  auto copy = filemod::bloom_filter::from_bytes(bloom.to_bytes());
+  ASSERT_TRUE(copy);
+  EXPECT_EQ(2, copy->size());
+  EXPECT_EQ(10, copy->capacity());
+  EXPECT_TRUE(copy->may_contain("a"));
+  EXPECT_TRUE(copy->may_contain("b/c"));
+  EXPECT_EQ(bloom.to_bytes(), copy->to_bytes());
+}
+
+TEST(BloomTest, from_bytes_malformed) {
+  filemod::bloom_filter bloom{10};
+  bloom.add("a");
+  auto bytes = bloom.to_bytes();
+
+  bytes.pop_back();
+  EXPECT_FALSE(filemod::bloom_filter::from_bytes(bytes));
+
+  EXPECT_FALSE(filemod::bloom_filter::from_bytes({1, 2, 3}));
+
+  // capacity too large for the words to be counted
+  std::vector<unsigned char> huge(16, 0xff);
+  EXPECT_FALSE(filemod::bloom_filter::from_bytes(huge));
+}
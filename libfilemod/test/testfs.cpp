@@ -1,11 +1,15 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 #include "filemod/fs.hpp"
 #include "filemod/fs_tx.hpp"
+#include "filemod/path_buf.hpp"
 #include "testhelper.hpp"
 
 TEST_F(FSTest, create_target) {
@@ -114,6 +118,88 @@ TEST_F(FSTest, install_mod_w_backup_rollback) {
   EXPECT_TRUE(!std::filesystem::exists(bak_dir) || bak_dir.empty());
 }
 
+TEST_F(FSTest, activate_generation) {
+  std::ofstream{m_game1_dir / "orig"} << "orig";
+  auto fs = create_fs();
+  fs.create_target(m_tar_id);
+  auto cfg_mod = fs.get_cfg_mod(m_tar_id, m_mod1_obj.mod_name);
+  create_mod_files(cfg_mod, m_mod1_obj);
+
+  auto gen_dir = fs.begin_generation(m_game1_dir);
+  fs.install_mod(cfg_mod, gen_dir);
+  // not visible before activated
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "moda"));
+  fs.activate_generation(m_game1_dir, gen_dir);
+
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "orig"));
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "moda"));
+  EXPECT_FALSE(std::filesystem::exists(gen_dir));
+  auto prev_dir = m_game1_dir;
+  prev_dir += filemod::GEN_PREV_SUFFIX;
+  EXPECT_TRUE(std::filesystem::exists(prev_dir / "orig"));
+  EXPECT_FALSE(std::filesystem::exists(prev_dir / "moda"));
+}
+
+TEST_F(FSTest, activate_generation_rollback) {
+  std::ofstream{m_game1_dir / "orig"} << "orig";
+  std::filesystem::path gen_dir;
+  {
+    auto fs = create_fs();
+    fs.create_target(m_tar_id);
+    auto cfg_mod = fs.get_cfg_mod(m_tar_id, m_mod1_obj.mod_name);
+    create_mod_files(cfg_mod, m_mod1_obj);
+
+    filemod::fs_tx tx{fs};
+    gen_dir = fs.begin_generation(m_game1_dir);
+    {
+      filemod::fs_tx tx2{fs};
+      fs.install_mod(cfg_mod, gen_dir);
+      tx2.commit();
+    }
+    fs.activate_generation(m_game1_dir, gen_dir);
+  }
+
+  // the activation is reverted before the changes made in the generation
+  auto it = std::filesystem::recursive_directory_iterator(m_game1_dir);
+  EXPECT_EQ(1, std::distance(begin(it), end(it)));
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "orig"));
+  EXPECT_FALSE(std::filesystem::exists(gen_dir));
+}
+
+TEST_F(FSTest, activate_generation_prev) {
+  std::ofstream{m_game1_dir / "orig"} << "orig";
+  auto prev_dir = filemod::FS::get_prev_gen(m_game1_dir);
+  auto stale_dir = m_game1_dir;
+  stale_dir += std::string{filemod::GEN_STALE_SUFFIX} + "0";
+  auto fs = create_fs();
+  {
+    filemod::fs_tx tx{fs};
+    fs.activate_generation(m_game1_dir, fs.begin_generation(m_game1_dir));
+    tx.commit();
+  }
+  std::ofstream{m_game1_dir / "new"} << "new";
+
+  // the generation kept is restored once rolled back
+  {
+    filemod::fs_tx tx{fs};
+    fs.activate_generation(m_game1_dir, fs.begin_generation(m_game1_dir));
+    EXPECT_TRUE(std::filesystem::exists(prev_dir / "new"));
+  }
+  EXPECT_FALSE(std::filesystem::exists(prev_dir / "new"));
+  EXPECT_TRUE(std::filesystem::exists(prev_dir / "orig"));
+  EXPECT_FALSE(std::filesystem::exists(stale_dir));
+
+  // and deleted once committed
+  {
+    filemod::fs_tx tx{fs};
+    fs.activate_generation(m_game1_dir, fs.begin_generation(m_game1_dir));
+    EXPECT_TRUE(std::filesystem::exists(stale_dir / "orig"));
+    tx.commit();
+  }
+  EXPECT_TRUE(std::filesystem::exists(prev_dir / "new"));
+  EXPECT_FALSE(std::filesystem::exists(stale_dir));
+}
+
 TEST_F(FSTest, uninstall_mod) {
   auto fs = create_fs();
   fs.create_target(m_tar_id);
@@ -147,6 +233,52 @@ TEST_F(FSTest, uninstall_mod_rollback) {
             std::distance(begin(gdi), end(gdi)));
 }
 
+TEST_F(FSTest, install_uninstall_many_files) {
+  // more files than a batch of changes holds
+  std::vector<std::string> rel_strs;
+  std::vector<std::filesystem::file_type> types;
+  for (const auto *dir : {"a", "a/b", "c"}) {
+    rel_strs.emplace_back(dir);
+    types.push_back(std::filesystem::file_type::directory);
+    for (int i = 0; i < 200; ++i) {
+      rel_strs.push_back(std::string{dir} + "/f" + std::to_string(i));
+      types.push_back(std::filesystem::file_type::regular);
+    }
+  }
+  const mod_obj obj{"many", std::move(rel_strs), std::move(types)};
+  auto count_files = [&] {
+    auto it = std::filesystem::recursive_directory_iterator(m_game1_dir);
+    return static_cast<size_t>(std::distance(begin(it), end(it)));
+  };
+
+  auto fs = create_fs();
+  fs.create_target(m_tar_id);
+  auto cfg_mod = fs.get_cfg_mod(m_tar_id, obj.mod_name);
+  create_mod_files(cfg_mod, obj);
+  auto file_rels = obj.file_rels();
+  std::sort(file_rels.begin(), file_rels.end());
+
+  {
+    filemod::fs_tx tx{fs};
+    fs.install_mod(cfg_mod, m_game1_dir);
+    EXPECT_EQ(obj.file_rel_strs.size(), count_files());
+  }
+  EXPECT_EQ(0, count_files());
+
+  fs.install_mod(cfg_mod, m_game1_dir);
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "a/b/f199"));
+  {
+    filemod::fs_tx tx{fs};
+    fs.uninstall_mod(cfg_mod, m_game1_dir, file_rels, {});
+    EXPECT_EQ(0, count_files());
+  }
+  EXPECT_EQ(obj.file_rel_strs.size(), count_files());
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "a/b/f199"));
+
+  fs.uninstall_mod(cfg_mod, m_game1_dir, file_rels, {});
+  EXPECT_EQ(0, count_files());
+}
+
 TEST_F(FSTest, uninstall_mod_restore_backup) {
   auto fs = create_fs();
   fs.create_target(m_tar_id);
@@ -364,4 +496,84 @@ TEST_F(FSTest, nested_tx_all_rollbacked) {
 
   // target created
   EXPECT_FALSE(std::filesystem::exists(m_cfg_dir / std::to_string(m_tar_id)));
-}
\ No newline at end of file
+}
+TEST_F(FSTest, parallel_tx_rollback) {
+  std::filesystem::path cfg_mod;
+  std::filesystem::path cfg_mod2;
+  {
+    auto fs = create_fs();
+    fs.create_target(m_tar_id);
+    cfg_mod = fs.get_cfg_mod(m_tar_id, m_mod1_obj.mod_name);
+    cfg_mod2 = fs.get_cfg_mod(m_tar_id, m_mod2_obj.mod_name);
+    create_mod_files(cfg_mod, m_mod1_obj);
+    create_mod_files(cfg_mod2, m_mod2_obj);
+
+    filemod::fs_tx tx{fs};
+    fs.parallel_tx(2, [&](size_t i) {
+      fs.install_mod(i == 0 ? cfg_mod : cfg_mod2,
+                     i == 0 ? m_game1_dir : m_game2_dir);
+    });
+    EXPECT_FALSE(std::filesystem::is_empty(m_game1_dir));
+    EXPECT_FALSE(std::filesystem::is_empty(m_game2_dir));
+
+    // changes of all workers are rolled back with the transaction
+    EXPECT_THROW(fs.parallel_tx(2,
+                                [&](size_t i) {
+                                  if (i == 1) {
+                                    throw std::runtime_error{"failed"};
+                                  }
+                                  fs.create_target(m_tar_id + 1);
+                                }),
+                 std::runtime_error);
+  }
+
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+  EXPECT_TRUE(std::filesystem::is_empty(m_game2_dir));
+  EXPECT_FALSE(
+      std::filesystem::exists(m_cfg_dir / std::to_string(m_tar_id + 1)));
+  EXPECT_TRUE(std::filesystem::exists(cfg_mod));
+}
+
+TEST(PathBufTest, join) {
+  const std::filesystem::path base{"base"};
+  const auto rel = std::filesystem::path{"a/b/c"}.make_preferred();
+  filemod::path_buf file{base};
+  file.join(rel.native());
+  EXPECT_EQ(base / "a/b/c", filemod::path_ref{file}.path());
+  EXPECT_EQ(rel.native(), file.rel());
+
+  // parents below the base, outermost first, then restored
+  std::vector<std::filesystem::path> parents;
+  file.for_each_parent(
+      [&](filemod::path_ref dir) { parents.push_back(dir.path()); });
+  EXPECT_EQ((std::vector<std::filesystem::path>{base / "a", base / "a/b"}),
+            parents);
+  EXPECT_EQ(base / "a/b/c", filemod::path_ref{file}.path());
+
+  auto size = file.push(std::filesystem::path{"d"}.native());
+  EXPECT_EQ(base / "a/b/c/d", filemod::path_ref{file}.path());
+  file.cut(size);
+  file.join(std::filesystem::path{"e"}.native());
+  EXPECT_EQ(base / "e", filemod::path_ref{file}.path());
+}
+
+TEST(PathBufTest, base_fd) {
+  // any number, the handle is only passed on
+  const int base_fd = 3;
+  const auto rel = std::filesystem::path{"a/b"}.make_preferred();
+  filemod::path_buf file{"base", base_fd};
+  file.join(rel.native());
+
+  filemod::path_ref ref{file};
+  EXPECT_EQ(base_fd, ref.dir_fd());
+  EXPECT_EQ(rel.native(), ref.at_path());
+  file.for_each_parent([&](filemod::path_ref dir) {
+    EXPECT_EQ(base_fd, dir.dir_fd());
+    EXPECT_EQ(std::filesystem::path{"a"}.native(), dir.at_path());
+  });
+
+  // paths w/o a handle are looked up in full
+  const std::filesystem::path path{"base/a"};
+  EXPECT_EQ(filemod::NO_DIR_FD, filemod::path_ref{path}.dir_fd());
+  EXPECT_EQ(path.native(), filemod::path_ref{path}.at_path());
+}
@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+
+#include "filemod/hash.hpp"
+#include "testhelper.hpp"
+
+static std::string xxh64_str(const std::string& str) {
+  filemod::xxh64 hasher;
+  hasher.update(str.data(), str.size());
+  return filemod::hash_to_str(hasher.digest());
+}
+
+TEST(HashTest, xxh64) {
+  EXPECT_EQ("ef46db3751d8e999", xxh64_str(""));
+  EXPECT_EQ("d24ec4f1a98c6e5b", xxh64_str("a"));
+  EXPECT_EQ("44bc2cf5ad770999", xxh64_str("abc"));
+  EXPECT_EQ("fbcea83c8a378bf1",
+            xxh64_str("Nobody inspects the spammish repetition"));
+}
+
+TEST(HashTest, xxh64_streaming) {
+  std::string str(1000, '\0');
+  for (size_t i = 0; i < str.size(); ++i) {
+    str[i] = static_cast<char>(i * 31);
+  }
+
+  filemod::xxh64 hasher;
+  for (size_t i = 0; i < str.size(); i += 7) {
+    hasher.update(str.data() + i, std::min<size_t>(7, str.size() - i));
+  }
+  EXPECT_EQ(xxh64_str(str), filemod::hash_to_str(hasher.digest()));
+}
+
+TEST_F(PathHelper, hash_file) {
+  std::filesystem::create_directories(m_tmp_dir);
+  auto file = m_tmp_dir / "hash_file";
+  std::ofstream{file} << "Nobody inspects the spammish repetition";
+
+  EXPECT_EQ("fbcea83c8a378bf1", filemod::hash_file(file));
+  std::filesystem::remove_all(m_tmp_dir);
+}
@@ -14,8 +14,13 @@ int write_archive(const std::filesystem::path& outname,
   int r;
 
   a = archive_write_new();
-  archive_write_set_format_zip(a);
-  archive_write_set_options(a, "zip:hdrcharset=UTF-8");
+  if (outname.extension() == ".gz") {
+    archive_write_set_format_pax_restricted(a);
+    archive_write_add_filter_gzip(a);
+  } else {
+    archive_write_set_format_zip(a);
+    archive_write_set_options(a, "zip:hdrcharset=UTF-8");
+  }
 
 #ifdef _WIN32
   r = archive_write_open_filename_w(a, outname.c_str());
@@ -57,7 +62,7 @@ int write_archive(const std::filesystem::path& outname,
     }
     if (!is_dir) {
       std::ifstream f{mod_file, std::ios_base::binary};
-      while (f.read(buff, sizeof(buff))) {
+      while (f.read(buff, sizeof(buff)) || f.gcount() > 0) {
         if ((r = archive_write_data(a, buff, f.gcount()) < ARCHIVE_OK)) {
           fprintf(stderr, "%s\n", archive_error_string(a));
           goto cleanup_l;
@@ -18,6 +18,7 @@
 #include <Windows.h>
 #endif
 
+// Write a zip archive, or a tar.gz one if `outname` ends w/ ".gz".
 int write_archive(const std::filesystem::path& outname,
                   const std::filesystem::path& mod_dir,
                   const std::vector<std::filesystem::path>& mod_file_rels);
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+#include "filemod/ipc.hpp"
+#include "testhelper.hpp"
+
+class IpcTest : public PathHelper {
+ public:
+  IpcTest() { std::filesystem::create_directories(m_tmp_dir); }
+  ~IpcTest() override { std::filesystem::remove_all(m_tmp_dir); }
+
+ protected:
+  // Send `request` once the server is listening.
+  filemod::result<filemod::ipc_response> send(
+      const filemod::ipc_request &request) {
+    auto ret = filemod::ipc_send(m_socket_path, request);
+    for (int i = 0; i < 100 && !ret.success && ret.msg.empty(); ++i) {
+      std::this_thread::sleep_for(std::chrono::milliseconds{10});
+      ret = filemod::ipc_send(m_socket_path, request);
+    }
+    return ret;
+  }
+
+  const std::filesystem::path m_socket_path{m_tmp_dir / filemod::SOCKFILE};
+};
+
+#ifndef _WIN32
+TEST_F(IpcTest, serve) {
+  EXPECT_FALSE(filemod::ipc_send(m_socket_path, {}).success);
+
+  int served = 0;
+  filemod::result_base serve_ret;
+  std::thread server{[&] {
+    serve_ret = filemod::ipc_serve(
+        m_socket_path,
+        [&](const filemod::ipc_request &request,
+            filemod::ipc_response &response) {
+          ++served;
+          response.code = static_cast<int>(request.args.size());
+          response.out = request.cwd;
+          for (const auto &arg : request.args) {
+            response.err += arg;
+          }
+          return request.args.empty() || request.args[0] != "stop";
+        });
+  }};
+
+  auto ret = send({.cwd = "/tmp", .args = {"list", "", "السلام"}});
+  ASSERT_TRUE(ret.success);
+  EXPECT_EQ(3, ret.data.code);
+  EXPECT_EQ("/tmp", ret.data.out);
+  EXPECT_EQ("listالسلام", ret.data.err);
+
+  ASSERT_TRUE(send({.args = {"stop"}}).success);
+  server.join();
+  EXPECT_TRUE(serve_ret.success);
+  EXPECT_EQ(2, served);
+  EXPECT_FALSE(std::filesystem::exists(m_socket_path));
+  EXPECT_FALSE(filemod::ipc_send(m_socket_path, {}).success);
+}
+#endif
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+
+#include "filemod/lock.hpp"
+#include "testhelper.hpp"
+
+class LockTest : public PathHelper {
+ public:
+  ~LockTest() override { std::filesystem::remove_all(m_tmp_dir); }
+
+ protected:
+  const std::filesystem::path m_lock_path{m_tmp_dir / filemod::LOCKFILE};
+  const std::chrono::milliseconds m_timeout{20};
+};
+
+TEST_F(LockTest, exclusive) {
+  filemod::file_lock a;
+  ASSERT_TRUE(a.lock(m_lock_path, m_timeout).success);
+  EXPECT_TRUE(a.locked());
+
+  {
+    filemod::file_lock b;
+    auto ret = b.lock(m_lock_path, m_timeout);
+    EXPECT_FALSE(ret.success);
+    EXPECT_FALSE(ret.msg.empty());
+    EXPECT_FALSE(b.locked());
+  }
+
+  // released on destruction
+  {
+    filemod::file_lock b;
+    a.unlock();
+    EXPECT_FALSE(a.locked());
+    EXPECT_TRUE(b.lock(m_lock_path, m_timeout).success);
+  }
+  EXPECT_TRUE(a.lock(m_lock_path, m_timeout).success);
+}
@@ -1,8 +1,14 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
 #include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
 
+#include "filemod/hash.hpp"
 #include "filemod/modder.hpp"
+#include "filemod/private/utils.hpp"
 #include "filemod/utils.hpp"
 #include "testhelper.hpp"
 
@@ -51,6 +57,46 @@ TEST_F(FilemodTest, install_mods) {
   EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), std::distance(begin(it), end(it)));
 }
 
+TEST_F(FilemodTest, install_mods_targets) {
+  auto tar1_ret = m_modder.add_target(m_game1_dir);
+  auto tar2_ret = m_modder.add_target(m_game2_dir);
+  auto mod1_ret = m_modder.add_mod(tar1_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar2_ret.data, m_mod2_dir);
+  auto mod3_ret = m_modder.add_mod(tar1_ret.data, m_mod2_dir);
+
+  ASSERT_TRUE(
+      m_modder.install_mods({mod1_ret.data, mod2_ret.data, mod3_ret.data})
+          .success);
+  auto mods =
+      m_modder.query_mods({mod1_ret.data, mod2_ret.data, mod3_ret.data});
+  ASSERT_EQ(3, mods.size());
+  for (const auto &mod : mods) {
+    EXPECT_EQ(filemod::ModStatus::Installed, mod.status);
+  }
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "mod2/asset/a.so"));
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game2_dir / "mod2/asset/a.so"));
+
+  ASSERT_TRUE(
+      m_modder.uninstall_mods({mod1_ret.data, mod2_ret.data, mod3_ret.data})
+          .success);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+  EXPECT_TRUE(std::filesystem::is_empty(m_game2_dir));
+}
+
+TEST_F(FilemodTest, install_mods_conflict) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.add_mod(tar_ret.data, "a", m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar_ret.data, "b", m_mod1_dir);
+
+  // the first mod is only planned when the second is checked
+  EXPECT_FALSE(m_modder.install_mods({mod1_ret.data, mod2_ret.data}).success);
+  for (const auto &mod :
+       m_modder.query_mods({mod1_ret.data, mod2_ret.data})) {
+    EXPECT_EQ(filemod::ModStatus::Uninstalled, mod.status);
+  }
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+}
+
 TEST_F(FilemodTest, install_target) {
   auto tar_ret = m_modder.add_target(m_game1_dir);
   auto mod_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
@@ -155,7 +201,43 @@ TEST_F(FilemodTest, add_mod_archive) {
 
   auto mods = m_modder.query_mods({mod_ret.data});
 
-  EXPECT_EQ(1, mods.size());
+  ASSERT_EQ(1, mods.size());
+  // relative paths come from archive entry names
+  auto files = mods[0].files;
+  auto expected = m_mod1_obj.file_rel_strs;
+  std::sort(files.begin(), files.end());
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, files);
+}
+
+// test add_mod from a zip large enough to extract on several workers
+TEST_F(FilemodTest, add_mod_archive_parallel) {
+  std::filesystem::path big_mod_dir{m_tmp_dir / "big_mod"};
+  std::vector<std::filesystem::path> file_rels{"data"};
+  std::filesystem::create_directories(big_mod_dir / "data");
+  for (int i = 0; i < 200; ++i) {
+    auto file_rel = std::filesystem::path{"data"} / std::to_string(i);
+    std::ofstream{big_mod_dir / file_rel} << std::string(i * 100, 'x') << i;
+    file_rels.push_back(file_rel);
+  }
+  std::filesystem::path archive_file{m_tmp_dir / "__big_archive.zip"};
+  int r = write_archive(archive_file, big_mod_dir, file_rels);
+  EXPECT_TRUE(r > -1);
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.add_mod_a(tar_ret.data, "big_mod", archive_file);
+  ASSERT_TRUE(mod_ret.success);
+
+  auto mods = m_modder.query_mods({mod_ret.data});
+  ASSERT_EQ(1, mods.size());
+  EXPECT_EQ(file_rels.size(), mods[0].files.size());
+
+  auto cfg_mod = m_cfg_dir / std::to_string(tar_ret.data) / "big_mod";
+  for (int i = 0; i < 200; ++i) {
+    std::ifstream f{cfg_mod / "data" / std::to_string(i)};
+    std::string content{std::istreambuf_iterator<char>{f}, {}};
+    EXPECT_EQ(std::string(i * 100, 'x') + std::to_string(i), content);
+  }
 }
 
 // test install_path from archive
@@ -181,6 +263,781 @@ TEST_F(FilemodTest, install_path_archive) {
   EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), std::distance(begin(it), end(it)));
 }
 
+// test add_mod from an archive that was added before
+TEST_F(FilemodTest, add_mod_archive_cached) {
+  std::filesystem::path archive_file{m_tmp_dir / "__archive.zip"};
+  int r = write_archive(archive_file, m_mod1_dir, m_mod1_obj.file_rels());
+  EXPECT_TRUE(r > -1);
+
+  auto tar1_ret = m_modder.add_target(m_game1_dir);
+  auto tar2_ret = m_modder.add_target(m_game2_dir);
+  auto mod1_ret = m_modder.add_mod_a(tar1_ret.data, "mod", archive_file);
+  ASSERT_TRUE(mod1_ret.success);
+
+  // modify the extracted tree, it must not stand in for the archive
+  auto cfg_mod1 = m_cfg_dir / std::to_string(tar1_ret.data) / "mod";
+  std::ofstream{cfg_mod1 / "mod1" / "mark"};
+  std::ofstream{cfg_mod1 / m_mod1_obj.file_rels().back()} << "changed";
+
+  auto mod2_ret = m_modder.add_mod_a(tar2_ret.data, "mod", archive_file);
+  ASSERT_TRUE(mod2_ret.success);
+
+  auto cfg_mod2 = m_cfg_dir / std::to_string(tar2_ret.data) / "mod";
+  EXPECT_FALSE(std::filesystem::exists(cfg_mod2 / "mod1" / "mark"));
+  auto mods = m_modder.query_mods({mod2_ret.data});
+  ASSERT_EQ(1, mods.size());
+  EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), mods[0].files.size());
+  auto verify_ret = m_modder.verify_mods({mod2_ret.data});
+  ASSERT_TRUE(verify_ret.success);
+  EXPECT_TRUE(verify_ret.data.empty());
+}
+
+// test install_path from archive conflicting with an installed mod
+TEST_F(FilemodTest, install_path_archive_conflict) {
+  std::filesystem::path archive_file{m_tmp_dir / "__archive.zip"};
+  int r = write_archive(archive_file, m_mod1_dir, m_mod1_obj.file_rels());
+  EXPECT_TRUE(r > -1);
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  ASSERT_TRUE(mod_ret.success);
+
+  auto a_mod_ret =
+      m_modder.install_path_a(tar_ret.data, "conflict_mod", archive_file);
+
+  EXPECT_FALSE(a_mod_ret.success);
+  EXPECT_NE(std::string::npos,
+            a_mod_ret.msg.find(std::to_string(mod_ret.data)));
+  // rejected before extracting
+  EXPECT_FALSE(std::filesystem::exists(
+      m_cfg_dir / std::to_string(tar_ret.data) / "conflict_mod"));
+}
+
+// test install_path from a tar.gz archive conflicting w/ an installed mod,
+// found once extracted
+TEST_F(FilemodTest, install_path_archive_conflict_tar) {
+  std::filesystem::path archive_file{m_tmp_dir / "__archive.tar.gz"};
+  int r = write_archive(archive_file, m_mod1_dir, m_mod1_obj.file_rels());
+  EXPECT_TRUE(r > -1);
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  ASSERT_TRUE(mod_ret.success);
+
+  auto a_mod_ret =
+      m_modder.install_path_a(tar_ret.data, "conflict_mod", archive_file);
+
+  EXPECT_FALSE(a_mod_ret.success);
+  EXPECT_NE(std::string::npos,
+            a_mod_ret.msg.find(std::to_string(mod_ret.data)));
+  EXPECT_FALSE(std::filesystem::exists(
+      m_cfg_dir / std::to_string(tar_ret.data) / "conflict_mod"));
+}
+
+// test install_path from an archive that cannot be read fails w/o throwing
+TEST_F(FilemodTest, install_path_archive_corrupt) {
+  std::filesystem::path archive_file{m_tmp_dir / "__corrupt.zip"};
+  std::ofstream{archive_file} << "not an archive";
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+
+  filemod::result<int64_t> a_mod_ret;
+  ASSERT_NO_THROW(a_mod_ret = m_modder.install_path_a(
+                      tar_ret.data, "corrupt_mod", archive_file));
+  EXPECT_FALSE(a_mod_ret.success);
+  EXPECT_NE(std::string::npos, a_mod_ret.msg.find("__corrupt.zip"));
+  EXPECT_FALSE(std::filesystem::exists(
+      m_cfg_dir / std::to_string(tar_ret.data) / "corrupt_mod"));
+}
+
+// test add_mod and remove_mods with deduplicated files
+TEST_F(FilemodTest, add_mod_dedup) {
+  m_modder.set_dedup(true);
+  auto tar1_ret = m_modder.add_target(m_game1_dir);
+  auto tar2_ret = m_modder.add_target(m_game2_dir);
+  auto mod1_ret = m_modder.add_mod(tar1_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar2_ret.data, m_mod1_dir);
+  ASSERT_TRUE(mod1_ret.success);
+  ASSERT_TRUE(mod2_ret.success);
+
+  auto file_rel = filemod::utf8str_to_path(m_mod1_obj.file_rel_strs[3]);
+  auto cfg_file = m_cfg_dir / std::to_string(tar1_ret.data) /
+                  m_mod1_obj.mod_name / file_rel;
+  auto blob = m_cfg_dir / filemod::BLOB_DIR /
+              filemod::hash_file(cfg_file).substr(0, 2) /
+              filemod::hash_file(cfg_file);
+  // the blob and both mod files
+  EXPECT_EQ(3, std::filesystem::hard_link_count(blob));
+
+  // still referenced by mod2
+  EXPECT_TRUE(m_modder.remove_mods({mod1_ret.data}).success);
+  EXPECT_TRUE(std::filesystem::exists(blob));
+
+  EXPECT_TRUE(m_modder.remove_mods({mod2_ret.data}).success);
+  EXPECT_FALSE(std::filesystem::exists(blob));
+}
+
+// test verify_mods and verify_target after files are changed
+TEST_F(FilemodTest, verify) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar_ret.data, m_mod2_dir);
+  ASSERT_TRUE(mod1_ret.success);
+  ASSERT_TRUE(mod2_ret.success);
+
+  auto verify_ret = m_modder.verify_target(tar_ret.data);
+  ASSERT_TRUE(verify_ret.success);
+  EXPECT_TRUE(verify_ret.data.empty());
+
+  // modify a stored file and delete an installed link
+  auto cfg_tar = m_cfg_dir / std::to_string(tar_ret.data);
+  std::ofstream{cfg_tar / m_mod2_obj.mod_name / "mod2" / "asset" / "a.so"}
+      << "changed";
+  auto file_rel = filemod::utf8str_to_path(m_mod1_obj.file_rel_strs[3]);
+  std::filesystem::remove(m_game1_dir / file_rel);
+
+  verify_ret = m_modder.verify_mods({mod1_ret.data, mod2_ret.data});
+  ASSERT_TRUE(verify_ret.success);
+  ASSERT_EQ(2, verify_ret.data.size());
+  EXPECT_EQ(mod1_ret.data, verify_ret.data[0].mod_id);
+  EXPECT_EQ(m_mod1_obj.file_rel_strs[3], verify_ret.data[0].dir);
+  EXPECT_EQ(filemod::FileIssue::Unlinked, verify_ret.data[0].issue);
+  EXPECT_EQ(mod2_ret.data, verify_ret.data[1].mod_id);
+  EXPECT_EQ(filemod::FileIssue::Modified, verify_ret.data[1].issue);
+
+  EXPECT_FALSE(m_modder.verify_mods({mod2_ret.data + 1}).success);
+}
+
+// test status after a link is removed and another is replaced
+TEST_F(FilemodTest, status) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.install_path(tar_ret.data, m_mod2_dir);
+  ASSERT_TRUE(mod1_ret.success);
+  ASSERT_TRUE(mod2_ret.success);
+
+  auto status_ret = m_modder.status({});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+
+  auto file1_rel = filemod::utf8str_to_path(m_mod1_obj.file_rel_strs[3]);
+  auto file2_rel = filemod::utf8str_to_path(m_mod2_obj.file_rel_strs[2]);
+  std::filesystem::remove(m_game1_dir / file1_rel);
+  std::filesystem::remove(m_game1_dir / file2_rel);
+  std::ofstream{m_game1_dir / file2_rel} << "updated by game";
+
+  status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  ASSERT_EQ(2, status_ret.data.size());
+  EXPECT_EQ(mod1_ret.data, status_ret.data[0].mod_id);
+  EXPECT_EQ(filemod::FileDrift::Missing, status_ret.data[0].drift);
+  EXPECT_EQ(mod2_ret.data, status_ret.data[1].mod_id);
+  EXPECT_EQ(m_mod2_obj.file_rel_strs[2], status_ret.data[1].dir);
+  EXPECT_EQ(filemod::FileDrift::Replaced, status_ret.data[1].drift);
+
+  EXPECT_FALSE(m_modder.status({tar_ret.data + 1}).success);
+}
+
+// test repair_target recreates a missing link and backs up a new game file
+TEST_F(FilemodTest, repair_target) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.install_path(tar_ret.data, m_mod2_dir);
+  ASSERT_TRUE(mod1_ret.success);
+  ASSERT_TRUE(mod2_ret.success);
+
+  auto file1_rel = filemod::utf8str_to_path(m_mod1_obj.file_rel_strs[3]);
+  auto file2_rel = filemod::utf8str_to_path(m_mod2_obj.file_rel_strs[2]);
+  std::filesystem::remove_all(m_game1_dir / file1_rel.parent_path());
+  std::filesystem::remove(m_game1_dir / file2_rel);
+  std::ofstream{m_game1_dir / file2_rel} << "updated by game";
+
+  EXPECT_TRUE(m_modder.repair_target(tar_ret.data).success);
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / file1_rel));
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / file2_rel));
+  auto status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+
+  // the game file is restored
+  EXPECT_TRUE(m_modder.uninstall_mods({mod2_ret.data}).success);
+  std::string content;
+  std::ifstream{m_game1_dir / file2_rel} >> content;
+  EXPECT_EQ("updated", content);
+}
+
+// test update_mod of an installed mod from a directory
+TEST_F(FilemodTest, update_mod) {
+  auto v1_dir = m_tmp_dir / "v1";
+  auto v2_dir = m_tmp_dir / "v2";
+  std::filesystem::create_directories(v1_dir / "a");
+  std::ofstream{v1_dir / "a" / "keep"} << "keep";
+  std::ofstream{v1_dir / "a" / "change"} << "old";
+  std::ofstream{v1_dir / "gone"} << "gone";
+  std::filesystem::create_directories(v2_dir);
+  std::filesystem::copy(v1_dir / "a", v2_dir / "a");
+  std::ofstream{v2_dir / "a" / "change"} << "new";
+  std::ofstream{v2_dir / "new"} << "new";
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.install_path(tar_ret.data, "mod", v1_dir);
+  ASSERT_TRUE(mod_ret.success);
+  auto cfg_mod = m_cfg_dir / std::to_string(tar_ret.data) / "mod";
+  auto keep_ino = filemod::lstat_meta(cfg_mod / "a" / "keep").ino;
+
+  auto update_ret = m_modder.update_mod(mod_ret.data, v2_dir);
+  ASSERT_TRUE(update_ret.success);
+
+  auto mods = m_modder.query_mods({mod_ret.data});
+  ASSERT_EQ(1, mods.size());
+  std::vector<std::string> files{"a", "a/change", "a/keep", "new"};
+  EXPECT_EQ(files, mods[0].files);
+  EXPECT_EQ(keep_ino, filemod::lstat_meta(cfg_mod / "a" / "keep").ino);
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "gone"));
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "new"));
+  std::string content;
+  std::ifstream{m_game1_dir / "a" / "change"} >> content;
+  EXPECT_EQ("new", content);
+
+  auto verify_ret = m_modder.verify_mods({mod_ret.data});
+  ASSERT_TRUE(verify_ret.success);
+  EXPECT_TRUE(verify_ret.data.empty());
+}
+
+// test update_mod from an archive
+TEST_F(FilemodTest, update_mod_archive) {
+  std::filesystem::path archive_file{m_tmp_dir / "__archive.zip"};
+  int r = write_archive(archive_file, m_mod2_dir, m_mod2_obj.file_rels());
+  EXPECT_TRUE(r > -1);
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.add_mod(tar_ret.data, "mod", m_mod1_dir);
+  ASSERT_TRUE(mod_ret.success);
+
+  EXPECT_TRUE(m_modder.update_mod(mod_ret.data, archive_file).success);
+  auto mods = m_modder.query_mods({mod_ret.data});
+  ASSERT_EQ(1, mods.size());
+  auto files = m_mod2_obj.file_rel_strs;
+  std::sort(files.begin(), files.end());
+  EXPECT_EQ(files, mods[0].files);
+}
+
+// test update_mod from an archive that cannot be extracted leaves no staged
+// files
+TEST_F(FilemodTest, update_mod_archive_corrupt) {
+  std::filesystem::path archive_file{m_tmp_dir / "__corrupt.zip"};
+  std::ofstream{archive_file} << "not an archive";
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.add_mod(tar_ret.data, "mod", m_mod1_dir);
+  ASSERT_TRUE(mod_ret.success);
+
+  try {
+    EXPECT_FALSE(m_modder.update_mod(mod_ret.data, archive_file).success);
+  } catch (std::exception &) {
+  }
+  auto staging_dir = (filemod::FS::get_tmp_dir() / filemod::TMP_EXTRACTED) /
+                     std::to_string(mod_ret.data);
+  EXPECT_FALSE(std::filesystem::exists(staging_dir));
+  EXPECT_EQ(m_mod1_obj.file_rel_strs.size(),
+            m_modder.query_mods({mod_ret.data})[0].files.size());
+}
+
+// test switching between profiles only touches the differing mods
+TEST_F(FilemodTest, switch_profile) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar_ret.data, m_mod2_dir);
+  ASSERT_TRUE(m_modder.install_mods({mod1_ret.data}).success);
+  ASSERT_TRUE(m_modder.save_profile(tar_ret.data, "one").success);
+  ASSERT_TRUE(m_modder
+                  .save_profile(tar_ret.data, "both",
+                                {mod1_ret.data, mod2_ret.data})
+                  .success);
+  EXPECT_FALSE(m_modder.save_profile(tar_ret.data, "bad", {0}).success);
+
+  auto mod1_link = m_game1_dir / filemod::utf8str_to_path(
+                                     m_mod1_obj.file_rel_strs.back());
+  auto mod1_ino = filemod::lstat_meta(mod1_link).ino;
+
+  ASSERT_TRUE(m_modder.switch_profile(tar_ret.data, "both").success);
+  auto mods = m_modder.query_mods({mod1_ret.data, mod2_ret.data});
+  ASSERT_EQ(2, mods.size());
+  EXPECT_EQ(filemod::ModStatus::Installed, mods[0].status);
+  EXPECT_EQ(filemod::ModStatus::Installed, mods[1].status);
+  // mod1 is in both profiles, its links are untouched
+  EXPECT_EQ(mod1_ino, filemod::lstat_meta(mod1_link).ino);
+
+  ASSERT_TRUE(m_modder.switch_profile(tar_ret.data, "one").success);
+  mods = m_modder.query_mods({mod1_ret.data, mod2_ret.data});
+  EXPECT_EQ(filemod::ModStatus::Installed, mods[0].status);
+  EXPECT_EQ(filemod::ModStatus::Uninstalled, mods[1].status);
+  EXPECT_FALSE(m_modder.switch_profile(tar_ret.data, "none").success);
+
+  // removed mods leave their profiles
+  ASSERT_TRUE(m_modder.remove_mods({mod2_ret.data}).success);
+  auto profiles = m_modder.query_profiles(tar_ret.data);
+  ASSERT_EQ(2, profiles.size());
+  EXPECT_EQ("both", profiles[0].name);
+  EXPECT_EQ(std::vector<int64_t>{mod1_ret.data}, profiles[0].mod_ids);
+
+  EXPECT_TRUE(m_modder.remove_profile(tar_ret.data, "both").success);
+  EXPECT_EQ(1, m_modder.query_profiles(tar_ret.data).size());
+}
+
+// test atomic target is activated through a new generation
+TEST_F(FilemodTest, install_target_atomic) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  ASSERT_TRUE(m_modder.set_atomic(tar_ret.data, true).success);
+  auto mod_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
+  m_modder.add_mod(tar_ret.data, "conflict", m_mod1_dir);
+
+  // the conflicting mod fails the whole activation
+  EXPECT_FALSE(m_modder.install_target(tar_ret.data).success);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+
+  m_modder.remove_mods({mod_ret.data + 1});
+  ASSERT_TRUE(m_modder.install_target(tar_ret.data).success);
+  auto it = std::filesystem::recursive_directory_iterator(m_game1_dir);
+  EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), std::distance(begin(it), end(it)));
+  auto next_dir = m_game1_dir;
+  next_dir += filemod::GEN_NEXT_SUFFIX;
+  EXPECT_FALSE(std::filesystem::exists(next_dir));
+  auto status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+
+  ASSERT_TRUE(m_modder.uninstall_target(tar_ret.data).success);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+}
+
+// test mods of the generation replaced by the last activation are installed
+// again
+TEST_F(FilemodTest, activate_prev) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  EXPECT_FALSE(m_modder.activate_prev(tar_ret.data).success);
+  ASSERT_TRUE(m_modder.set_atomic(tar_ret.data, true).success);
+  auto mod_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
+  // no activation yet
+  EXPECT_FALSE(m_modder.activate_prev(tar_ret.data).success);
+
+  ASSERT_TRUE(m_modder.install_target(tar_ret.data).success);
+  ASSERT_TRUE(m_modder.activate_prev(tar_ret.data).success);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+  EXPECT_EQ(filemod::ModStatus::Uninstalled,
+            m_modder.query_mods({mod_ret.data})[0].status);
+  EXPECT_TRUE(m_modder.query_profiles(tar_ret.data).empty());
+
+  // and back again
+  ASSERT_TRUE(m_modder.activate_prev(tar_ret.data).success);
+  auto it = std::filesystem::recursive_directory_iterator(m_game1_dir);
+  EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), std::distance(begin(it), end(it)));
+  auto status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+  auto prev_dir = filemod::FS::get_prev_gen(m_game1_dir);
+  EXPECT_TRUE(std::filesystem::is_empty(prev_dir));
+  for (const auto &entry :
+       std::filesystem::directory_iterator(m_game1_dir.parent_path())) {
+    EXPECT_EQ(std::string::npos, entry.path().filename().string().find(
+                                     filemod::GEN_STALE_SUFFIX));
+  }
+}
+
+// test which mods provide files, as conflicts are found
+TEST_F(FilemodTest, which) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+  ASSERT_TRUE(mod_ret.success);
+  auto file = m_game1_dir / filemod::utf8str_to_path(
+                                m_mod1_obj.file_rel_strs.back());
+
+  auto which_ret = m_modder.which(file);
+  ASSERT_TRUE(which_ret.success);
+  ASSERT_EQ(1, which_ret.data.size());
+  EXPECT_EQ(mod_ret.data, which_ret.data[0].id);
+  EXPECT_FALSE(m_modder.which(m_tmp_dir).success);
+
+  // the failed install leaves the index as it was
+  auto other_ret = m_modder.install_path(tar_ret.data, "other", m_mod1_dir);
+  EXPECT_FALSE(other_ret.success);
+  which_ret = m_modder.which(file);
+  ASSERT_EQ(1, which_ret.data.size());
+  EXPECT_EQ(mod_ret.data, which_ret.data[0].id);
+
+  ASSERT_TRUE(m_modder.uninstall_mods({mod_ret.data}).success);
+  which_ret = m_modder.which(file);
+  ASSERT_TRUE(which_ret.success);
+  EXPECT_TRUE(which_ret.data.empty());
+}
+
+TEST(UtilsTest, ascii_fold) {
+  EXPECT_EQ("", filemod::ascii_fold(""));
+  EXPECT_EQ("textures/a.dds", filemod::ascii_fold("Textures/A.DDS"));
+  // longer than a vector, non-ASCII bytes kept
+  EXPECT_EQ("@[`{ textures/ÄÖ/az_long_name_0123.dds",
+            filemod::ascii_fold("@[`{ TEXTURES/ÄÖ/AZ_Long_Name_0123.dds"));
+}
+
+static void write_file(const std::filesystem::path &file) {
+  std::filesystem::create_directories(file.parent_path());
+  std::ofstream{file} << file.filename().string();
+}
+
+// Overwrite the CRC-32 of `name` in the central directory of zip `zip`.
+static void set_zip_crc(const std::filesystem::path &zip,
+                        const std::string &name, uint32_t crc) {
+  std::fstream file{zip, std::ios::in | std::ios::out | std::ios::binary};
+  std::string bytes{std::istreambuf_iterator<char>{file}, {}};
+  std::string header{"PK\x01\x02", 4};
+  for (auto pos = bytes.find(header); pos != std::string::npos;
+       pos = bytes.find(header, pos + 1)) {
+    if (bytes.compare(pos + 46, name.size(), name) == 0) {
+      file.seekp(static_cast<std::streamoff>(pos + 16));
+      for (int i = 0; i < 4; ++i) {
+        file.put(static_cast<char>(crc >> (8 * i)));
+      }
+    }
+  }
+}
+
+// test update_mod from a zip archive extracts only files w/ another CRC-32
+TEST_F(FilemodTest, update_mod_zip_crc) {
+  std::vector<std::filesystem::path> file_rels{"a/same", "a/changed"};
+  for (const auto &version : {"v1", "v2"}) {
+    std::filesystem::create_directories(m_tmp_dir / version / "a");
+    for (const auto &file_rel : file_rels) {
+      std::ofstream{m_tmp_dir / version / file_rel}
+          << version << file_rel.string();
+    }
+  }
+  write_file(m_tmp_dir / "v2" / "added");
+  auto v1_zip = m_tmp_dir / "v1.zip";
+  auto v2_zip = m_tmp_dir / "v2.zip";
+  ASSERT_TRUE(write_archive(v1_zip, m_tmp_dir / "v1", file_rels) > -1);
+  file_rels.emplace_back("added");
+  ASSERT_TRUE(write_archive(v2_zip, m_tmp_dir / "v2", file_rels) > -1);
+  auto v1_crcs = filemod::read_zip_crcs(v1_zip);
+  ASSERT_EQ(2, v1_crcs.size());
+  EXPECT_NE(v1_crcs["a/same"].crc,
+            filemod::read_zip_crcs(v2_zip)["a/same"].crc);
+  // a file of the recorded CRC-32 is taken as unchanged, w/o extracting it
+  set_zip_crc(v2_zip, "a/same", v1_crcs["a/same"].crc);
+
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.add_mod_a(tar_ret.data, "mod", v1_zip);
+  ASSERT_TRUE(mod_ret.success);
+  ASSERT_TRUE(m_modder.install_mods({mod_ret.data}).success);
+  ASSERT_TRUE(m_modder.update_mod(mod_ret.data, v2_zip).success);
+
+  std::string content;
+  std::ifstream{m_game1_dir / "a" / "same"} >> content;
+  EXPECT_EQ("v1a/same", content);
+  std::ifstream{m_game1_dir / "a" / "changed"} >> content;
+  EXPECT_EQ("v2a/changed", content);
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "added"));
+  std::vector<std::string> files{"a", "a/changed", "a/same", "added"};
+  EXPECT_EQ(files, m_modder.query_mods({mod_ret.data})[0].files);
+  auto verify_ret = m_modder.verify_mods({mod_ret.data});
+  ASSERT_TRUE(verify_ret.success);
+  EXPECT_TRUE(verify_ret.data.empty());
+}
+
+// test files differing only in case conflict in a case-insensitive target
+TEST_F(FilemodTest, install_nocase) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  ASSERT_TRUE(m_modder.set_nocase(tar_ret.data, true).success);
+  write_file(m_game1_dir / "data" / "Readme.TXT");
+  write_file(m_tmp_dir / "upper" / "Textures" / "A.dds");
+  write_file(m_tmp_dir / "lower" / "textures" / "a.dds");
+  write_file(m_tmp_dir / "lower" / "DATA" / "readme.txt");
+
+  auto upper_ret = m_modder.install_path(tar_ret.data, m_tmp_dir / "upper");
+  ASSERT_TRUE(upper_ret.success);
+  EXPECT_FALSE(
+      m_modder.install_path(tar_ret.data, m_tmp_dir / "lower").success);
+
+  // the original file is backed up and restored regardless of case, the mod
+  // file linked into the existing directory
+  ASSERT_TRUE(m_modder.uninstall_mods({upper_ret.data}).success);
+  auto lower_ret = m_modder.install_path(tar_ret.data, m_tmp_dir / "lower");
+  ASSERT_TRUE(lower_ret.success);
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "DATA"));
+  EXPECT_TRUE(
+      std::filesystem::is_symlink(m_game1_dir / "data" / "Readme.TXT"));
+  auto status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+  auto verify_ret = m_modder.verify_mods({lower_ret.data});
+  ASSERT_TRUE(verify_ret.success);
+  EXPECT_TRUE(verify_ret.data.empty());
+  ASSERT_TRUE(m_modder.uninstall_mods({lower_ret.data}).success);
+  EXPECT_FALSE(
+      std::filesystem::is_symlink(m_game1_dir / "data" / "Readme.TXT"));
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "data" / "Readme.TXT"));
+
+  // a case-sensitive target keeps both
+  ASSERT_TRUE(m_modder.set_nocase(tar_ret.data, false).success);
+  ASSERT_TRUE(m_modder.install_mods({upper_ret.data, lower_ret.data}).success);
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "data" / "Readme.TXT"));
+}
+
+// test an archive w/o directory entries is extracted once, its parents are
+// recorded too
+TEST_F(FilemodTest, add_mod_archive_cached_no_dirs) {
+  auto mod_dir = m_tmp_dir / "nodirs";
+  std::vector<std::filesystem::path> file_rels{"a/b/c.txt", "a/d.txt"};
+  for (const auto &file_rel : file_rels) {
+    write_file(mod_dir / file_rel);
+  }
+  std::filesystem::path archive_file{m_tmp_dir / "__nodirs.zip"};
+  ASSERT_TRUE(write_archive(archive_file, mod_dir, file_rels) > -1);
+
+  auto tar1_ret = m_modder.add_target(m_game1_dir);
+  auto tar2_ret = m_modder.add_target(m_game2_dir);
+  auto mod1_ret = m_modder.add_mod_a(tar1_ret.data, "mod", archive_file);
+  ASSERT_TRUE(mod1_ret.success);
+  std::vector<std::string> files{"a", "a/b", "a/b/c.txt", "a/d.txt"};
+  EXPECT_EQ(files, m_modder.query_mods({mod1_ret.data})[0].files);
+
+  // permissions are no part of the content, a clone keeps them
+  auto cfg_mod1 = m_cfg_dir / std::to_string(tar1_ret.data) / "mod";
+  std::filesystem::permissions(cfg_mod1 / "a" / "d.txt",
+                               std::filesystem::perms::owner_read);
+  auto mod2_ret = m_modder.add_mod_a(tar2_ret.data, "mod", archive_file);
+  ASSERT_TRUE(mod2_ret.success);
+  auto cfg_mod2 = m_cfg_dir / std::to_string(tar2_ret.data) / "mod";
+  EXPECT_EQ(std::filesystem::perms::owner_read,
+            std::filesystem::status(cfg_mod2 / "a" / "d.txt").permissions());
+  EXPECT_EQ(files, m_modder.query_mods({mod2_ret.data})[0].files);
+}
+
+// test update_mod of a directory into a file w/ installed files loaded
+TEST_F(FilemodTest, update_mod_dir_to_file) {
+  write_file(m_tmp_dir / "v1" / "a" / "b");
+  write_file(m_tmp_dir / "v2" / "a");
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.install_path(tar_ret.data, "mod", m_tmp_dir / "v1");
+  ASSERT_TRUE(mod_ret.success);
+  ASSERT_TRUE(m_modder.install_path(tar_ret.data, m_mod1_dir).success);
+  ASSERT_TRUE(m_modder.which(m_game1_dir / "a" / "b").success);
+
+  auto update_ret = m_modder.update_mod(mod_ret.data, m_tmp_dir / "v2");
+  ASSERT_TRUE(update_ret.success) << update_ret.msg;
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "a"));
+  auto which_ret = m_modder.which(m_game1_dir / "a");
+  ASSERT_TRUE(which_ret.success);
+  ASSERT_EQ(1, which_ret.data.size());
+  EXPECT_EQ(mod_ret.data, which_ret.data[0].id);
+}
+
+// test update_mod adding a file in place of an original file of another case
+TEST_F(FilemodTest, update_mod_nocase) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  ASSERT_TRUE(m_modder.set_nocase(tar_ret.data, true).success);
+  write_file(m_game1_dir / "data" / "x.txt");
+  write_file(m_tmp_dir / "v1" / "Data" / "a.txt");
+  write_file(m_tmp_dir / "v2" / "Data" / "a.txt");
+  write_file(m_tmp_dir / "v2" / "Data" / "X.txt");
+
+  auto mod_ret = m_modder.install_path(tar_ret.data, "mod", m_tmp_dir / "v1");
+  ASSERT_TRUE(mod_ret.success);
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "Data"));
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "data" / "a.txt"));
+
+  ASSERT_TRUE(m_modder.update_mod(mod_ret.data, m_tmp_dir / "v2").success);
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "Data"));
+  EXPECT_TRUE(std::filesystem::is_symlink(m_game1_dir / "data" / "x.txt"));
+  auto status_ret = m_modder.status({tar_ret.data});
+  ASSERT_TRUE(status_ret.success);
+  EXPECT_TRUE(status_ret.data.empty());
+
+  // the original file comes back once the file is removed again
+  ASSERT_TRUE(m_modder.update_mod(mod_ret.data, m_tmp_dir / "v1").success);
+  EXPECT_FALSE(std::filesystem::is_symlink(m_game1_dir / "data" / "x.txt"));
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "data" / "x.txt"));
+  ASSERT_TRUE(m_modder.uninstall_mods({mod_ret.data}).success);
+  EXPECT_TRUE(std::filesystem::exists(m_game1_dir / "data" / "x.txt"));
+  EXPECT_FALSE(std::filesystem::exists(m_game1_dir / "data" / "a.txt"));
+}
+
+TEST_F(FilemodTest, transaction) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  write_file(m_tmp_dir / "conflict" / m_mod1_obj.file_rel_strs[3]);
+
+  // a failed call rolls back all calls before it
+  filemod::result<int64_t> ret;
+  m_modder.transaction([&]() -> filemod::result_base & {
+    ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+    if (ret.success) {
+      ret = m_modder.install_path(tar_ret.data, m_tmp_dir / "conflict");
+    }
+    return ret;
+  });
+  EXPECT_FALSE(ret.success);
+  EXPECT_TRUE(m_modder.query_targets({tar_ret.data})[0].ModDtos.empty());
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+
+  m_modder.transaction([&]() -> filemod::result_base & {
+    ret = m_modder.install_path(tar_ret.data, m_mod1_dir);
+    if (ret.success) {
+      ret = m_modder.install_path(tar_ret.data, m_mod2_dir);
+    }
+    return ret;
+  });
+  ASSERT_TRUE(ret.success);
+  EXPECT_EQ(2, m_modder.query_targets({tar_ret.data})[0].ModDtos.size());
+  EXPECT_FALSE(std::filesystem::is_empty(m_game1_dir));
+}
+
+TEST_F(FilemodTest, list) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar_ret.data, m_mod2_dir);
+  ASSERT_TRUE(m_modder.install_mods({mod1_ret.data}).success);
+
+  std::ostringstream text;
+  m_modder.list_mods(text, {});
+  EXPECT_EQ(m_modder.list_mods({mod1_ret.data, mod2_ret.data}), text.str());
+  auto mod1_text = m_modder.list_mods({mod1_ret.data});
+  EXPECT_EQ(0, text.str().find(mod1_text));
+  EXPECT_NE(std::string::npos, mod1_text.find("STATUS installed\n"));
+
+  // pages of mods by id
+  std::ostringstream ndjson;
+  m_modder.list_mods(ndjson, {},
+                     {.format = filemod::ListFormat::NdJson, .limit = 1,
+                      .offset = 1});
+  auto line = ndjson.str();
+  EXPECT_EQ(std::string::npos, line.find('\n'));
+  EXPECT_EQ(0, line.find("{\"id\":" + std::to_string(mod2_ret.data) +
+                         ",\"target_id\":" + std::to_string(tar_ret.data)));
+  EXPECT_NE(std::string::npos, line.find("\"status\":\"not_installed\""));
+
+  std::ostringstream json;
+  m_modder.list_targets(json, {}, {.format = filemod::ListFormat::Json});
+  EXPECT_EQ(0, json.str().find("[\n{\"id\":" + std::to_string(tar_ret.data)));
+  EXPECT_EQ('[', json.str().front());
+  EXPECT_EQ(']', json.str().back());
+  EXPECT_NE(std::string::npos, json.str().find("\"mods\":[{\"id\":"));
+
+  std::ostringstream empty;
+  m_modder.list_targets(empty, {}, {.format = filemod::ListFormat::Json,
+                                    .offset = 1});
+  EXPECT_EQ("[]", empty.str());
+}
+
+TEST_F(FilemodTest, async) {
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod1_ret = m_modder.add_mod(tar_ret.data, m_mod1_dir);
+  auto mod2_ret = m_modder.add_mod(tar_ret.data, m_mod2_dir);
+
+  auto install = [&](filemod::modder &m) {
+    return m.install_mods({mod1_ret.data, mod2_ret.data});
+  };
+  filemod::progress last;
+  auto on_progress = [&](const filemod::progress &p) { last = p; };
+  auto ins_ret = m_modder.async(install, {}, on_progress).get();
+  ASSERT_TRUE(ins_ret.success);
+  EXPECT_GT(last.files_done, 0);
+  EXPECT_EQ(last.files_total, last.files_done);
+  auto mods = m_modder.query_mods({mod1_ret.data, mod2_ret.data});
+  EXPECT_EQ(filemod::ModStatus::Installed, mods[0].status);
+  EXPECT_EQ(filemod::ModStatus::Installed, mods[1].status);
+}
+
+// progress is reported w/o holding the task lock, so the callback may add
+// work found
+TEST_F(FilemodTest, async_progress_add_total) {
+  filemod::progress last;
+  filemod::task *reporting = nullptr;
+  filemod::task t{{}, [&](const filemod::progress &p) {
+                    last = p;
+                    if (p.files_total == 1) {
+                      reporting->add_total(1, 0);
+                    }
+                  }};
+  reporting = &t;
+  t.add_total(1, 0);
+  t.add_done(1, 0);
+  t.add_done(1, 0);
+  EXPECT_EQ(2, last.files_done);
+  EXPECT_EQ(2, last.files_total);
+}
+
+TEST_F(FilemodTest, async_cancel) {
+  std::filesystem::path big_mod_dir{m_tmp_dir / "big_mod"};
+  std::vector<std::filesystem::path> file_rels{"data"};
+  std::filesystem::create_directories(big_mod_dir / "data");
+  for (int i = 0; i < 200; ++i) {
+    auto file_rel = std::filesystem::path{"data"} / std::to_string(i);
+    std::ofstream{big_mod_dir / file_rel} << std::string(i * 100, 'x') << i;
+    file_rels.push_back(file_rel);
+  }
+  std::filesystem::path archive_file{m_tmp_dir / "__big_archive.zip"};
+  ASSERT_TRUE(write_archive(archive_file, big_mod_dir, file_rels) > -1);
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+
+  // stopped halfway through extraction, all extracted files are rolled back
+  std::stop_source stop;
+  auto add = [&](filemod::modder &m) {
+    return m.add_mod_a(tar_ret.data, "big_mod", archive_file);
+  };
+  auto on_progress = [&](const filemod::progress &p) {
+    if (p.files_done >= 10) {
+      stop.request_stop();
+    }
+  };
+  auto add_ret = m_modder.async(add, stop.get_token(), on_progress).get();
+  EXPECT_FALSE(add_ret.success);
+  EXPECT_EQ(filemod::ERR_CANCELLED, add_ret.msg);
+  EXPECT_TRUE(m_modder.query_targets({tar_ret.data})[0].ModDtos.empty());
+  EXPECT_FALSE(std::filesystem::exists(m_cfg_dir /
+                                       std::to_string(tar_ret.data) /
+                                       "big_mod"));
+
+  // the modder is usable again, stop requested before the call changes nothing
+  auto install = [&](filemod::modder &m) {
+    return m.install_path(tar_ret.data, m_mod1_dir);
+  };
+  auto ins_ret = m_modder.async(install, stop.get_token()).get();
+  EXPECT_FALSE(ins_ret.success);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+
+  add_ret = m_modder.async(add).get();
+  EXPECT_TRUE(add_ret.success);
+}
+
+// symlinks are reported once made, those made before cancelling are rolled
+// back
+TEST_F(FilemodTest, async_cancel_install) {
+  std::filesystem::path big_mod_dir{m_tmp_dir / "big_mod"};
+  std::filesystem::create_directories(big_mod_dir / "data");
+  for (int i = 0; i < 200; ++i) {
+    std::ofstream{big_mod_dir / "data" / std::to_string(i)} << i;
+  }
+  auto tar_ret = m_modder.add_target(m_game1_dir);
+  auto mod_ret = m_modder.add_mod(tar_ret.data, big_mod_dir);
+  ASSERT_TRUE(mod_ret.success);
+
+  std::stop_source stop;
+  auto install = [&](filemod::modder &m) {
+    return m.install_mods({mod_ret.data});
+  };
+  uint64_t files_done = 0;
+  auto on_progress = [&](const filemod::progress &p) {
+    files_done = p.files_done;
+    if (p.files_done >= 10) {
+      stop.request_stop();
+    }
+  };
+  auto ins_ret = m_modder.async(install, stop.get_token(), on_progress).get();
+  EXPECT_FALSE(ins_ret.success);
+  EXPECT_EQ(filemod::ERR_CANCELLED, ins_ret.msg);
+  EXPECT_GE(files_done, 10);
+  EXPECT_TRUE(std::filesystem::is_empty(m_game1_dir));
+  EXPECT_EQ(filemod::ModStatus::Uninstalled,
+            m_modder.query_mods({mod_ret.data})[0].status);
+}
+
 // test rename mod
 TEST_F(FilemodTest, test_rename_mod) {
   auto tar_ret = m_modder.add_target(m_game1_dir);
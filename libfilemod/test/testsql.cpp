@@ -1,5 +1,10 @@
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "filemod/sql.hpp"
@@ -101,6 +106,41 @@ TEST_F(DBTest, query_mods_w_files) {
   EXPECT_EQ(m_mod1_obj.file_rel_strs.size(), mod.files.size());
 }
 
+TEST_F(DBTest, query_mod_views) {
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  auto mod1_id = insert_mod1(tar_id);
+  auto mod2_id = insert_mod2(tar_id);
+  m_db.install_mod(mod2_id, m_bak_file_rel_strs);
+
+  auto sorted = [](std::span<const std::string_view> views) {
+    std::vector<std::string> strs{views.begin(), views.end()};
+    std::sort(strs.begin(), strs.end());
+    return strs;
+  };
+  auto sorted_strs = [](std::vector<std::string> strs) {
+    std::sort(strs.begin(), strs.end());
+    return strs;
+  };
+
+  // views are valid in the moved result
+  auto views = m_db.query_mod_views({});
+  auto moved = std::move(views);
+  ASSERT_EQ(2, moved.mods.size());
+  auto &mod1 = moved.mods[0];
+  EXPECT_EQ(mod1_id, mod1.id);
+  EXPECT_EQ(tar_id, mod1.tar_id);
+  EXPECT_EQ(m_mod1_obj.mod_name, mod1.dir);
+  EXPECT_EQ(sorted_strs(m_mod1_obj.file_rel_strs), sorted(mod1.files));
+  EXPECT_TRUE(mod1.bak_files.empty());
+  auto &mod2 = moved.mods[1];
+  EXPECT_EQ(filemod::ModStatus::Installed, mod2.status);
+  EXPECT_EQ(sorted_strs(m_mod2_obj.file_rel_strs), sorted(mod2.files));
+  EXPECT_EQ(sorted_strs(m_bak_file_rel_strs), sorted(mod2.bak_files));
+  EXPECT_EQ(9, moved.paths.size());
+
+  EXPECT_TRUE(m_db.query_mod_views({mod2_id + 1}).mods.empty());
+}
+
 TEST_F(DBTest, query_targets_mods) {
   auto tar_id = m_db.insert_target(m_game1_dir.string());
   auto mod_id = insert_mod1(tar_id);
@@ -179,4 +219,137 @@ TEST_F(DBTest, uninstall_mod) {
   auto &mod = mods[0];
   EXPECT_EQ(filemod::ModStatus::Uninstalled, mod.status);
   EXPECT_TRUE(mod.bak_files.empty());
-}
\ No newline at end of file
+}
+
+TEST_F(DBTest, query_mods_by_archive) {
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  auto mod1_id = insert_mod1(tar_id);
+  auto mod2_id = insert_mod2(tar_id);
+  m_db.insert_archive(mod1_id, "0123456789abcdef");
+  m_db.insert_archive(mod2_id, "fedcba9876543210");
+
+  auto mods = m_db.query_mods_by_archive("0123456789abcdef");
+  ASSERT_EQ(1, mods.size());
+  EXPECT_EQ(mod1_id, mods[0].id);
+
+  m_db.delete_mod(mod1_id);
+  EXPECT_TRUE(m_db.query_mods_by_archive("0123456789abcdef").empty());
+}
+
+TEST_F(DBTest, release_blobs) {
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  auto mod1_id = insert_mod1(tar_id);
+  auto mod2_id = insert_mod2(tar_id);
+  m_db.update_mod_file_hashes(mod1_id,
+                              {{.dir = "mod1/资产/a.so", .hash = "aa", .blob = true}});
+  m_db.update_mod_file_hashes(
+      mod2_id, {{.dir = "mod2/asset/a.so", .hash = "aa", .blob = true},
+                {.dir = "mod2/asset", .hash = "bb", .blob = false}});
+
+  EXPECT_TRUE(m_db.release_blobs(mod1_id).empty());
+  m_db.delete_mod(mod1_id);
+
+  auto hashes = m_db.release_blobs(mod2_id);
+  ASSERT_EQ(1, hashes.size());
+  EXPECT_EQ("aa", hashes[0]);
+}
+
+TEST_F(DBTest, save_profile) {
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  auto mod1_id = insert_mod1(tar_id);
+  auto mod2_id = insert_mod2(tar_id);
+  auto id = m_db.save_profile(tar_id, "full", {mod2_id, mod1_id});
+  EXPECT_EQ(id, m_db.save_profile(tar_id, "full", {mod2_id, mod1_id}));
+
+  auto ret = m_db.query_profile(tar_id, "full");
+  ASSERT_TRUE(ret.success);
+  EXPECT_EQ(id, ret.data.id);
+  EXPECT_EQ((std::vector<int64_t>{mod1_id, mod2_id}), ret.data.mod_ids);
+
+  m_db.delete_mod(mod1_id);
+  auto profiles = m_db.query_profiles(tar_id);
+  ASSERT_EQ(1, profiles.size());
+  EXPECT_EQ(std::vector<int64_t>{mod2_id}, profiles[0].mod_ids);
+
+  EXPECT_EQ(1, m_db.delete_profile(id));
+  EXPECT_FALSE(m_db.query_profile(tar_id, "full").success);
+}
+
+TEST_F(DBTest, update_target_bloom) {
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  EXPECT_FALSE(m_db.query_target_bloom(tar_id).success);
+
+  std::vector<unsigned char> bytes{1, 0, 2, 0, 3};
+  m_db.update_target_bloom(tar_id, bytes);
+  m_db.update_target_bloom(tar_id, bytes);
+  auto ret = m_db.query_target_bloom(tar_id);
+  ASSERT_TRUE(ret.success);
+  EXPECT_EQ(bytes, ret.data);
+
+  m_db.delete_target(tar_id);
+  EXPECT_FALSE(m_db.query_target_bloom(tar_id).success);
+}
+
+TEST_F(DBTest, find_files) {
+  using files_t = std::vector<std::pair<std::string, int64_t>>;
+  auto tar_id = m_db.insert_target(m_game1_dir.string());
+  auto mod1_id = insert_mod1(tar_id);
+  auto mod2_id = insert_mod2(tar_id);
+  m_db.install_mod(mod2_id, {});
+
+  EXPECT_EQ((files_t{{"mod1/资产", mod1_id}, {"mod1/资产/a.so", mod1_id}}),
+            m_db.find_files(tar_id, "mod1/*"));
+  EXPECT_EQ(
+      (files_t{{"mod1/资产/a.so", mod1_id}, {"mod2/asset/a.so", mod2_id}}),
+      m_db.find_files(tar_id, "*/a.so"));
+  EXPECT_EQ((files_t{{"mod2/asset/a.so", mod2_id}}),
+            m_db.find_files(tar_id, "*/a.so", true));
+  EXPECT_EQ(7, m_db.find_files(tar_id, "*").size());
+  EXPECT_TRUE(m_db.find_files(tar_id + 1, "*").empty());
+
+  m_db.delete_mod_files(mod2_id, {"mod2/asset/a.so"});
+  EXPECT_EQ((files_t{{"mod1/资产/a.so", mod1_id}}),
+            m_db.find_files(tar_id, "*/a.so"));
+  m_db.delete_mod(mod1_id);
+  EXPECT_TRUE(m_db.find_files(tar_id, "*/a.so").empty());
+  EXPECT_EQ((files_t{{"mod2/asset", mod2_id}}),
+            m_db.find_files(tar_id, "*asse*"));
+}
+
+TEST(StringArenaTest, push_back) {
+  filemod::string_arena arena;
+  std::vector<std::string> strs;
+  for (int i = 0; i < 100; ++i) {
+    strs.push_back(std::string(i % 7, 'a' + i % 26));
+    arena.push_back(strs.back());
+  }
+
+  // views are rebased as the buffer grows
+  ASSERT_EQ(strs.size(), arena.size());
+  size_t bytes = 0;
+  for (size_t i = 0; i < strs.size(); ++i) {
+    EXPECT_EQ(strs[i], arena[i]);
+    bytes += strs[i].size();
+  }
+  EXPECT_EQ(bytes, arena.bytes());
+  auto views = arena.views(10, 20);
+  EXPECT_EQ((std::vector<std::string>{strs.begin() + 10, strs.begin() + 20}),
+            (std::vector<std::string>{views.begin(), views.end()}));
+}
+
+TEST_F(DBTest, read_only) {
+  std::filesystem::create_directories(m_tmp_dir);
+  auto path = (m_tmp_dir / filemod::DBFILE).string();
+  {
+    // a missing database is created regardless
+    filemod::DB db{path, true};
+    EXPECT_LT(0, db.insert_target(m_game1_dir.string()));
+  }
+
+  filemod::DB writer{path};
+  filemod::DB reader{path, true};
+  auto id = writer.insert_target(m_game2_dir.string());
+  EXPECT_TRUE(reader.query_target(id).success);
+  EXPECT_ANY_THROW(reader.insert_target(m_game2_dir.string()));
+  std::filesystem::remove_all(m_tmp_dir);
+}
@@ -2,13 +2,23 @@
 // Created by Joe Tse on 11/26/23.
 //
 #include <boost/program_options.hpp>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <exception>
+#include <filemod/ipc.hpp>
+#include <filemod/lock.hpp>
 #include <filemod/modder.hpp>
 #include <filemod/utils.hpp>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <system_error>
 #include <vector>
 
 #include "boost/program_options/options_description.hpp"
@@ -28,6 +38,29 @@ typedef char mychar;
 
 namespace po = boost::program_options;
 
+// kept open by `filemod serve` across commands
+static std::unique_ptr<filemod::modder> g_modder;
+static bool g_serving = false;
+static bool g_stop_serving = false;
+// lock of config directory held by the outermost command, commands it runs,
+// e.g. of a batch, run under it
+static filemod::file_lock g_lock;
+// whether the command holding `g_lock` only reads
+static bool g_read_only = false;
+
+static filemod::modder &get_modder() {
+  if (!g_modder) {
+    g_modder = std::make_unique<filemod::modder>(g_read_only);
+  }
+  return *g_modder;
+}
+
+// Whether command `cmd` does not change targets, mods or the database.
+static bool is_read_only(const std::string &cmd) {
+  return "list" == cmd || "which" == cmd || "find" == cmd || "verify" == cmd ||
+         "status" == cmd;
+}
+
 static bool is_set(int64_t id) {
   return id != (std::numeric_limits<int64_t>::min)();
 }
@@ -69,25 +102,36 @@ static void parse_add(filemod::result_base &ret, std::ostringstream &oss,
                       std::string &dir) {
   po::options_description desc(
       "add target or mod\n"
-      "Usage: filemod add --tdir <target_dir>\n"
-      "       filemod add -t <target_id> [--name <mod_name>] --mdir "
+      "Usage: filemod add --tdir <target_dir> [--atomic] [--nocase]\n"
+      "       filemod add -t <target_id> [--name <mod_name>] [--dedup] --mdir "
       "<mod_dir>\n"
-      "       filemod add -t <target_id> [--name <mod_name>] --archive "
-      "<archive_path>\n"
+      "       filemod add -t <target_id> [--name <mod_name>] [--dedup] "
+      "--archive <archive_path>\n"
       "Options");
   desc.add_options()("tdir", po::value<std::string>(&dir), "target directory")(
       "tid,t", po::value<int64_t>(&id), "target id")(
       "name,n", po::value<std::string>(&name), "mod name")(
       "mdir,d", po::value<std::string>(&dir), "mod source files directory")(
-      "archive,a", po::value<std::string>(&dir), "mod archie path")("help,h",
-                                                                    "");
+      "archive,a", po::value<std::string>(&dir), "mod archie path")(
+      "dedup", "store identical mod files once")(
+      "atomic", "activate target atomically through generations")(
+      "nocase", "treat files differing only in case as the same")("help,h",
+                                                                  "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
+  md.set_dedup(vm.count("dedup") > 0);
 
   if (vm.count("help")) {
     oss << desc;
   } else if (vm.count("tdir")) {  // add target
-    move_to_retbase(md.add_target(filemod::utf8str_to_path(dir)), ret);
+    auto tar_ret = md.add_target(filemod::utf8str_to_path(dir));
+    if (tar_ret.success && vm.count("atomic")) {
+      md.set_atomic(tar_ret.data, true);
+    }
+    if (tar_ret.success && vm.count("nocase")) {
+      md.set_nocase(tar_ret.data, true);
+    }
+    move_to_retbase(std::move(tar_ret), ret);
   } else if (vm.count("tid") &&
              vm.count("mdir")) {  // add mod from mod source directory
     if (vm.count("name")) {
@@ -115,18 +159,20 @@ static void parse_install(filemod::result_base &ret, std::ostringstream &oss,
       "install mod(s)\n"
       "Usage: filemod install -t <target_id>\n"
       "       filemod install -m <mod_id1> [mod_id2] ...\n"
-      "       filemod install -t <target_id> [--name <mod_name>] --mdir "
-      "<mod_dir>\n"
-      "       filemod install -t <target_id> [--name <mod_name>] -a <archive>\n"
+      "       filemod install -t <target_id> [--name <mod_name>] [--dedup] "
+      "--mdir <mod_dir>\n"
+      "       filemod install -t <target_id> [--name <mod_name>] [--dedup] -a "
+      "<archive>\n"
       "Options");
   desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
       "name,n", po::value<std::string>(&name), "mod name")(
       "mdir,d", po::value<std::string>(&dir), "mod source directory")(
       "archive,a", po::value<std::string>(&dir), "mod archie path")(
       "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(), "mod ids")(
-      "help,h", "");
+      "dedup", "store identical mod files once")("help,h", "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
+  md.set_dedup(vm.count("dedup") > 0);
 
   if (vm.count("help")) {
     oss << desc;
@@ -170,7 +216,7 @@ static void parse_uninstall(filemod::result_base &ret, std::ostringstream &oss,
       "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(), "mod ids")(
       "help,h", "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
 
   if (vm.count("help")) {
     oss << desc;
@@ -196,7 +242,7 @@ static void parse_remove(filemod::result_base &ret, std::ostringstream &oss,
       "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(), "mod ids")(
       "help,h", "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
 
   if (vm.count("help")) {
     oss << desc;
@@ -211,25 +257,43 @@ static void parse_remove(filemod::result_base &ret, std::ostringstream &oss,
 
 static void parse_list(filemod::result_base &ret, std::ostringstream &oss,
                        po::basic_parsed_options<char> &parsed,
-                       po::variables_map &vm, std::vector<int64_t> &ids) {
+                       po::variables_map &vm, std::vector<int64_t> &ids,
+                       std::ostream &out) {
   po::options_description desc(
-      "display target(s) and mod(s) in database\n"
-      "Usage: filemod list [-t <target_id1> [target_id2] ...]\n"
-      "       filemod list -m <mod_id1> [mod_id2] ...\n"
+      "display target(s) and mod(s) in database, written as they are read\n"
+      "Usage: filemod list [-t <target_id1> [target_id2] ...] [options]\n"
+      "       filemod list -m [mod_id1] [mod_id2] ... [options]\n"
       "Options");
+  filemod::ListOptions opts;
   desc.add_options()(
       "tid,t", po::value<std::vector<int64_t>>(&ids)->multitoken(),
-      "target ids")("mid,m", po::value<std::vector<int64_t>>()->multitoken(),
-                    "mod ids")("help,h", "");
+      "target ids")(
+      "mid,m",
+      po::value<std::vector<int64_t>>()->multitoken()->zero_tokens(),
+      "mod ids, all mods if none")("json", "output one JSON array")(
+      "ndjson", "output one JSON object per line")(
+      "limit", po::value<int64_t>(&opts.limit),
+      "list at most this many targets or mods")(
+      "offset", po::value<int64_t>(&opts.offset),
+      "skip this many targets or mods first")("help,h", "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
+
+  if (vm.count("json")) {
+    opts.format = filemod::ListFormat::Json;
+  } else if (vm.count("ndjson")) {
+    opts.format = filemod::ListFormat::NdJson;
+  }
 
   if (vm.count("help")) {
     oss << desc;
-  } else if (vm.count("mid")) {  // list mods
-    ret.msg = md.list_mods(vm["mid"].as<std::vector<int64_t>>());
+  } else if (vm.count("json") && vm.count("ndjson")) {
+    parse_error(desc, oss, ret);
+  } else if (vm.count("mid")) {  // list mods, written as read from database
+    auto mod_ids = vm["mid"].as<std::vector<int64_t>>();
+    md.list_mods(out, mod_ids, opts);
   } else {  // list targets
-    ret.msg = md.list_targets(ids);
+    md.list_targets(out, ids, opts);
   }
 }
 
@@ -243,7 +307,7 @@ static void parse_rename(filemod::result_base &ret, std::ostringstream &oss,
   desc.add_options()("mid,m", po::value<int64_t>(&mid), "mod id")(
       "name,n", po::value<std::string>(&newname), "new mod name")("help,h", "");
   parse_subcmd(desc, parsed, vm);
-  filemod::modder md;
+  auto &md = get_modder();
 
   if (vm.count("help")) {
     oss << desc;
@@ -254,17 +318,674 @@ static void parse_rename(filemod::result_base &ret, std::ostringstream &oss,
   }
 }
 
-static int parse(int argc, char *argv[]) {
+static void parse_update(filemod::result_base &ret, std::ostringstream &oss,
+                         po::basic_parsed_options<char> &parsed,
+                         po::variables_map &vm, int64_t &mid,
+                         std::string &dir) {
+  po::options_description desc(
+      "update mod files in place from a new version\n"
+      "Usage: filemod update -m <mod_id> [--dedup] --mdir <mod_dir>\n"
+      "       filemod update -m <mod_id> [--dedup] --archive <archive_path>\n"
+      "Files of --mdir of the same size are read whole to compare them, files\n"
+      "of a zip archive only if their CRC-32 differs.\n"
+      "Options");
+  desc.add_options()("mid,m", po::value<int64_t>(&mid), "mod id")(
+      "mdir,d", po::value<std::string>(&dir), "mod source files directory")(
+      "archive,a", po::value<std::string>(&dir), "mod archive path")(
+      "dedup", "store identical mod files once")("help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+  md.set_dedup(vm.count("dedup") > 0);
+
+  if (vm.count("help")) {
+    oss << desc;
+  } else if (vm.count("mid") && (vm.count("mdir") || vm.count("archive"))) {
+    ret = md.update_mod(mid, filemod::utf8str_to_path(dir));
+  } else {
+    parse_error(desc, oss, ret);
+  }
+}
+
+static void parse_profile(filemod::result_base &ret, std::ostringstream &oss,
+                          po::basic_parsed_options<char> &parsed,
+                          po::variables_map &vm, int64_t &id,
+                          std::string &name, std::vector<int64_t> &ids) {
+  po::options_description desc(
+      "save, remove or list mod profiles of a target\n"
+      "Usage: filemod profile -t <target_id>\n"
+      "       filemod profile -t <target_id> --save -n <profile_name> "
+      "[-m <mod_id1> [mod_id2] ...]\n"
+      "       filemod profile -t <target_id> --remove -n <profile_name>\n"
+      "Options");
+  desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
+      "name,n", po::value<std::string>(&name), "profile name")(
+      "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(),
+      "mod ids, installed mods if omitted")(
+      "save", "save a profile")("remove", "remove a profile")("help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+  } else if (is_set(id) && vm.count("save") && is_set(name)) {
+    if (is_set(ids)) {
+      move_to_retbase(md.save_profile(id, name, ids), ret);
+    } else {
+      move_to_retbase(md.save_profile(id, name), ret);
+    }
+  } else if (is_set(id) && vm.count("remove") && is_set(name)) {
+    ret = md.remove_profile(id, name);
+  } else if (is_set(id)) {  // list profiles
+    for (const auto &profile : md.query_profiles(id)) {
+      oss << "PROFILE '" << profile.name << "' MOD_IDS";
+      for (auto mod_id : profile.mod_ids) {
+        oss << ' ' << mod_id;
+      }
+      oss << '\n';
+    }
+  } else {
+    parse_error(desc, oss, ret);
+  }
+}
+
+static void parse_switch(filemod::result_base &ret, std::ostringstream &oss,
+                         po::basic_parsed_options<char> &parsed,
+                         po::variables_map &vm, int64_t &id,
+                         std::string &name) {
+  po::options_description desc(
+      "install exactly the mods of a profile\n"
+      "Usage: filemod switch -t <target_id> -n <profile_name>\n"
+      "       filemod switch -t <target_id> --prev\n"
+      "Options");
+  desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
+      "name,n", po::value<std::string>(&name), "profile name")(
+      "prev", "mods installed before the last activation of an atomic target")(
+      "help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+  } else if (is_set(id) && vm.count("prev")) {
+    ret = md.activate_prev(id);
+  } else if (is_set(id) && is_set(name)) {
+    ret = md.switch_profile(id, name);
+  } else {
+    parse_error(desc, oss, ret);
+  }
+}
+
+static void parse_which(filemod::result_base &ret, std::ostringstream &oss,
+                        po::basic_parsed_options<char> &parsed,
+                        po::variables_map &vm, std::string &dir) {
+  po::options_description desc(
+      "display installed mods providing a file in a target\n"
+      "Usage: filemod which <path>\n"
+      "Options");
+  desc.add_options()("path", po::value<std::string>(&dir), "file path")(
+      "help,h", "");
+  po::positional_options_description pos;
+  pos.add("path", 1);
+  auto opts = po::collect_unrecognized(parsed.options, po::include_positional);
+  opts.erase(opts.begin());
+  po::store(po::command_line_parser(opts).options(desc).positional(pos).run(),
+            vm);
+  po::notify(vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+    return;
+  } else if (!is_set(dir)) {
+    parse_error(desc, oss, ret);
+    return;
+  }
+
+  auto which_ret = md.which(filemod::utf8str_to_path(dir));
+  if (!which_ret.success) {
+    ret = std::move(which_ret);
+    return;
+  }
+  if (which_ret.data.empty()) {
+    ret.success = false;
+    ret.msg = "not provided by any installed mod";
+    return;
+  }
+  for (const auto &mod : which_ret.data) {
+    oss << "MOD_ID " << mod.id << " DIR '" << mod.dir << "'\n";
+  }
+}
+
+static void parse_find(filemod::result_base &ret, std::ostringstream &oss,
+                       po::basic_parsed_options<char> &parsed,
+                       po::variables_map &vm, int64_t &id,
+                       std::string &pattern) {
+  po::options_description desc(
+      "display files of mods of a target matching a glob pattern, e.g.\n"
+      "'Data/Scripts/*' or '*.ini'\n"
+      "Usage: filemod find -t <target_id> [--installed] <pattern>\n"
+      "Options");
+  desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
+      "installed", "files of installed mods only")(
+      "pattern", po::value<std::string>(&pattern), "glob pattern")("help,h",
+                                                                    "");
+  po::positional_options_description pos;
+  pos.add("pattern", 1);
+  auto opts = po::collect_unrecognized(parsed.options, po::include_positional);
+  opts.erase(opts.begin());
+  po::store(po::command_line_parser(opts).options(desc).positional(pos).run(),
+            vm);
+  po::notify(vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+    return;
+  } else if (!is_set(id) || !vm.count("pattern")) {
+    parse_error(desc, oss, ret);
+    return;
+  }
+
+  auto find_ret = md.find_files(id, pattern, vm.count("installed"));
+  if (!find_ret.success) {
+    ret = std::move(find_ret);
+    return;
+  }
+  for (const auto &[file, mod_id] : find_ret.data) {
+    oss << "MOD_ID " << mod_id << " '" << file << "'\n";
+  }
+}
+
+static void parse_verify(filemod::result_base &ret, std::ostringstream &oss,
+                         po::basic_parsed_options<char> &parsed,
+                         po::variables_map &vm, int64_t &id,
+                         std::vector<int64_t> &ids) {
+  po::options_description desc(
+      "verify mod files and installed links\n"
+      "Usage: filemod verify -t <target_id>\n"
+      "       filemod verify -m <mod_id1> [mod_id2] ...\n"
+      "Options");
+  desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
+      "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(), "mod ids")(
+      "help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+
+  filemod::result<std::vector<filemod::FileIssueDto>> verify_ret;
+  if (vm.count("help")) {
+    oss << desc;
+    return;
+  } else if (is_set(id)) {
+    verify_ret = md.verify_target(id);
+  } else if (is_set(ids)) {
+    verify_ret = md.verify_mods(ids);
+  } else {
+    parse_error(desc, oss, ret);
+    return;
+  }
+
+  if (!verify_ret.success) {
+    ret = std::move(verify_ret);
+    return;
+  }
+  if (verify_ret.data.empty()) {
+    ret.msg = "ok";
+    return;
+  }
+
+  ret.success = false;
+  for (const auto &issue : verify_ret.data) {
+    oss << "MOD_ID " << issue.mod_id << " '" << issue.dir << "' ";
+    switch (issue.issue) {
+      case filemod::FileIssue::Missing:
+        oss << "missing\n";
+        break;
+      case filemod::FileIssue::Modified:
+        oss << "modified\n";
+        break;
+      case filemod::FileIssue::Unlinked:
+        oss << "unlinked\n";
+        break;
+    }
+  }
+}
+
+static void parse_status(filemod::result_base &ret, std::ostringstream &oss,
+                         po::basic_parsed_options<char> &parsed,
+                         po::variables_map &vm, std::vector<int64_t> &ids) {
+  po::options_description desc(
+      "display files of installed mods changed in target(s)\n"
+      "Usage: filemod status [-t <target_id1> [target_id2] ...]\n"
+      "Options");
+  desc.add_options()(
+      "tid,t", po::value<std::vector<int64_t>>(&ids)->multitoken(),
+      "target ids")("help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+    return;
+  }
+
+  auto status_ret = md.status(ids);
+  if (!status_ret.success) {
+    ret = std::move(status_ret);
+    return;
+  }
+  if (status_ret.data.empty()) {
+    ret.msg = "ok";
+    return;
+  }
+
+  ret.success = false;
+  for (const auto &drift : status_ret.data) {
+    oss << "MOD_ID " << drift.mod_id << " '" << drift.dir << "' ";
+    switch (drift.drift) {
+      case filemod::FileDrift::Missing:
+        oss << "missing\n";
+        break;
+      case filemod::FileDrift::Replaced:
+        oss << "replaced\n";
+        break;
+      case filemod::FileDrift::BackupMissing:
+        oss << "backup missing\n";
+        break;
+    }
+  }
+}
+
+static void parse_repair(filemod::result_base &ret, std::ostringstream &oss,
+                         po::basic_parsed_options<char> &parsed,
+                         po::variables_map &vm, int64_t &id,
+                         std::vector<int64_t> &ids) {
+  po::options_description desc(
+      "recreate missing or replaced files of installed mod(s)\n"
+      "Usage: filemod repair -t <target_id>\n"
+      "       filemod repair -m <mod_id1> [mod_id2] ...\n"
+      "Options");
+  desc.add_options()("tid,t", po::value<int64_t>(&id), "target id")(
+      "mid,m", po::value<std::vector<int64_t>>(&ids)->multitoken(), "mod ids")(
+      "help,h", "");
+  parse_subcmd(desc, parsed, vm);
+  auto &md = get_modder();
+
+  if (vm.count("help")) {
+    oss << desc;
+  } else if (is_set(id)) {  // repair all mods of a target
+    ret = md.repair_target(id);
+  } else if (is_set(ids)) {  // repair multiple mods
+    ret = md.repair_mods(ids);
+  } else {
+    parse_error(desc, oss, ret);
+  }
+}
+
+static int parse(int argc, char *argv[], std::ostream &out,
+                 std::ostream &err);
+
+// Run a command line sent by a client as the client would in process.
+static bool serve_request(const filemod::ipc_request &request,
+                          filemod::ipc_response &response) {
+  std::vector<std::string> args{filemod::FILEMOD};
+  args.insert(args.end(), request.args.begin(), request.args.end());
+  std::vector<char *> argv;
+  for (auto &arg : args) {
+    argv.push_back(arg.data());
+  }
+
+  std::ostringstream out;
+  std::ostringstream err;
+
+  std::error_code ec;
+  if (!request.cwd.empty()) {
+    std::filesystem::current_path(filemod::utf8str_to_path(request.cwd), ec);
+  }
+  if (ec) {
+    err << "error: cannot change directory to '" << request.cwd
+        << "': " << ec.message() << '\n';
+    response.code = 1;
+  } else {
+    try {
+      response.code =
+          parse(static_cast<int>(argv.size()), argv.data(), out, err);
+    } catch (std::exception &e) {
+      err << e.what() << '\n';
+      response.code = 1;
+    }
+  }
+  response.out = out.str();
+  response.err = err.str();
+  return !g_stop_serving;
+}
+
+static void parse_serve(filemod::result_base &ret, std::ostringstream &oss,
+                        po::basic_parsed_options<char> &parsed,
+                        po::variables_map &vm) {
+  po::options_description desc(
+      "serve commands of other filemod processes, keeping database and "
+      "indexes open\n"
+      "Usage: filemod serve [--stop]\n"
+      "Options");
+  desc.add_options()("stop", "stop the running server")("help,h", "");
+  parse_subcmd(desc, parsed, vm);
+
+  if (vm.count("help")) {
+    oss << desc;
+  } else if (g_serving) {  // sent by a client
+    if (vm.count("stop")) {
+      g_stop_serving = true;
+      ret.msg = "ok";
+    } else {
+      ret.success = false;
+      ret.msg = "error: already serving";
+    }
+  } else if (vm.count("stop")) {
+    auto send_ret = filemod::ipc_send(filemod::get_socket_path(),
+                                      {.args = {"serve", "--stop"}});
+    if (send_ret.success) {
+      ret.success = send_ret.data.code == 0;
+      auto &msg = ret.success ? send_ret.data.out : send_ret.data.err;
+      if (!msg.empty() && msg.back() == '\n') {
+        msg.pop_back();
+      }
+      ret.msg = std::move(msg);
+    } else {
+      ret.success = false;
+      ret.msg = send_ret.msg.empty() ? "error: not serving" : send_ret.msg;
+    }
+  } else {
+    get_modder();
+    g_serving = true;
+    auto serve_ret =
+        filemod::ipc_serve(filemod::get_socket_path(), serve_request);
+    g_serving = false;
+    ret.success = serve_ret.success;
+    ret.msg = serve_ret.success ? "ok" : std::move(serve_ret.msg);
+  }
+}
+
+static void append_utf8(std::string &str, uint32_t cp) {
+  if (cp < 0x80) {
+    str += static_cast<char>(cp);
+  } else if (cp < 0x800) {
+    str += static_cast<char>(0xc0 | (cp >> 6));
+    str += static_cast<char>(0x80 | (cp & 0x3f));
+  } else if (cp < 0x10000) {
+    str += static_cast<char>(0xe0 | (cp >> 12));
+    str += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    str += static_cast<char>(0x80 | (cp & 0x3f));
+  } else {
+    str += static_cast<char>(0xf0 | (cp >> 18));
+    str += static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+    str += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    str += static_cast<char>(0x80 | (cp & 0x3f));
+  }
+}
+
+static bool read_hex4(std::string_view str, size_t &i, uint32_t &value) {
+  if (i + 4 > str.size()) {
+    return false;
+  }
+  value = 0;
+  for (size_t end = i + 4; i < end; ++i) {
+    auto c = static_cast<unsigned char>(str[i]);
+    if (!std::isxdigit(c)) {
+      return false;
+    }
+    value = value * 16 +
+            (std::isdigit(c) ? c - '0' : std::tolower(c) - 'a' + 10);
+  }
+  return true;
+}
+
+// Append arguments of `line`, a JSON array of strings, to `args`. Returns false
+// if it is not one.
+static bool split_json_args(std::string_view line,
+                            std::vector<std::string> &args) {
+  size_t i = 0;
+  auto skip_spaces = [&] {
+    while (i < line.size() &&
+           std::isspace(static_cast<unsigned char>(line[i]))) {
+      ++i;
+    }
+  };
+  auto at = [&](char c) { return i < line.size() && line[i] == c; };
+
+  skip_spaces();
+  if (!at('[')) {
+    return false;
+  }
+  ++i;
+  skip_spaces();
+  if (at(']')) {
+    ++i;
+    skip_spaces();
+    return i == line.size();
+  }
+
+  while (true) {
+    skip_spaces();
+    if (!at('"')) {
+      return false;
+    }
+    ++i;
+    auto &arg = args.emplace_back();
+    while (!at('"')) {
+      if (i == line.size()) {
+        return false;
+      }
+      if (char c = line[i++]; c != '\\') {
+        arg += c;
+        continue;
+      }
+      if (i == line.size()) {
+        return false;
+      }
+      uint32_t cp;
+      switch (char c = line[i++]; c) {
+        case '"':
+        case '\\':
+        case '/':
+          arg += c;
+          break;
+        case 'b':
+          arg += '\b';
+          break;
+        case 'f':
+          arg += '\f';
+          break;
+        case 'n':
+          arg += '\n';
+          break;
+        case 'r':
+          arg += '\r';
+          break;
+        case 't':
+          arg += '\t';
+          break;
+        case 'u':
+          if (!read_hex4(line, i, cp)) {
+            return false;
+          }
+          if (cp >= 0xd800 && cp < 0xdc00) {  // surrogate pair
+            uint32_t low;
+            if (line.substr(i, 2) != "\\u" || !read_hex4(line, i += 2, low) ||
+                low < 0xdc00 || low >= 0xe000) {
+              return false;
+            }
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+          }
+          append_utf8(arg, cp);
+          break;
+        default:
+          return false;
+      }
+    }
+    ++i;
+
+    skip_spaces();
+    if (at(',')) {
+      ++i;
+    } else if (at(']')) {
+      ++i;
+      skip_spaces();
+      return i == line.size();
+    } else {
+      return false;
+    }
+  }
+}
+
+// Append arguments of command line `line` to `args`. Arguments are separated
+// by whitespace, and may be quoted in '' or "". In "", a backslash escapes a
+// following " or backslash. Returns false if a quote is not closed.
+static bool split_command_line(std::string_view line,
+                               std::vector<std::string> &args) {
+  std::string arg;
+  bool in_arg = false;
+  char quote = 0;
+  for (size_t i = 0; i < line.size(); ++i) {
+    char c = line[i];
+    if (quote == '"' && c == '\\' && i + 1 < line.size() &&
+        (line[i + 1] == '"' || line[i + 1] == '\\')) {
+      arg += line[++i];
+    } else if (quote) {
+      if (c == quote) {
+        quote = 0;
+      } else {
+        arg += c;
+      }
+    } else if (c == '\'' || c == '"') {
+      quote = c;
+      in_arg = true;
+    } else if (std::isspace(static_cast<unsigned char>(c))) {
+      if (in_arg) {
+        args.push_back(std::move(arg));
+        arg.clear();
+        in_arg = false;
+      }
+    } else {
+      arg += c;
+      in_arg = true;
+    }
+  }
+  if (quote) {
+    return false;
+  }
+  if (in_arg) {
+    args.push_back(std::move(arg));
+  }
+  return true;
+}
+
+static void parse_batch(filemod::result_base &ret, std::ostringstream &oss,
+                        po::basic_parsed_options<char> &parsed,
+                        po::variables_map &vm, std::string &dir,
+                        std::ostream &out, std::ostream &err) {
+  po::options_description desc(
+      "run commands read from a file or stdin in one process\n"
+      "Usage: filemod batch [--tx] [-f <file>]\n"
+      "Each line is a command as given to filemod, e.g. install -m 1, or a\n"
+      "JSON array of its arguments, e.g. [\"install\", \"-m\", \"1\"]. Empty\n"
+      "lines and lines starting with # are skipped. Stops at the first failed\n"
+      "command.\n"
+      "Options");
+  desc.add_options()("file,f", po::value<std::string>(&dir),
+                     "file to read commands from instead of stdin")(
+      "tx", "run all commands in one transaction, rolled back if one fails")(
+      "help,h", "");
+  parse_subcmd(desc, parsed, vm);
+
+  if (vm.count("help")) {
+    oss << desc;
+    return;
+  }
+
+  std::ifstream file;
+  if (vm.count("file")) {
+    file.open(filemod::utf8str_to_path(dir));
+    if (!file) {
+      ret.success = false;
+      ret.msg = "error: cannot open '" + dir + "'";
+      return;
+    }
+  }
+  std::istream &in = vm.count("file") ? file : std::cin;
+
+  auto run_all = [&]() -> filemod::result_base & {
+    std::string line;
+    for (size_t line_no = 1; std::getline(in, line); ++line_no) {
+      if (!line.empty() && line.back() == '\r') {
+        line.pop_back();
+      }
+      auto first = line.find_first_not_of(" \t");
+      if (first == std::string::npos || line[first] == '#') {
+        continue;
+      }
+
+      auto fail = [&](const char *what) -> filemod::result_base & {
+        ret.success = false;
+        ret.msg = "error: ";
+        ret.msg += what;
+        ret.msg += " at line " + std::to_string(line_no);
+        return ret;
+      };
+      std::vector<std::string> args{filemod::FILEMOD};
+      if (line[first] == '[' ? !split_json_args(line, args)
+                             : !split_command_line(line, args)) {
+        return fail("cannot parse command");
+      }
+      if (args.size() > 1 && ("batch" == args[1] || "serve" == args[1])) {
+        return fail("command not allowed in batch");
+      }
+
+      std::vector<char *> argv;
+      for (auto &arg : args) {
+        argv.push_back(arg.data());
+      }
+      int code;
+      try {
+        code = parse(static_cast<int>(argv.size()), argv.data(), out, err);
+      } catch (std::exception &e) {
+        err << e.what() << '\n';
+        code = 1;
+      }
+      if (code != 0) {
+        return fail("batch stopped");
+      }
+    }
+    ret.msg = "ok";
+    return ret;
+  };
+
+  if (vm.count("tx")) {
+    get_modder().transaction(run_all);
+    if (!ret.success) {
+      ret.msg += ", all changes rolled back";
+    }
+  } else {
+    run_all();
+  }
+}
+
+static int parse(int argc, char *argv[], std::ostream &out,
+                 std::ostream &err) {
   filemod::result_base ret{.success = true};
   std::ostringstream oss;
 
   po::options_description visible(
       "filemod is a file replacement manager.\n"
       "Usage: filemod <command> <args>\n"
-      " Commands: add | install | uninstall | remove | list | rename\n"
+      " Commands: add | install | uninstall | remove | list | rename | verify |\n"
+      "           status | repair | update | profile | switch | which | find |\n"
+      "           serve | batch\n"
       " filemod <command> --help to show command help.\n"
       "Common Options");
-  visible.add_options()("help,h", "")("version,v", "");
+  int lock_timeout;
+  visible.add_options()("help,h", "")("version,v", "")(
+      "lock-timeout", po::value<int>(&lock_timeout)->default_value(60),
+      "seconds to wait for other filemod processes");
 
   po::options_description hidden("command");
   hidden.add_options()("command", po::value<std::string>(), "")(
@@ -293,7 +1014,35 @@ static int parse(int argc, char *argv[]) {
     std::string dir;
     std::vector<int64_t> ids;
 
-    if ("add" == cmd) {
+    // commands only reading read the database in WAL mode without waiting for
+    // others, the rest run one at a time. A server locks for each command
+    // instead.
+    bool outermost = "serve" != cmd && !g_lock.locked();
+    bool locking = outermost && !is_read_only(cmd);
+    if (outermost) {
+      g_read_only = !locking;
+    }
+    if (locking) {
+      ret = g_lock.lock(filemod::get_lock_path(),
+                        std::chrono::seconds{lock_timeout});
+    }
+    if (outermost && ret.success && g_modder) {
+      // the database may have been changed by another process since, e.g. a
+      // batch, checked once no other can change it
+      g_modder->drop_stale_caches();
+    }
+    struct lock_scope {
+      bool owner;
+      ~lock_scope() {
+        if (owner) {
+          g_lock.unlock();
+        }
+      }
+    } scope{locking};
+
+    if (!ret.success) {
+      // not locked
+    } else if ("add" == cmd) {
       parse_add(ret, oss, parsed, vm, id, name, dir);
     } else if ("install" == cmd) {
       parse_install(ret, oss, parsed, vm, id, name, dir, ids);
@@ -302,9 +1051,29 @@ static int parse(int argc, char *argv[]) {
     } else if ("remove" == cmd) {
       parse_remove(ret, oss, parsed, vm, id, ids);
     } else if ("list" == cmd) {
-      parse_list(ret, oss, parsed, vm, ids);
+      parse_list(ret, oss, parsed, vm, ids, out);
     } else if ("rename" == cmd) {
       parse_rename(ret, oss, parsed, vm, id, name);
+    } else if ("verify" == cmd) {
+      parse_verify(ret, oss, parsed, vm, id, ids);
+    } else if ("status" == cmd) {
+      parse_status(ret, oss, parsed, vm, ids);
+    } else if ("repair" == cmd) {
+      parse_repair(ret, oss, parsed, vm, id, ids);
+    } else if ("update" == cmd) {
+      parse_update(ret, oss, parsed, vm, id, dir);
+    } else if ("profile" == cmd) {
+      parse_profile(ret, oss, parsed, vm, id, name, ids);
+    } else if ("switch" == cmd) {
+      parse_switch(ret, oss, parsed, vm, id, name);
+    } else if ("which" == cmd) {
+      parse_which(ret, oss, parsed, vm, dir);
+    } else if ("find" == cmd) {
+      parse_find(ret, oss, parsed, vm, id, name);
+    } else if ("serve" == cmd) {
+      parse_serve(ret, oss, parsed, vm);
+    } else if ("batch" == cmd) {
+      parse_batch(ret, oss, parsed, vm, dir, out, err);
     } else {
       parse_error(visible, oss, ret);
     }
@@ -317,13 +1086,41 @@ static int parse(int argc, char *argv[]) {
   }
 
   if (ret.success) {
-    std::cout << ret.msg << oss.str() << '\n';
+    out << ret.msg << oss.str() << '\n';
     return 0;
   }
-  std::cerr << ret.msg << oss.str() << '\n';
+  err << ret.msg << oss.str() << '\n';
   return 1;
 }
 
+// Run the command line by a running `filemod serve`, if any. Returns false if
+// no server is listening.
+static bool run_on_server(int argc, char *argv[], int &code) {
+  // a batch reads stdin of its own process
+  if (argc > 1 && (std::string_view{"serve"} == argv[1] ||
+                   std::string_view{"batch"} == argv[1])) {
+    return false;
+  }
+
+  filemod::ipc_request request{
+      .cwd = filemod::path_to_utf8str(std::filesystem::current_path()),
+      .args = {argv + 1, argv + argc}};
+  auto send_ret = filemod::ipc_send(filemod::get_socket_path(), request);
+  if (send_ret.success) {
+    std::cout << send_ret.data.out;
+    std::cerr << send_ret.data.err;
+    code = send_ret.data.code;
+    return true;
+  }
+  if (!send_ret.msg.empty()) {
+    // not run again in process, it may have been run
+    std::cerr << send_ret.msg << '\n';
+    code = 1;
+    return true;
+  }
+  return false;
+}
+
 int MAIN(int argc, mychar **argv) {
   setlocale(LC_CTYPE, "en_US.UTF-8");
 
@@ -346,7 +1143,10 @@ int MAIN(int argc, mychar **argv) {
 
   try {
     // args are all utf-8 encoded
-    return parse(argc, args);
+    if (int code; run_on_server(argc, args, code)) {
+      return code;
+    }
+    return parse(argc, args, std::cout, std::cerr);
   } catch (std::exception &e) {
     std::cerr << e.what() << '\n';
     return 1;